@@ -0,0 +1,240 @@
+#include "aggregate.hh"
+#include "ast.hh"
+#include "exceptions.hh"
+
+#include <algorithm>
+
+/** Shorter ranges are aggregated directly, without the tree. */
+static const unsigned int min_aggregate_rows = 8;
+
+const unsigned int aggregate_cache::block_bits;
+const unsigned int aggregate_cache::block_rows;
+
+bool aggregate_cache::block::has(unsigned int lo, unsigned int hi) const {
+	if (missing == 0) {
+		return true;
+	}
+	for (unsigned int k = lo; k < hi; k++) {
+		if (!filled[k]) {
+			return false;
+		}
+	}
+	return true;
+}
+
+void aggregate_cache::find_missing(const column &c, unsigned int level, unsigned int index, std::vector<std::pair<unsigned int, unsigned int> > &missing) {
+	unsigned long long first = static_cast<unsigned long long>(index) << level;
+	if (level > block_bits) {
+		if (c.nodes.find(std::make_pair(level, index)) == c.nodes.end()) {
+			find_missing(c, level - 1, 2 * index, missing);
+			find_missing(c, level - 1, 2 * index + 1, missing);
+		}
+		return;
+	}
+
+	auto iter = c.blocks.find(first >> block_bits);
+	unsigned int lo = first & (block_rows - 1);
+	if (iter != c.blocks.end() && iter->second->has(lo, lo + (1u << level))) {
+		return;
+	}
+	unsigned int end = first + (1ull << level);
+	if (!missing.empty() && missing.back().second == first) {
+		missing.back().second = end;
+	} else {
+		missing.push_back(std::make_pair(static_cast<unsigned int>(first), end));
+	}
+}
+
+aggregate_cache::node aggregate_cache::value(column &c, unsigned int level, unsigned int index) {
+	node ret;
+	if (level <= block_bits) {
+		unsigned long long first = static_cast<unsigned long long>(index) << level;
+		const block &b = *c.blocks.find(first >> block_bits)->second;
+		unsigned int n = (block_rows + (first & (block_rows - 1))) >> level;
+		ret.sum = b.sums[n];
+		ret.count = b.counts[n];
+		return ret;
+	}
+
+	auto key = std::make_pair(level, index);
+	auto iter = c.nodes.find(key);
+	if (iter != c.nodes.end()) {
+		return iter->second;
+	}
+	node left = value(c, level - 1, 2 * index);
+	node right = value(c, level - 1, 2 * index + 1);
+	ret.sum = left.sum + right.sum;
+	ret.count = left.count + right.count;
+	c.nodes.insert(std::make_pair(key, ret));
+	return ret;
+}
+
+void aggregate_cache::fill(unsigned int col, const std::vector<std::pair<unsigned int, unsigned int> > &rows, const environment &env, std::set<cellindex> &evaluation_stack) {
+	// Blocks touched by the rows, each with the requested rows in it.
+	std::map<unsigned int, std::vector<bool> > requested;
+	for (auto &r : rows) {
+		for (unsigned long long row = r.first; row < r.second; row++) {
+			std::vector<bool> &wanted = requested[row >> block_bits];
+			wanted.resize(block_rows);
+			wanted[row & (block_rows - 1)] = true;
+		}
+	}
+
+	for (auto &p : requested) {
+		std::shared_ptr<const block> existing;
+		{
+			std::lock_guard<std::mutex> lock(m_mutex);
+			column &c = m_columns[col];
+			auto iter = c.blocks.find(p.first);
+			if (iter != c.blocks.end()) {
+				existing = iter->second;
+			}
+		}
+
+		// Built outside of the lock, as building evaluates cells. Rows of the old block are copied.
+		std::shared_ptr<block> built = existing ? std::make_shared<block>(*existing) : std::make_shared<block>();
+		std::map<unsigned int, std::string> errors;
+		unsigned int first_row = p.first << block_bits;
+		for (unsigned int k = 0; k < block_rows; k++) {
+			cellindex i(col, first_row + k);
+			// Constants don't depend on any cell, they can be added beyond the range.
+			if (built->filled[k] || !(p.second[k] || env.is_constant(i))) {
+				continue;
+			}
+			if (evaluation_stack.find(i) != evaluation_stack.end()) {
+				throw evaluation_error("circular reference");
+			}
+			if (env.has_value(i)) {
+				try {
+					built->sums[block_rows + k] = env.find_in_range(i, evaluation_stack);
+					built->counts[block_rows + k] = 1;
+				} catch (const evaluation_error &e) {
+					errors.insert(std::make_pair(i.row, std::string(e.what())));
+				}
+			}
+			built->filled[k] = true;
+			built->missing--;
+		}
+		for (unsigned int n = block_rows - 1; n > 0; n--) {
+			built->sums[n] = built->sums[2 * n] + built->sums[2 * n + 1];
+			built->counts[n] = built->counts[2 * n] + built->counts[2 * n + 1];
+		}
+
+		std::lock_guard<std::mutex> lock(m_mutex);
+		column &c = m_columns[col];
+		std::shared_ptr<const block> &stored = c.blocks[p.first];
+		// If other thread stored more complete block first, it's kept.
+		if (!stored || stored->missing > built->missing) {
+			stored = built;
+		}
+		c.errors.insert(errors.begin(), errors.end());
+	}
+}
+
+void aggregate_cache::query(unsigned int col, unsigned int from, unsigned int to, const environment &env, std::set<cellindex> &evaluation_stack, double &sum, double &count) {
+	// The largest aligned nodes within the range, left to right.
+	std::vector<std::pair<unsigned int, unsigned int> > nodes;
+	for (unsigned long long row = from; row < to;) {
+		unsigned int level = 0;
+		while (level < 31 && row % (2ull << level) == 0 && row + (2ull << level) <= to) {
+			level++;
+		}
+		nodes.push_back(std::make_pair(level, static_cast<unsigned int>(row >> level)));
+		row += 1ull << level;
+	}
+
+	for (;;) {
+		std::vector<std::pair<unsigned int, unsigned int> > missing;
+		{
+			std::lock_guard<std::mutex> lock(m_mutex);
+			column &c = m_columns[col];
+			for (auto &n : nodes) {
+				find_missing(c, n.first, n.second, missing);
+			}
+			if (missing.empty()) {
+				auto error = c.errors.lower_bound(from);
+				if (error != c.errors.end() && error->first < to) {
+					throw evaluation_error(error->second);
+				}
+				for (auto &n : nodes) {
+					node v = value(c, n.first, n.second);
+					sum += v.sum;
+					count += v.count;
+				}
+				return;
+			}
+		}
+		fill(col, missing, env, evaluation_stack);
+	}
+}
+
+void aggregate_cache::clear() {
+	std::lock_guard<std::mutex> lock(m_mutex);
+	m_columns.clear();
+}
+
+std::size_t aggregate_cache::memory_usage() const {
+	std::lock_guard<std::mutex> lock(m_mutex);
+	std::size_t ret = tree_usage(m_columns);
+	for (auto &p : m_columns) {
+		const column &c = p.second;
+		ret += tree_usage(c.blocks) + tree_usage(c.nodes) + tree_usage(c.errors);
+		ret += c.blocks.size() * (sizeof(block) + 2 * block_rows * sizeof(double) + 2 * block_rows * sizeof(unsigned int) + block_rows / 8);
+		for (auto &e : c.errors) {
+			ret += string_usage(e.second);
+		}
+	}
+	return ret;
+}
+
+void aggregate_function::aggregate(const std::vector<astnode *> &parameters, const environment &env, std::set<cellindex> &evaluation_stack, double &sum, double &count) const {
+	for (const astnode *parameter : parameters) {
+		const astnode_range *r = dynamic_cast<const astnode_range *>(parameter);
+		if (r == nullptr) {
+			sum += parameter->evaluate(env, evaluation_stack);
+			count++;
+			continue;
+		}
+
+		env.range_dependency(r->first, r->last);
+		aggregate_cache *aggregates = env.aggregates();
+		for (unsigned int col = r->first.col; col <= r->last.col; col++) {
+			if (aggregates != nullptr && r->rows() >= min_aggregate_rows) {
+				aggregates->query(col, r->first.row, r->last.row + 1, env, evaluation_stack, sum, count);
+				continue;
+			}
+
+			for (unsigned int row = r->first.row; row <= r->last.row; row++) {
+				cellindex i(col, row);
+				if (evaluation_stack.find(i) != evaluation_stack.end()) {
+					throw evaluation_error("circular reference");
+				}
+				if (env.has_value(i)) {
+					sum += env.find_in_range(i, evaluation_stack);
+					count++;
+				}
+			}
+		}
+	}
+}
+
+double sum_function::apply(const std::vector<astnode *> &parameters, const environment &env, std::set<cellindex> &evaluation_stack) const {
+	double sum = 0, count = 0;
+	aggregate(parameters, env, evaluation_stack, sum, count);
+	return sum;
+}
+
+double average_function::apply(const std::vector<astnode *> &parameters, const environment &env, std::set<cellindex> &evaluation_stack) const {
+	double sum = 0, count = 0;
+	aggregate(parameters, env, evaluation_stack, sum, count);
+	if (count == 0) {
+		throw evaluation_error(str() + " of no numbers");
+	}
+	return sum / count;
+}
+
+double count_function::apply(const std::vector<astnode *> &parameters, const environment &env, std::set<cellindex> &evaluation_stack) const {
+	double sum = 0, count = 0;
+	aggregate(parameters, env, evaluation_stack, sum, count);
+	return count;
+}
@@ -0,0 +1,124 @@
+/** \file Range aggregates and their shared per column trees. */
+
+#ifndef AGGREGATE_HH
+#define AGGREGATE_HH
+
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "lookup.hh"
+
+/** Sums and counts of the number cells of the columns, shared by all formulas evaluated with the same state.
+ *
+ * Each column is one segment tree over all rows, built only where ranges were requested.
+ * Rows are grouped into aligned blocks of `block_rows`, each a small tree of its own,
+ * nodes above the blocks are memoized once all of their blocks are complete.
+ * Range is summed from the largest aligned nodes it contains, left to right, so the result
+ * depends only on the range, not on which ranges were aggregated before.
+ *
+ * Empty and string cells are not counted, error cells are remembered, so that aggregates
+ * over them fail with the error. Rows beyond the requested ones are added to the block
+ * only if they are constants, so extending a range over formulas costs O(block_rows),
+ * and repeated ranges over built rows cost O(log n). Forgotten with the memoized values.
+ * Thread safe.
+ */
+class aggregate_cache {
+public:
+	static const unsigned int block_bits = 8;
+	static const unsigned int block_rows = 1u << block_bits;
+
+	/** Add sum and count of rows [from, to) of the column.
+	 *
+	 * @throw evaluation_error of the first error cell of the rows, or if the cells are being evaluated (circular reference)
+	 * @throw pending_evaluation, evaluation_cancelled and then the rows are not added
+	 */
+	void query(unsigned int col, unsigned int from, unsigned int to, const environment &env, std::set<cellindex> &evaluation_stack, double &sum, double &count);
+
+	/** Forget all aggregates. */
+	void clear();
+
+	/** Memory used by the aggregates, in bytes. */
+	std::size_t memory_usage() const;
+
+private:
+	/** Tree of one block, leaf of k-th row is at `block_rows + k`, node `n` sums `2n` and `2n + 1`.
+	 * Immutable once stored, extended by copying.
+	 */
+	struct block {
+		block() : sums(2 * block_rows), counts(2 * block_rows), filled(block_rows), missing(block_rows) {}
+
+		/** Are rows [lo, hi) of the block added. */
+		bool has(unsigned int lo, unsigned int hi) const;
+
+		std::vector<double> sums;
+		std::vector<unsigned int> counts;
+		std::vector<bool> filled;
+		unsigned int missing;
+	};
+
+	/** Memoized node above the blocks. */
+	struct node {
+		double sum;
+		double count;
+	};
+
+	struct column {
+		std::map<unsigned int, std::shared_ptr<const block> > blocks;
+
+		/** Nodes above the blocks by level and index. */
+		std::map<std::pair<unsigned int, unsigned int>, node> nodes;
+
+		/** Errors by the row. */
+		std::map<unsigned int, std::string> errors;
+	};
+
+	/** Add rows of the node which are not in the blocks, as [first, end) row ranges. */
+	static void find_missing(const column &c, unsigned int level, unsigned int index, std::vector<std::pair<unsigned int, unsigned int> > &missing);
+
+	/** Sum and count of the node, all of its rows must be in the blocks. */
+	static node value(column &c, unsigned int level, unsigned int index);
+
+	/** Evaluate the rows into the blocks of the column. */
+	void fill(unsigned int col, const std::vector<std::pair<unsigned int, unsigned int> > &rows, const environment &env, std::set<cellindex> &evaluation_stack);
+
+	mutable std::mutex m_mutex;
+	std::map<unsigned int, column> m_columns;
+};
+
+/** Parent class of SUM, AVERAGE and COUNT. Parameters are ranges or numbers.
+ * Columns of the ranges are aggregated through the aggregate cache of the environment.
+ */
+class aggregate_function : public range_function {
+public:
+	aggregate_function(const std::string &name) : range_function(name, function_traits()) {}
+
+protected:
+	/** Add sum and count of the parameters. */
+	void aggregate(const std::vector<astnode *> &parameters, const environment &env, std::set<cellindex> &evaluation_stack, double &sum, double &count) const;
+};
+
+/** SUM(range or number, ...), sum of the numbers. */
+class sum_function : public aggregate_function {
+public:
+	sum_function() : aggregate_function("sum") {}
+	double apply(const std::vector<astnode *> &parameters, const environment &env, std::set<cellindex> &evaluation_stack) const;
+};
+
+/** AVERAGE(range or number, ...), average of the numbers, error if there are none. */
+class average_function : public aggregate_function {
+public:
+	average_function() : aggregate_function("average") {}
+	double apply(const std::vector<astnode *> &parameters, const environment &env, std::set<cellindex> &evaluation_stack) const;
+};
+
+/** COUNT(range or number, ...), number of the numbers. */
+class count_function : public aggregate_function {
+public:
+	count_function() : aggregate_function("count") {}
+	double apply(const std::vector<astnode *> &parameters, const environment &env, std::set<cellindex> &evaluation_stack) const;
+};
+
+#endif
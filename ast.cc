@@ -1,22 +1,34 @@
 #include "ast.hh"
 #include "functions.hh"
 #include "exceptions.hh"
+#include "parser.hh"
 
+#include "profiler.hh"
+#include "cancellation.hh"
+#include "trace.hh"
+
+#include <cctype>
+#include <chrono>
 #include <iostream>
 
 double evaluate(const astnode *node, const table<astnode *> &s) {
 	// Create helper structures and evaluate the node.
 	std::set<cellindex> evaluation_stack;
-	environment env(s);
+	table_source source(s);
+	environment env(source);
 	return node->evaluate(env, evaluation_stack);
 }
 
 /** Helper RAII class for preventing circular references = infinite loops. */
 class find_lookup {
 public:
-	/** In constructor we check that cellindex is not presend in stack, and than insert it into (push). */
-	find_lookup(const cellindex &index, std::set<cellindex> &stack) : index(index), stack(stack) {
-		if (stack.find(index) != stack.end()) {
+	/** In constructor we check that cellindex is not presend in stack, and than insert it into (push).
+	 * Cells which are not checked are not pushed either.
+	 */
+	find_lookup(const cellindex &index, std::set<cellindex> &stack, bool check = true) : index(index), stack(stack), check(check) {
+		if (!check) {
+			return;
+		} else if (stack.find(index) != stack.end()) {
 			throw evaluation_error("circular reference");
 		} else {
 			stack.insert(index);
@@ -25,25 +37,267 @@ public:
 
 	/** In destructor we remove index from stack (pop). */
 	~find_lookup() {
-		stack.erase(index);
+		if (check) {
+			stack.erase(index);
+		}
 	}
 
 private:
 	const cellindex &index;
 	std::set<cellindex> &stack;
+	bool check;
 };
 
-double environment::find(const cellindex &index, std::set<cellindex> &evaluation_stack) const {
-	// raii find lookup, so we cannot forget to remove index from stack.
-	find_lookup fl(index, evaluation_stack);
+/** Helper RAII class measuring the evaluation of the cell for the profiler.
+ * Scopes of nested evaluations form a stack, so the time of precedents can be
+ * subtracted from the exclusive time of the dependent.
+ */
+class profile_scope {
+public:
+	profile_scope(const environment &env, const cellindex &index) : env(env), index(index), parent(env.m_profile_scope), children(0) {
+		if (env.m_profiler != nullptr) {
+			start = std::chrono::steady_clock::now();
+			env.m_profile_scope = this;
+		}
+	}
+
+	~profile_scope() {
+		if (env.m_profiler != nullptr) {
+			std::chrono::duration<double, std::micro> inclusive = std::chrono::steady_clock::now() - start;
+			env.m_profiler->record(index, inclusive.count(), inclusive.count() - children);
+			if (parent != nullptr) {
+				parent->children += inclusive.count();
+			}
+			env.m_profile_scope = parent;
+		}
+	}
+
+	const cellindex &cell() const {
+		return index;
+	}
+
+private:
+	const environment &env;
+	const cellindex &index;
+	profile_scope *parent;
+	std::chrono::steady_clock::time_point start;
+
+	/** Inclusive time of the precedents, in microseconds. */
+	double children;
+};
+
+/** Helper RAII class tracking the cell being evaluated, for recording dependencies. */
+class current_cell {
+public:
+	current_cell(const environment &env, const cellindex *index) : env(env), parent(env.m_current) {
+		env.m_current = index;
+	}
+
+	~current_cell() {
+		env.m_current = parent;
+	}
+
+private:
+	const environment &env;
+	const cellindex *parent;
+};
 
+const astnode *table_source::formula(const cellindex &index) const {
 	auto iter = s.find(index);
-	if (iter == s.end()) {
+	return iter == s.end() ? nullptr : iter->second;
+}
+
+void environment::range_dependency(const cellindex &first, const cellindex &last) const {
+	if (m_dependencies != nullptr && m_current != nullptr) {
+		m_dependencies->add_range(*m_current, first, last);
+	}
+}
+
+double environment::find_in_range(const cellindex &index, std::set<cellindex> &evaluation_stack) const {
+	current_cell none(*this, nullptr);
+	return find(index, evaluation_stack);
+}
+
+bool environment::has_value(const cellindex &index) const {
+	double value;
+	return source.formula(index) != nullptr || source.constant(index, value);
+}
+
+bool environment::is_constant(const cellindex &index) const {
+	const astnode *node = source.formula(index);
+	return node == nullptr || dynamic_cast<const astnode_number *>(node) != nullptr;
+}
+
+void environment::volatile_call() const {
+	if (m_dependencies != nullptr && m_current != nullptr) {
+		m_dependencies->mark_volatile(*m_current);
+	}
+}
+
+double environment::find(const std::string &sheet, const cellindex &index) const {
+	if (m_dependencies != nullptr && m_current != nullptr) {
+		m_dependencies->mark_external(*m_current);
+	}
+	if (m_link == nullptr) {
+		throw evaluation_error("no sheet -- " + sheet);
+	}
+	return m_link->find(sheet, index);
+}
+
+double environment::find(const cellindex &index, std::set<cellindex> &evaluation_stack) const {
+	if (m_profiler != nullptr && m_profile_scope != nullptr) {
+		m_profiler->dependency(m_profile_scope->cell(), index);
+	}
+
+	if (m_dependencies != nullptr && m_current != nullptr) {
+		m_dependencies->add(*m_current, index);
+	}
+
+	cached_value cached;
+	if (cache != nullptr && cache->find(index, cached)) {
+		if (cached.error) {
+			throw evaluation_error(cached.message);
+		}
+		return cached.value;
+	}
+
+	if (m_cancellation != nullptr && m_cancellation->stopped()) {
+		throw evaluation_cancelled("cancelled before " + to_string(index));
+	}
+
+	bool check_cycles;
+	const astnode *node = source.checked_formula(index, check_cycles);
+	if (node == nullptr) {
+		// Constants are not memoized, reading them is as cheap as the cache.
+		double value;
+		if (source.constant(index, value)) {
+			return value;
+		}
 		throw evaluation_error("not formula or number cell -- " + to_string(index));
-	} else {
-		double ret = iter->second->evaluate(s, evaluation_stack);
-		return ret;
 	}
+
+	// raii find lookup, so we cannot forget to remove index from stack.
+	find_lookup fl(index, evaluation_stack, check_cycles);
+	trace_scope ts(m_tracer, "cell", &index);
+	profile_scope ps(*this, index);
+	current_cell cc(*this, &index);
+
+	if (cache == nullptr) {
+		return node->evaluate(*this, evaluation_stack);
+	}
+
+	// Errors are memoized too, so eg. circular references are found only once.
+	try {
+		cached.value = node->evaluate(*this, evaluation_stack);
+	} catch (const evaluation_error &e) {
+		cached.error = true;
+		cached.message = e.what();
+		cache->store(index, cached);
+		throw;
+	}
+	cache->store(index, cached);
+	return cached.value;
+}
+
+/** Numbers are written with as many digits as needed to parse back to the same value. */
+std::ostream &astnode_number::write_formula(std::ostream &os, const function_registry &functions) const {
+	std::ostringstream oss;
+	oss.precision(15);
+	oss << value;
+
+	std::istringstream iss(oss.str());
+	double parsed;
+	if (!(iss >> parsed) || parsed != value) {
+		oss.str("");
+		oss.precision(17);
+		oss << value;
+	}
+	return os << oss.str();
+}
+
+astnode *astnode_cell::rewrite(const reference_shift &shift) const {
+	if (!shift.local) {
+		return nullptr;
+	}
+	if (shift.deletes(index)) {
+		return new astnode_ref_error();
+	}
+	if (shift.moves(index)) {
+		return new astnode_cell(shift.apply(index));
+	}
+	return nullptr;
+}
+
+/** Sheet names are case insensitive. */
+static bool same_sheet(const std::string &a, const std::string &b) {
+	if (a.size() != b.size()) {
+		return false;
+	}
+	for (std::size_t k = 0; k < a.size(); k++) {
+		if (std::toupper(static_cast<unsigned char>(a[k])) != std::toupper(static_cast<unsigned char>(b[k]))) {
+			return false;
+		}
+	}
+	return true;
+}
+
+astnode *astnode_sheet_cell::rewrite(const reference_shift &shift) const {
+	if (shift.sheet.empty() || !same_sheet(sheet, shift.sheet)) {
+		return nullptr;
+	}
+	if (shift.deletes(index)) {
+		return new astnode_ref_error();
+	}
+	if (shift.moves(index)) {
+		return new astnode_sheet_cell(sheet, shift.apply(index));
+	}
+	return nullptr;
+}
+
+double astnode_ref_error::evaluate(const environment &env, std::set<cellindex> &evaluation_stack) const {
+	throw evaluation_error("reference to deleted cell");
+}
+
+double astnode_range::evaluate(const environment &env, std::set<cellindex> &evaluation_stack) const {
+	throw evaluation_error("range is not a number -- " + to_string(first) + ":" + to_string(last));
+}
+
+/** Shift of interval [lo, hi] of rows or columns, returns false if all of it is deleted. */
+static bool shift_interval(const reference_shift &shift, unsigned int &lo, unsigned int &hi) {
+	if (shift.insert) {
+		if (lo >= shift.at) lo += shift.count;
+		if (hi >= shift.at) hi += shift.count;
+		return true;
+	}
+
+	unsigned int end = shift.at + shift.count;
+	if (lo >= shift.at && hi < end) {
+		return false;
+	}
+	// first row after the deleted ones moves to `at`
+	if (lo >= end) lo -= shift.count; else if (lo > shift.at) lo = shift.at;
+	if (hi >= end) hi -= shift.count; else if (hi >= shift.at) hi = shift.at - 1;
+	return true;
+}
+
+astnode *astnode_range::rewrite(const reference_shift &shift) const {
+	if (!shift.local) {
+		return nullptr;
+	}
+	bool rows = shift.axis == reference_shift::rows;
+	unsigned int lo = rows ? first.row : first.col;
+	unsigned int hi = rows ? last.row : last.col;
+	unsigned int old_lo = lo, old_hi = hi;
+	if (!shift_interval(shift, lo, hi)) {
+		return new astnode_ref_error();
+	}
+	if (lo == old_lo && hi == old_hi) {
+		return nullptr;
+	}
+	if (rows) {
+		return new astnode_range(cellindex(first.col, lo), cellindex(last.col, hi));
+	}
+	return new astnode_range(cellindex(lo, first.row), cellindex(hi, last.row));
 }
 
 double astnode_cell::evaluate(const environment &env, std::set<cellindex> &evaluation_stack) const {
@@ -51,9 +305,168 @@ double astnode_cell::evaluate(const environment &env, std::set<cellindex> &evalu
 }
 
 double astnode_call::evaluate(const environment &env, std::set<cellindex> &evaluation_stack) const {
+	// Same semantics as the apply of built-in functions, parameters are evaluated left to right.
+	switch (m_op) {
+	case op_add: {
+		double ret = 0;
+		for (astnode *node : m_parameters) {
+			ret += node->evaluate(env, evaluation_stack);
+		}
+		return ret;
+	}
+	case op_mul: {
+		double ret = 1;
+		for (astnode *node : m_parameters) {
+			ret *= node->evaluate(env, evaluation_stack);
+		}
+		return ret;
+	}
+	case op_sub:
+	case op_div: {
+		if (m_parameters.size() == 0) { return 1; }
+
+		double ret = m_parameters[0]->evaluate(env, evaluation_stack);
+		if (m_parameters.size() == 1) {
+			return m_op == op_sub ? -ret : 1 / ret;
+		}
+
+		for (auto iter = ++m_parameters.begin(); iter != m_parameters.end(); ++iter) {
+			double d = (*iter)->evaluate(env, evaluation_stack);
+			if (m_op == op_sub) {
+				ret -= d;
+			} else {
+				ret /= d;
+			}
+		}
+		return ret;
+	}
+	case op_none:
+		break;
+	}
+	if (m_function->traits().is_volatile) {
+		env.volatile_call();
+	}
 	return m_function->apply(m_parameters, env, evaluation_stack);
 }
 
+astnode *astnode_call::clone() const {
+	std::vector<astnode *> parameters;
+	for (auto &parameter : m_parameters) {
+		parameters.push_back(parameter->clone());
+	}
+	return new astnode_call(m_function, parameters, m_id);
+}
+
+void astnode_call::sheets(std::set<std::string> &names) const {
+	for (auto &parameter : m_parameters) {
+		parameter->sheets(names);
+	}
+}
+
+bool astnode_call::references(std::vector<cellindex> &cells) const {
+	if (m_op == op_none && !m_function->traits().pure) {
+		return false;
+	}
+	for (auto &parameter : m_parameters) {
+		if (!parameter->references(cells)) {
+			return false;
+		}
+	}
+	return true;
+}
+
+std::size_t astnode_call::memory_usage() const {
+	std::size_t ret = sizeof(*this) + m_parameters.capacity() * sizeof(astnode *);
+	for (auto &parameter : m_parameters) {
+		ret += parameter->memory_usage();
+	}
+	return ret;
+}
+
+bool astnode_call::vectorize(const cellindex &at, column_kernel &kernel) const {
+	if (m_op == op_none) {
+		return false;
+	}
+	for (auto &parameter : m_parameters) {
+		if (!parameter->vectorize(at, kernel)) {
+			return false;
+		}
+	}
+	kernel.push_operation(m_op, m_parameters.size());
+	return true;
+}
+
+astnode *astnode_call::rewrite(const reference_shift &shift) const {
+	std::vector<astnode *> parameters;
+	bool changed = false;
+	for (auto &parameter : m_parameters) {
+		astnode *rewritten = parameter->rewrite(shift);
+		changed = changed || rewritten != nullptr;
+		parameters.push_back(rewritten);
+	}
+
+	if (!changed) {
+		return nullptr;
+	}
+
+	// unchanged parameters are copied, as the new node owns its parameters
+	for (std::size_t k = 0; k < parameters.size(); k++) {
+		if (parameters[k] == nullptr) {
+			parameters[k] = m_parameters[k]->clone();
+		}
+	}
+	return new astnode_call(m_function, parameters, m_id);
+}
+
+int astnode_call::precedence(const function_registry &functions) const {
+	if (m_id == function_registry::npos || m_parameters.size() != 2) {
+		return 0;
+	}
+
+	const std::string &name = functions.name(m_id);
+	if (name == "+" || name == "-") {
+		return 1;
+	} else if (name == "*" || name == "/") {
+		return 2;
+	}
+	return 0;
+}
+
+/** Operators are left associative, so the right operand of the same precedence needs parentheses. */
+std::ostream &astnode_call::write_formula(std::ostream &os, const function_registry &functions) const {
+	const std::string &name = m_id == function_registry::npos ? m_function->str() : functions.name(m_id);
+
+	int p = precedence(functions);
+	if (p == 0) {
+		os << name << '(';
+		for (std::size_t k = 0; k < m_parameters.size(); k++) {
+			if (k != 0) {
+				os << ", ";
+			}
+			m_parameters[k]->write_formula(os, functions);
+		}
+		return os << ')';
+	}
+
+	for (std::size_t k = 0; k < 2; k++) {
+		auto call = dynamic_cast<const astnode_call *>(m_parameters[k]);
+		int operand_precedence = call == nullptr ? 0 : call->precedence(functions);
+		bool parens = operand_precedence != 0 && (k == 0 ? operand_precedence < p : operand_precedence <= p);
+
+		if (k != 0) {
+			os << ' ' << name << ' ';
+		}
+		if (parens) {
+			os << '(';
+		}
+		m_parameters[k]->write_formula(os, functions);
+		if (parens) {
+			os << ')';
+		}
+	}
+	return os;
+}
+
 std::ostream &astnode_call::write(std::ostream &os) const {
 	os << '(' << m_function->str();
 	for (auto &rand : m_parameters) {
@@ -63,3 +476,82 @@ std::ostream &astnode_call::write(std::ostream &os) const {
 	os << ')';
 	return os;
 }
+
+const astnode *astnode_lazy::compile() const {
+	std::call_once(m_parsed, [this]() {
+		try {
+			m_compiled = parse(m_input, *m_functions);
+		} catch (const syntax_error &e) {
+			m_error = e.what();
+		} catch (const not_formula_error &e) {
+			m_error = e.what();
+		}
+	});
+	return m_compiled;
+}
+
+double astnode_lazy::evaluate(const environment &env, std::set<cellindex> &evaluation_stack) const {
+	const astnode *node = compile();
+	if (node == nullptr) {
+		// same as in eager mode, where cells with syntax error have no ast.
+		throw evaluation_error("not formula or number cell -- " + to_string(m_index));
+	}
+	return node->evaluate(env, evaluation_stack);
+}
+
+std::ostream &astnode_lazy::write(std::ostream &os) const {
+	const astnode *node = compile();
+	if (node != nullptr) {
+		return node->write(os);
+	}
+	return os << m_input;
+}
+
+std::ostream &astnode_lazy::write_formula(std::ostream &os, const function_registry &functions) const {
+	const astnode *node = compile();
+	if (node != nullptr) {
+		return node->write_formula(os, functions);
+	}
+	// strip =
+	return os << m_input.substr(1);
+}
+
+astnode *astnode_lazy::clone() const {
+	return new astnode_lazy(m_input, m_functions, m_index);
+}
+
+astnode *astnode_lazy::rewrite(const reference_shift &shift) const {
+	const astnode *node = compile();
+	if (node != nullptr) {
+		return node->rewrite(shift);
+	}
+
+	// Formula with syntax error, only the index used in error messages is moved.
+	if (shift.local && shift.moves(m_index)) {
+		return new astnode_lazy(m_input, m_functions, shift.apply(m_index));
+	}
+	return nullptr;
+}
+
+void astnode_lazy::sheets(std::set<std::string> &names) const {
+	const astnode *node = compile();
+	if (node != nullptr) {
+		node->sheets(names);
+	}
+}
+
+bool astnode_lazy::vectorize(const cellindex &at, column_kernel &kernel) const {
+	const astnode *node = compile();
+	return node != nullptr && node->vectorize(at, kernel);
+}
+
+bool astnode_lazy::references(std::vector<cellindex> &cells) const {
+	const astnode *node = compile();
+	return node == nullptr || node->references(cells);
+}
+
+std::size_t astnode_lazy::memory_usage() const {
+	// Error message is written during compilation, so it is not counted.
+	const astnode *node = m_compiled;
+	return sizeof(*this) + string_usage(m_input) + (node != nullptr ? node->memory_usage() : 0);
+}
@@ -8,7 +8,15 @@
 
 #include "definitions.hh"
 #include "table.hh"
+#include "cache.hh"
+#include "functions.hh"
+#include "registry.hh"
+#include "kernel.hh"
 
+#include <algorithm>
+#include <atomic>
+#include <memory>
+#include <mutex>
 #include <ostream>
 #include <set>
 #include <vector>
@@ -32,30 +40,247 @@ public:
 	 */
 	virtual std::ostream &write(std::ostream &os) const = 0;
 
+	/** Write node as formula text (without leading `=`), that parses back to equal node.
+	 * Function names are taken from the registry the node was parsed with.
+	 */
+	virtual std::ostream &write_formula(std::ostream &os, const function_registry &functions) const = 0;
+
 	/** Evaluate node. */
 	virtual double evaluate(const environment &env, std::set<cellindex> &evaluation_stack) const = 0;
 
+	/** Deep copy of the node. */
+	virtual astnode *clone() const = 0;
+
+	/** Copy of the node with cell references moved by the shift.
+	 * Returns nullptr if no reference is changed, so unchanged nodes can be shared.
+	 */
+	virtual astnode *rewrite(const reference_shift &shift) const = 0;
+
+	/** Collect names of the sheets referenced by the formula. */
+	virtual void sheets(std::set<std::string> &names) const {}
+
+	/** Memory used by the node and its children, in bytes. */
+	virtual std::size_t memory_usage() const = 0;
+
+	/** Compile the node into the kernel, relative to the row of formula cell `at`.
+	 * Returns false if the node can't be compiled, the kernel is not usable then.
+	 */
+	virtual bool vectorize(const cellindex &at, column_kernel &kernel) const { return false; }
+
+	/** Collect the cells the formula refers to. Returns false if they are not known
+	 * before evaluation, eg. cells of ranges or cells used by impure functions.
+	 */
+	virtual bool references(std::vector<cellindex> &cells) const { return false; }
+
 	// Virtual destructor!
 	virtual ~astnode() {}
 };
 
-/** Evaluation environment. Abstracts table of `astnode`. 
+/** Moving of the cells by inserting or deleting rows or columns. */
+struct reference_shift {
+	enum axis_type {
+		rows,
+		columns
+	};
+
+	reference_shift(axis_type axis, unsigned int at, unsigned int count, bool insert) : axis(axis), at(at), count(count), insert(insert), local(true) {}
+
+	/** Is the cell deleted by the shift. */
+	bool deletes(const cellindex &index) const {
+		unsigned int i = axis == rows ? index.row : index.col;
+		return !insert && i >= at && i - at < count;
+	}
+
+	/** Is the cell moved by the shift. */
+	bool moves(const cellindex &index) const {
+		unsigned int i = axis == rows ? index.row : index.col;
+		return i >= at && !deletes(index);
+	}
+
+	/** New index of the moved (not deleted) cell. */
+	cellindex apply(const cellindex &index) const {
+		if (!moves(index)) {
+			return index;
+		}
+		unsigned int delta = insert ? count : -count;
+		if (axis == rows) {
+			return cellindex(index.col, index.row + delta);
+		} else {
+			return cellindex(index.col + delta, index.row);
+		}
+	}
+
+	axis_type axis;
+	unsigned int at;
+	unsigned int count;
+	bool insert;
+
+	/** Name of the shifted sheet of workbook, references to it eg. Sheet1!A5 are rewritten too.
+	 * Empty if the sheet is not in workbook.
+	 */
+	std::string sheet;
+
+	/** References without sheet are to the shifted sheet, false when rewriting the other sheets. */
+	bool local;
+};
+
+/** Source of compiled formulas for the evaluation environment. */
+class formula_source {
+public:
+	virtual ~formula_source() {}
+
+	/** Compiled formula (or number) of the cell, nullptr if cell is not formula or number cell. */
+	virtual const astnode *formula(const cellindex &index) const = 0;
+
+	/** Formula of the cell, and whether evaluation has to check it for circular references.
+	 * Cells which can't be on a cycle of references are not checked.
+	 */
+	virtual const astnode *checked_formula(const cellindex &index, bool &check_cycles) const {
+		check_cycles = true;
+		return formula(index);
+	}
+
+	/** Value of constant cell without formula, eg. in compressed region. Returns false if there is none. */
+	virtual bool constant(const cellindex &index, double &value) const {
+		return false;
+	}
+};
+
+/** Formula source for plain table of `astnode`. */
+class table_source : public formula_source {
+public:
+	table_source(const table<astnode *> &s) : s(s) {}
+	const astnode *formula(const cellindex &index) const;
+private:
+	const table<astnode *> &s;
+};
+
+/** Evaluates cells of other sheets, for references like Sheet2!A1. */
+class sheet_link {
+public:
+	virtual ~sheet_link() {}
+
+	/** Evaluate cell of the named sheet.
+	 *
+	 * @throw evaluation_error if there is no such sheet, or the cell can't be evaluated
+	 */
+	virtual double find(const std::string &sheet, const cellindex &index) const = 0;
+};
+
+/** Evaluation environment. Abstracts the source of `astnode`s.
  *
  * \see astnode
  */
 class environment {
 public:
-	/** Takes table of `astnode`. This might change.
+	/** Takes source of `astnode`s.
+	 * If cache is given, evaluated values (and errors) are memoized in it.
 	 *
 	 * \sa astnode
 	 */
-	environment(const table<astnode *> &s) : s(s) {}
+	environment(const formula_source &source, value_cache *cache = nullptr)
+		: source(source), cache(cache), m_profiler(nullptr), m_async(nullptr), m_cancellation(nullptr), m_dependencies(nullptr), m_link(nullptr), m_lookups(nullptr), m_aggregates(nullptr), m_tracer(nullptr), m_current(nullptr), m_profile_scope(nullptr) {}
+
+	/** Record evaluation times of cells and their dependencies into the profiler. */
+	void set_profiler(profiler *p) {
+		m_profiler = p;
+	}
+
+	/** Track asynchronous calls, so that evaluation doesn't wait for them.
+	 * Without it asynchronous functions are applied synchronously.
+	 */
+	void set_async_calls(async_calls *calls) {
+		m_async = calls;
+	}
+
+	async_calls *async() const {
+		return m_async;
+	}
+
+	/** Stop evaluation of not yet memoized cells when cancelled. */
+	void set_cancellation(const cancellation *c) {
+		m_cancellation = c;
+	}
+
+	/** Record dependencies between cells and calls of volatile functions. */
+	void set_dependencies(dependency_graph *dependencies) {
+		m_dependencies = dependencies;
+	}
+
+	/** Evaluate references to other sheets through the link. */
+	void set_sheet_link(const sheet_link *link) {
+		m_link = link;
+	}
+
+	/** Search for the cell of other sheet and evaluate it. */
+	double find(const std::string &sheet, const cellindex &index) const;
+
+	/** Record that the cell being evaluated depends on all cells of the range. */
+	void range_dependency(const cellindex &first, const cellindex &last) const;
+
+	/** Evaluate cell of the range recorded by `range_dependency`, without recording dependency on the cell itself. */
+	double find_in_range(const cellindex &index, std::set<cellindex> &evaluation_stack) const;
+
+	/** Search indexes of lookup functions, shared by all formulas. */
+	void set_lookup_cache(lookup_cache *lookups) {
+		m_lookups = lookups;
+	}
+
+	lookup_cache *lookups() const {
+		return m_lookups;
+	}
+
+	/** Aggregates of columns for range functions, shared by all formulas. */
+	void set_aggregate_cache(aggregate_cache *aggregates) {
+		m_aggregates = aggregates;
+	}
+
+	aggregate_cache *aggregates() const {
+		return m_aggregates;
+	}
+
+	/** Record spans of cell evaluations into the tracer. */
+	void set_tracer(tracer *t) {
+		m_tracer = t;
+	}
+
+	tracer *trace() const {
+		return m_tracer;
+	}
+
+	/** Cell has formula or number, empty and string cells have no value. */
+	bool has_value(const cellindex &index) const;
+
+	/** Cell has no formula, so its value doesn't depend on other cells. */
+	bool is_constant(const cellindex &index) const;
+
+	/** Called when volatile function is applied, marks the cell being evaluated. */
+	void volatile_call() const;
 
 	/** Search for the cell in environment and evaluate it. */
 	double find(const cellindex &index, std::set<cellindex> &evaluation_stack) const;
 
 private:
-	const table<astnode *> &s;
+	friend class profile_scope;
+	friend class current_cell;
+
+	const formula_source &source;
+	value_cache *cache;
+
+	profiler *m_profiler;
+	async_calls *m_async;
+	const cancellation *m_cancellation;
+	dependency_graph *m_dependencies;
+	const sheet_link *m_link;
+	lookup_cache *m_lookups;
+	aggregate_cache *m_aggregates;
+	tracer *m_tracer;
+
+	/** Cell being evaluated, nullptr at the top level. */
+	mutable const cellindex *m_current;
+
+	/** Innermost cell being profiled. */
+	mutable profile_scope *m_profile_scope;
 };
 
 /** Scalar number eg 0 or 1. */
@@ -65,7 +290,16 @@ public:
 	std::ostream &write(std::ostream &os) const {
 		return os << value;
 	}
+	std::ostream &write_formula(std::ostream &os, const function_registry &functions) const;
 	double evaluate(const environment &env, std::set<cellindex> &evaluation_stack) const { return value; }
+	astnode *clone() const { return new astnode_number(value); }
+	astnode *rewrite(const reference_shift &shift) const { return nullptr; }
+	std::size_t memory_usage() const { return sizeof(*this); }
+	bool vectorize(const cellindex &at, column_kernel &kernel) const {
+		kernel.push_constant(value);
+		return true;
+	}
+	bool references(std::vector<cellindex> &cells) const { return true; }
 private:
 	double value;
 };
@@ -77,20 +311,110 @@ public:
 	std::ostream &write(std::ostream &os) const {
 		return os << index;
 	}
+	std::ostream &write_formula(std::ostream &os, const function_registry &functions) const {
+		return os << index;
+	}
+	double evaluate(const environment &env, std::set<cellindex> &evaluation_stack) const;
+	astnode *clone() const { return new astnode_cell(index); }
+	astnode *rewrite(const reference_shift &shift) const;
+	std::size_t memory_usage() const { return sizeof(*this); }
+	bool vectorize(const cellindex &at, column_kernel &kernel) const {
+		kernel.push_input(index.col, static_cast<long long>(index.row) - at.row);
+		return true;
+	}
+	bool references(std::vector<cellindex> &cells) const {
+		cells.push_back(index);
+		return true;
+	}
+private:
+	cellindex index;
+};
+
+/** Rectangle of cells eg A1:B10, parameter of functions working on ranges.
+ * Range has no number value.
+ */
+class astnode_range : public astnode {
+public:
+	/** Corners are normalized, so that first is the top left one. */
+	astnode_range(const cellindex &a, const cellindex &b)
+		: first(std::min(a.col, b.col), std::min(a.row, b.row)), last(std::max(a.col, b.col), std::max(a.row, b.row)) {}
+	std::ostream &write(std::ostream &os) const {
+		return os << first << ':' << last;
+	}
+	std::ostream &write_formula(std::ostream &os, const function_registry &functions) const {
+		return os << first << ':' << last;
+	}
 	double evaluate(const environment &env, std::set<cellindex> &evaluation_stack) const;
+	astnode *clone() const { return new astnode_range(first, last); }
+
+	/** Range shrinks when its rows or columns are deleted, and grows on insertion inside it. */
+	astnode *rewrite(const reference_shift &shift) const;
+	std::size_t memory_usage() const { return sizeof(*this); }
+
+	unsigned int cols() const { return last.col - first.col + 1; }
+	unsigned int rows() const { return last.row - first.row + 1; }
+
+	const cellindex first;
+	const cellindex last;
+};
+
+/** Cell of other sheet eg Sheet2!A1. */
+class astnode_sheet_cell : public astnode {
+public:
+	astnode_sheet_cell(const std::string &sheet, const cellindex &index) : sheet(sheet), index(index) {}
+	std::ostream &write(std::ostream &os) const {
+		return os << sheet << '!' << index;
+	}
+	std::ostream &write_formula(std::ostream &os, const function_registry &functions) const {
+		return os << sheet << '!' << index;
+	}
+	double evaluate(const environment &env, std::set<cellindex> &evaluation_stack) const {
+		return env.find(sheet, index);
+	}
+	astnode *clone() const { return new astnode_sheet_cell(sheet, index); }
+
+	/** Rewritten only when the shifted sheet is the referenced one. */
+	astnode *rewrite(const reference_shift &shift) const;
+
+	void sheets(std::set<std::string> &names) const {
+		names.insert(sheet);
+	}
+	std::size_t memory_usage() const { return sizeof(*this) + string_usage(sheet); }
 private:
+	std::string sheet;
 	cellindex index;
 };
 
+/** Reference to the cell which was deleted. */
+class astnode_ref_error : public astnode {
+public:
+	std::ostream &write(std::ostream &os) const {
+		return os << "#REF!";
+	}
+	std::ostream &write_formula(std::ostream &os, const function_registry &functions) const {
+		return os << "#REF!";
+	}
+	double evaluate(const environment &env, std::set<cellindex> &evaluation_stack) const;
+	astnode *clone() const { return new astnode_ref_error(); }
+	astnode *rewrite(const reference_shift &shift) const { return nullptr; }
+	std::size_t memory_usage() const { return sizeof(*this); }
+	bool references(std::vector<cellindex> &cells) const { return true; }
+};
+
 /** The only compound ast node, the function (or operator) call.
  * Both operations (1 + 1) and function calls (SUM(1, 1)) are represented by this.
  * We could have separate node types for different operations, but in this way
  * structure is more light.
+ *
+ * Built-in operations are dispatched on the opcode of the function, without virtual calls.
  */
 class astnode_call : public astnode {
 public:
-	astnode_call(function *f, const std::vector<astnode *> &rands) : m_function(f), m_parameters(rands) {}
-	astnode_call(function *f, astnode *left, astnode *right) : m_function(f) {
+	/** Id is the id of the function in the registry the node is parsed with, used to write formula. */
+	astnode_call(function *f, const std::vector<astnode *> &rands, unsigned int id = function_registry::npos)
+		: m_function(f), m_op(f->traits().op), m_id(id), m_parameters(rands) {}
+	astnode_call(function *f, astnode *left, astnode *right, unsigned int id = function_registry::npos)
+		: m_function(f), m_op(f->traits().op), m_id(id) {
 		m_parameters.push_back(left);
 		m_parameters.push_back(right);
 	}
@@ -100,10 +424,86 @@ public:
 		}
 	}
 	std::ostream &write(std::ostream &os) const;
+	std::ostream &write_formula(std::ostream &os, const function_registry &functions) const;
 	double evaluate(const environment &env, std::set<cellindex> &evaluation_stack) const;
+	astnode *clone() const;
+	astnode *rewrite(const reference_shift &shift) const;
+	void sheets(std::set<std::string> &names) const;
+	std::size_t memory_usage() const;
+
+	/** Only built-in operations are compiled. */
+	bool vectorize(const cellindex &at, column_kernel &kernel) const;
+
+	/** References of built-in operations and pure functions are their parameters' references. */
+	bool references(std::vector<cellindex> &cells) const;
 private:
+	/** Binding strength of the operator for writing formula, 0 if it is not written as operator. */
+	int precedence(const function_registry &functions) const;
+
 	function *m_function;
+	opcode m_op;
+	unsigned int m_id;
 	std::vector<astnode *> m_parameters;
 };
 
+/** Formula which is parsed only when first needed, for evaluation or for the references.
+ * Used by lazy spreadsheets, so bulk loading does not pay for parsing cells
+ * which are never evaluated. Result of the parse (also syntax error) is cached.
+ * Compilation is thread safe, as concurrent readers may evaluate the same cell.
+ */
+class astnode_lazy : public astnode {
+public:
+	astnode_lazy(const std::string &input, const std::shared_ptr<const function_registry> &functions, const cellindex &index)
+		: m_input(input), m_functions(functions), m_index(index), m_compiled(nullptr) {}
+	~astnode_lazy() {
+		delete m_compiled;
+	}
+
+	/** Writes compiled node, or formula text if it has syntax error. */
+	std::ostream &write(std::ostream &os) const;
+
+	/** Writes compiled node, or formula text if it has syntax error. */
+	std::ostream &write_formula(std::ostream &os, const function_registry &functions) const;
+
+	/** Compile and evaluate. Cell with syntax error is not formula cell for the referrers. */
+	double evaluate(const environment &env, std::set<cellindex> &evaluation_stack) const;
+
+	/** Parse the formula if not done yet.
+	 *
+	 * @return compiled node or nullptr if there is syntax error.
+	 */
+	const astnode *compile() const;
+
+	astnode *clone() const;
+
+	/** Compiles the formula to rewrite it. Formula with syntax error is kept as it is. */
+	astnode *rewrite(const reference_shift &shift) const;
+
+	/** Compiles the formula to collect the sheets. */
+	void sheets(std::set<std::string> &names) const;
+
+	/** Includes the compiled node if it is compiled already, doesn't compile. */
+	std::size_t memory_usage() const;
+
+	/** Compiles the formula to vectorize it. */
+	bool vectorize(const cellindex &at, column_kernel &kernel) const;
+
+	/** Compiles the formula to collect the references. Formula with syntax error refers to nothing. */
+	bool references(std::vector<cellindex> &cells) const;
+
+	/** Syntax error message, non empty only after failed compile. */
+	const std::string &syntax_error_message() const {
+		return m_error;
+	}
+
+private:
+	std::string m_input;
+	std::shared_ptr<const function_registry> m_functions;
+	cellindex m_index;
+
+	mutable std::once_flag m_parsed;
+	mutable std::atomic<astnode *> m_compiled;
+	mutable std::string m_error;
+};
+
 #endif
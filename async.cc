@@ -0,0 +1,147 @@
+#include "async.hh"
+#include "ast.hh"
+#include "exceptions.hh"
+#include "cancellation.hh"
+
+void async_result::resolve(double value) {
+	m_value = value;
+	complete(resolved);
+}
+
+void async_result::reject(const std::string &message) {
+	m_message = message;
+	complete(rejected);
+}
+
+void async_result::complete(state s) {
+	m_state.store(s, std::memory_order_release);
+
+	// Taking the lock, so waiter can't miss the notification between its check and wait.
+	{
+		std::lock_guard<std::mutex> lock(m_signal->mutex);
+	}
+	m_signal->completed.notify_all();
+}
+
+double async_result::wait() const {
+	std::unique_lock<std::mutex> lock(m_signal->mutex);
+	m_signal->completed.wait(lock, [this]() { return completed(); });
+	lock.unlock();
+	return value();
+}
+
+double async_result::value() const {
+	if (m_state.load(std::memory_order_acquire) == rejected) {
+		throw evaluation_error(m_message);
+	}
+	return m_value;
+}
+
+double async_function::apply(const std::vector<astnode *> &parameters, const environment &env, std::set<cellindex> &evaluation_stack) const {
+	async_calls *calls = env.async();
+	if (calls == nullptr) {
+		return strict_function::apply(parameters, env, evaluation_stack);
+	}
+
+	std::vector<double> double_parameters;
+	for (astnode *node : parameters) {
+		double_parameters.push_back(node->evaluate(env, evaluation_stack));
+	}
+
+	std::shared_ptr<async_result> result = calls->call(this, double_parameters);
+	if (!result->completed()) {
+		throw pending_evaluation(str() + " is pending");
+	}
+	return result->value();
+}
+
+double async_function::apply(const std::vector<double> &parameters) const {
+	auto result = std::make_shared<async_result>(std::make_shared<async_signal>());
+	start(parameters, result);
+	return result->wait();
+}
+
+std::shared_ptr<async_result> async_calls::call(const async_function *f, const std::vector<double> &parameters) {
+	std::shared_ptr<async_result> result;
+	{
+		std::lock_guard<std::mutex> lock(m_signal->mutex);
+		auto iter = m_calls.find(key(f, parameters));
+		if (iter != m_calls.end()) {
+			return iter->second;
+		}
+
+		result = std::make_shared<async_result>(m_signal);
+		m_calls.insert(std::make_pair(key(f, parameters), result));
+	}
+
+	// Outside of the lock, as the function may complete the result immediately.
+	f->start(parameters, result);
+	return result;
+}
+
+std::size_t async_calls::running() const {
+	std::lock_guard<std::mutex> lock(m_signal->mutex);
+	std::size_t ret = 0;
+	for (auto &p : m_calls) {
+		if (!p.second->completed()) {
+			ret++;
+		}
+	}
+	return ret;
+}
+
+void async_calls::wait_any(const cancellation *c) const {
+	std::unique_lock<std::mutex> lock(m_signal->mutex);
+
+	std::vector<std::shared_ptr<async_result> > running;
+	for (auto &p : m_calls) {
+		if (!p.second->completed()) {
+			running.push_back(p.second);
+		}
+	}
+
+	auto any_completed = [&running]() {
+		for (auto &result : running) {
+			if (result->completed()) {
+				return true;
+			}
+		}
+		return running.empty();
+	};
+
+	if (c == nullptr) {
+		m_signal->completed.wait(lock, any_completed);
+		return;
+	}
+
+	// Cancelling doesn't notify, so it's polled.
+	const std::chrono::milliseconds poll(10);
+	while (!any_completed() && !c->stopped()) {
+		cancellation::clock::time_point until = cancellation::clock::now() + poll;
+		if (c->has_deadline() && c->deadline() < until) {
+			until = c->deadline();
+		}
+		m_signal->completed.wait_until(lock, until);
+	}
+}
+
+void async_calls::forget_completed(bool all) {
+	std::lock_guard<std::mutex> lock(m_signal->mutex);
+	for (auto iter = m_calls.begin(); iter != m_calls.end();) {
+		if (iter->second->completed() && (all || !iter->first.first->traits().pure)) {
+			iter = m_calls.erase(iter);
+		} else {
+			++iter;
+		}
+	}
+}
+
+std::size_t async_calls::memory_usage() const {
+	std::lock_guard<std::mutex> lock(m_signal->mutex);
+	std::size_t ret = tree_usage(m_calls);
+	for (auto &p : m_calls) {
+		// parameters, and result with its control block
+		ret += p.first.second.capacity() * sizeof(double) + 2 * sizeof(void *) + p.second->memory_usage();
+	}
+	return ret;
+}
@@ -0,0 +1,122 @@
+/** \file Asynchronous functions. */
+
+#ifndef ASYNC_HH
+#define ASYNC_HH
+
+#include <atomic>
+#include <condition_variable>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "functions.hh"
+
+/** Lock and condition signalled when any asynchronous result is completed. */
+struct async_signal {
+	std::mutex mutex;
+	std::condition_variable completed;
+};
+
+/** Result of asynchronous call, completed later by the function from any thread. */
+class async_result {
+public:
+	async_result(const std::shared_ptr<async_signal> &signal) : m_state(running), m_value(0), m_signal(signal) {}
+
+	/** Complete with value. */
+	void resolve(double value);
+
+	/** Complete with evaluation error. */
+	void reject(const std::string &message);
+
+	bool completed() const {
+		return m_state.load(std::memory_order_acquire) != running;
+	}
+
+	/** Wait for completion, and return the value.
+	 * @throw evaluation_error if the call was rejected
+	 */
+	double wait() const;
+
+	/** Value of completed call.
+	 * @throw evaluation_error if the call was rejected
+	 */
+	double value() const;
+
+	/** Memory used by the result, in bytes. Message is counted only when completed. */
+	std::size_t memory_usage() const {
+		return sizeof(*this) + (completed() ? string_usage(m_message) : 0);
+	}
+
+private:
+	enum state {
+		running,
+		resolved,
+		rejected
+	};
+
+	void complete(state s);
+
+	std::atomic<int> m_state;
+	double m_value;
+	std::string m_message;
+	std::shared_ptr<async_signal> m_signal;
+};
+
+/** Function whose result is delivered later, eg. lookup in slow external service.
+ * Parameters are evaluated strictly. When evaluation environment tracks asynchronous calls,
+ * call is started and evaluation of the dependent cells is suspended until the result is delivered,
+ * otherwise the evaluation waits for the result.
+ *
+ * \sa async_calls
+ */
+class async_function : public strict_function {
+public:
+	async_function(const std::string &name, const function_traits &traits = function_traits()) : strict_function(name, traits) {}
+
+	/** Start the call. Result must be completed exactly once, from any thread. */
+	virtual void start(const std::vector<double> &parameters, const std::shared_ptr<async_result> &result) const = 0;
+
+	/** Returns result of completed call, otherwise starts the call.
+	 * @throw pending_evaluation if the result is not yet available
+	 */
+	double apply(const std::vector<astnode *> &parameters, const environment &env, std::set<cellindex> &evaluation_stack) const;
+
+	/** Synchronous application, starts the call and waits for it. */
+	double apply(const std::vector<double> &parameters) const;
+};
+
+/** Asynchronous calls made during evaluation, keyed by function and parameters,
+ * so that re-evaluation picks the results of already made calls.
+ * Thread safe.
+ */
+class async_calls {
+public:
+	async_calls() : m_signal(std::make_shared<async_signal>()) {}
+
+	/** Result of the call, the call is started if it was not made before. */
+	std::shared_ptr<async_result> call(const async_function *f, const std::vector<double> &parameters);
+
+	/** Number of calls not yet completed. */
+	std::size_t running() const;
+
+	/** Wait until any running call completes. Returns immediately if nothing is running.
+	 * Stops waiting also when cancelled.
+	 */
+	void wait_any(const cancellation *c = nullptr) const;
+
+	/** Forget completed calls, of impure functions only if `all` is false. */
+	void forget_completed(bool all);
+
+	/** Memory used by the calls and their results, in bytes. */
+	std::size_t memory_usage() const;
+
+private:
+	typedef std::pair<const async_function *, std::vector<double> > key;
+
+	std::shared_ptr<async_signal> m_signal;
+	std::map<key, std::shared_ptr<async_result> > m_calls;
+};
+
+#endif
@@ -0,0 +1,231 @@
+#include "cache.hh"
+
+bool value_cache::find(const cellindex &index, cached_value &value) const {
+	stripe &s = stripe_of(index);
+	std::lock_guard<std::mutex> lock(s.mutex);
+
+	auto iter = s.values.find(index);
+	if (iter == s.values.end()) {
+		return false;
+	}
+	value = iter->second;
+	return true;
+}
+
+void value_cache::store(const cellindex &index, const cached_value &value) {
+	stripe &s = stripe_of(index);
+	std::lock_guard<std::mutex> lock(s.mutex);
+	s.values.insert(std::make_pair(index, value));
+}
+
+void value_cache::erase(const cellindex &index) {
+	stripe &s = stripe_of(index);
+	std::lock_guard<std::mutex> lock(s.mutex);
+	s.values.erase(index);
+}
+
+void value_cache::clear() {
+	for (stripe &s : m_stripes) {
+		std::lock_guard<std::mutex> lock(s.mutex);
+		s.values.clear();
+	}
+}
+
+std::size_t value_cache::memory_usage() const {
+	std::size_t ret = 0;
+	for (stripe &s : m_stripes) {
+		std::lock_guard<std::mutex> lock(s.mutex);
+		ret += hash_usage(s.values);
+		for (auto &p : s.values) {
+			ret += string_usage(p.second.message);
+		}
+	}
+	return ret;
+}
+
+void dependency_graph::add(const cellindex &dependent, const cellindex &precedent) {
+	stripe &s = stripe_of(precedent);
+	std::lock_guard<std::mutex> lock(s.mutex);
+	s.dependents[precedent].insert(dependent);
+}
+
+void dependency_graph::add_range(const cellindex &dependent, const cellindex &first, const cellindex &last) {
+	std::lock_guard<std::mutex> lock(m_ranges_mutex);
+	m_ranges_of[dependent].push_back(m_ranges.size());
+	m_ranges.push_back(rectangle(first, last, m_ranges.size()));
+	m_range_dependents.push_back(dependent);
+	m_range_alive.push_back(true);
+}
+
+void dependency_graph::index_ranges() {
+	std::vector<rectangle> ranges;
+	std::vector<cellindex> dependents;
+	m_ranges_of.clear();
+	for (std::size_t k = 0; k < m_ranges.size(); k++) {
+		if (m_range_alive[k]) {
+			m_ranges_of[m_range_dependents[k]].push_back(ranges.size());
+			ranges.push_back(rectangle(m_ranges[k].first, m_ranges[k].last, ranges.size()));
+			dependents.push_back(m_range_dependents[k]);
+		}
+	}
+	m_ranges.swap(ranges);
+	m_range_dependents.swap(dependents);
+	m_range_alive.assign(m_ranges.size(), true);
+
+	rectangle_index index(m_ranges);
+	std::swap(m_range_index, index);
+	m_indexed = m_ranges.size();
+	m_removed = 0;
+}
+
+void dependency_graph::mark_volatile(const cellindex &index) {
+	std::lock_guard<std::mutex> lock(m_volatile_mutex);
+	m_volatile.insert(index);
+}
+
+std::vector<cellindex> dependency_graph::take_volatile() {
+	std::vector<cellindex> cells;
+	{
+		std::lock_guard<std::mutex> lock(m_volatile_mutex);
+		for (const cellindex &i : m_volatile) {
+			cells.push_back(i);
+		}
+		m_volatile.clear();
+	}
+	return take_dependents(cells);
+}
+
+void dependency_graph::mark_external(const cellindex &index) {
+	std::lock_guard<std::mutex> lock(m_external_mutex);
+	m_external.insert(index);
+}
+
+std::vector<cellindex> dependency_graph::take_external() {
+	std::vector<cellindex> cells;
+	{
+		std::lock_guard<std::mutex> lock(m_external_mutex);
+		for (const cellindex &i : m_external) {
+			cells.push_back(i);
+		}
+		m_external.clear();
+	}
+	return take_dependents(cells);
+}
+
+std::vector<cellindex> dependency_graph::take_dependents(const std::vector<cellindex> &cells) {
+	std::vector<cellindex> ret;
+	cellset seen;
+	for (const cellindex &i : cells) {
+		if (seen.insert(i).second) {
+			ret.push_back(i);
+		}
+	}
+
+	// Index is rebuilt when the ranges not in it, or removed from it, are many.
+	std::lock_guard<std::mutex> ranges_lock(m_ranges_mutex);
+	if (m_ranges.size() - m_indexed + m_removed > m_indexed / 2) {
+		index_ranges();
+	}
+	auto visit = [&](std::size_t id) {
+		if (m_range_alive[id] && seen.insert(m_range_dependents[id]).second) {
+			ret.push_back(m_range_dependents[id]);
+		}
+	};
+
+	// Breadth first, ret is the queue. Cell is copied, as the queue grows while visiting.
+	for (std::size_t k = 0; k < ret.size(); k++) {
+		const cellindex i = ret[k];
+		m_range_index.find(i, visit);
+		for (std::size_t id = m_indexed; id < m_ranges.size(); id++) {
+			if (m_ranges[id].contains(i)) {
+				visit(id);
+			}
+		}
+
+		cellset dependents;
+		{
+			stripe &s = stripe_of(i);
+			std::lock_guard<std::mutex> lock(s.mutex);
+			auto iter = s.dependents.find(i);
+			if (iter == s.dependents.end()) {
+				continue;
+			}
+			dependents.swap(iter->second);
+			s.dependents.erase(iter);
+		}
+
+		for (const cellindex &d : dependents) {
+			if (seen.insert(d).second) {
+				ret.push_back(d);
+			}
+		}
+	}
+
+	// Ranges of the invalidated cells are recorded again when they are evaluated.
+	for (const cellindex &i : ret) {
+		auto iter = m_ranges_of.find(i);
+		if (iter != m_ranges_of.end()) {
+			for (std::size_t id : iter->second) {
+				m_range_alive[id] = false;
+			}
+			m_removed += iter->second.size();
+			m_ranges_of.erase(iter);
+		}
+	}
+	return ret;
+}
+
+std::size_t dependency_graph::memory_usage() const {
+	std::size_t ret = 0;
+	for (stripe &s : m_stripes) {
+		std::lock_guard<std::mutex> lock(s.mutex);
+		ret += hash_usage(s.dependents);
+		for (auto &p : s.dependents) {
+			ret += hash_usage(p.second);
+		}
+	}
+
+	{
+		std::lock_guard<std::mutex> lock(m_ranges_mutex);
+		ret += m_ranges.capacity() * sizeof(rectangle) + m_range_dependents.capacity() * sizeof(cellindex)
+			+ m_range_alive.capacity() / 8 + hash_usage(m_ranges_of) + m_range_index.memory_usage();
+		for (auto &p : m_ranges_of) {
+			ret += p.second.capacity() * sizeof(std::size_t);
+		}
+	}
+
+	{
+		std::lock_guard<std::mutex> lock(m_external_mutex);
+		ret += hash_usage(m_external);
+	}
+
+	std::lock_guard<std::mutex> lock(m_volatile_mutex);
+	return ret + hash_usage(m_volatile);
+}
+
+void dependency_graph::clear() {
+	for (stripe &s : m_stripes) {
+		std::lock_guard<std::mutex> lock(s.mutex);
+		s.dependents.clear();
+	}
+
+	{
+		std::lock_guard<std::mutex> lock(m_ranges_mutex);
+		m_ranges.clear();
+		m_range_dependents.clear();
+		m_range_alive.clear();
+		m_ranges_of.clear();
+		rectangle_index empty;
+		std::swap(m_range_index, empty);
+		m_indexed = 0;
+		m_removed = 0;
+	}
+
+	{
+		std::lock_guard<std::mutex> lock(m_external_mutex);
+		m_external.clear();
+	}
+
+	std::lock_guard<std::mutex> lock(m_volatile_mutex);
+	m_volatile.clear();
+}
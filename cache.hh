@@ -0,0 +1,147 @@
+/** \file Cache of evaluated cell values. */
+
+#ifndef CACHE_HH
+#define CACHE_HH
+
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+#include "cellindex.hh"
+#include "definitions.hh"
+#include "rectangles.hh"
+
+/** Memoized result of cell evaluation, value or evaluation error. */
+struct cached_value {
+	cached_value() : error(false), value(0) {}
+
+	bool error;
+	double value;
+	std::string message;
+};
+
+/** Thread safe cache of evaluated cell values.
+ * The cells are split into stripes by hash, each stripe guarded by its own mutex,
+ * so readers evaluating different cells rarely contend on the same lock.
+ */
+class value_cache {
+public:
+	/** Look up memoized value. Returns false if cell is not cached. */
+	bool find(const cellindex &index, cached_value &value) const;
+
+	/** Memoize value. If other thread stored value first, it's kept. */
+	void store(const cellindex &index, const cached_value &value);
+
+	/** Forget value of one cell. */
+	void erase(const cellindex &index);
+
+	/** Forget all values. */
+	void clear();
+
+	/** Memory used by the values, in bytes. */
+	std::size_t memory_usage() const;
+
+private:
+	static const unsigned int stripe_count = 64;
+
+	/** One lock and its part of the cells. Padded to avoid false sharing of the locks. */
+	struct stripe {
+		std::mutex mutex;
+		std::unordered_map<cellindex, cached_value, cellindex_hash> values;
+		char padding[64];
+	};
+
+	stripe &stripe_of(const cellindex &index) const {
+		return m_stripes[cellindex_hash()(index) % stripe_count];
+	}
+
+	mutable stripe m_stripes[stripe_count];
+};
+
+/** Dependencies between memoized cells and cells calling volatile functions,
+ * recorded during evaluation. Used to forget only values depending on volatile
+ * or edited cells. Thread safe, striped like the value cache.
+ */
+class dependency_graph {
+public:
+	dependency_graph() : m_indexed(0), m_removed(0) {}
+
+	/** Record that `dependent` used value of `precedent`. */
+	void add(const cellindex &dependent, const cellindex &precedent);
+
+	/** Record that `dependent` used values of all cells of the range.
+	 * Ranges are kept as rectangles, not as edges from each cell.
+	 */
+	void add_range(const cellindex &dependent, const cellindex &first, const cellindex &last);
+
+	/** Record that the cell called volatile function. */
+	void mark_volatile(const cellindex &index);
+
+	/** Record that the cell read cell of other sheet of the workbook. */
+	void mark_external(const cellindex &index);
+
+	/** Volatile cells and their transitive dependents. They are removed from the graph,
+	 * as their dependencies are recorded again when they are evaluated.
+	 */
+	std::vector<cellindex> take_volatile();
+
+	/** The cells and their transitive dependents, found through the cell edges
+	 * and the index of the ranges. They are removed from the graph, like by `take_volatile`.
+	 */
+	std::vector<cellindex> take_dependents(const std::vector<cellindex> &cells);
+
+	/** Cells reading other sheets and their transitive dependents, like `take_volatile`.
+	 * Edges between sheets are not recorded, so these are forgotten when other sheets change.
+	 */
+	std::vector<cellindex> take_external();
+
+	/** Forget all dependencies. */
+	void clear();
+
+	/** Memory used by the dependencies, in bytes. */
+	std::size_t memory_usage() const;
+
+private:
+	typedef std::unordered_set<cellindex, cellindex_hash> cellset;
+
+	static const unsigned int stripe_count = 64;
+
+	/** Dependents of the precedents in this stripe. */
+	struct stripe {
+		std::mutex mutex;
+		std::unordered_map<cellindex, cellset, cellindex_hash> dependents;
+		char padding[64];
+	};
+
+	stripe &stripe_of(const cellindex &index) {
+		return m_stripes[cellindex_hash()(index) % stripe_count];
+	}
+
+	mutable stripe m_stripes[stripe_count];
+
+	mutable std::mutex m_volatile_mutex;
+	cellset m_volatile;
+
+	mutable std::mutex m_external_mutex;
+	cellset m_external;
+
+	/** Rebuild the index of the live ranges, must be called with the ranges locked. */
+	void index_ranges();
+
+	/** Range dependencies, ids of the rectangles are positions in the vectors.
+	 * Ranges before `m_indexed` are in the spatial index, the newer ones are checked
+	 * one by one until the index is rebuilt. Removed ranges stay until then, not alive.
+	 */
+	mutable std::mutex m_ranges_mutex;
+	std::vector<rectangle> m_ranges;
+	std::vector<cellindex> m_range_dependents;
+	std::vector<bool> m_range_alive;
+	std::unordered_map<cellindex, std::vector<std::size_t>, cellindex_hash> m_ranges_of;
+	rectangle_index m_range_index;
+	std::size_t m_indexed;
+	std::size_t m_removed;
+};
+
+#endif
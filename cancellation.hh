@@ -0,0 +1,51 @@
+/** \file Cancellation of recalculation. */
+
+#ifndef CANCELLATION_HH
+#define CANCELLATION_HH
+
+#include <atomic>
+#include <chrono>
+
+/** Deadline and cancellation flag of recalculation.
+ * Checked before each cell is evaluated, so recalculation stops at cell granularity.
+ * `cancel` can be called from other thread.
+ */
+class cancellation {
+public:
+	typedef std::chrono::steady_clock clock;
+
+	/** No deadline, stops only when cancelled. */
+	cancellation() : m_cancelled(false), m_has_deadline(false) {}
+
+	/** Stops when deadline passes. */
+	explicit cancellation(clock::time_point deadline) : m_cancelled(false), m_has_deadline(true), m_deadline(deadline) {}
+
+	/** Stops after the time budget from now. */
+	template <typename Rep, typename Period>
+	explicit cancellation(std::chrono::duration<Rep, Period> budget)
+		: m_cancelled(false), m_has_deadline(true), m_deadline(clock::now() + std::chrono::duration_cast<clock::duration>(budget)) {}
+
+	void cancel() {
+		m_cancelled.store(true, std::memory_order_relaxed);
+	}
+
+	/** Cancelled or the deadline has passed. */
+	bool stopped() const {
+		return m_cancelled.load(std::memory_order_relaxed) || (m_has_deadline && clock::now() >= m_deadline);
+	}
+
+	bool has_deadline() const {
+		return m_has_deadline;
+	}
+
+	clock::time_point deadline() const {
+		return m_deadline;
+	}
+
+private:
+	std::atomic<bool> m_cancelled;
+	bool m_has_deadline;
+	clock::time_point m_deadline;
+};
+
+#endif
@@ -4,6 +4,7 @@
 #define CELLINDEX_HH
 
 #include <string>
+#include <functional>
 
 /** Representing cell index. Pair of integers with few helper functions. 
  * Members are const, so this structure is non-mutable.
@@ -27,10 +28,21 @@ struct cellindex {
 		return col < other.col;
 	}
 
+	bool operator==(const cellindex &other) const {
+		return col == other.col && row == other.row;
+	}
+
 	const unsigned int col;
 	const unsigned int row;
 };
 
 std::ostream &operator<< (std::ostream &os, const cellindex &i);
 
+/** Hash function, so we can use cellindex as key for unordered containers. */
+struct cellindex_hash {
+	std::size_t operator()(const cellindex &i) const {
+		return std::hash<unsigned long long>()((static_cast<unsigned long long>(i.col) << 32) | i.row);
+	}
+};
+
 #endif
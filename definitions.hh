@@ -3,13 +3,30 @@
 #ifndef DEFINITIONS_HH
 #define DEFINITIONS_HH
 
+#include <cstddef>
 #include <map>
 #include <sstream>
+#include <string>
 
 // Forward declarations
 class function;
 class astnode;
+class astnode_range;
 class environment;
+class function_registry;
+struct reference_shift;
+class profiler;
+class profile_scope;
+class tracer;
+class async_calls;
+class cancellation;
+class dependency_graph;
+class sheet_link;
+class workbook;
+class journal;
+class lookup_cache;
+class aggregate_cache;
+class spreadsheet;
 
 /// Functions
 typedef std::map<std::string, function *> functionmap;
@@ -22,4 +39,23 @@ std::string to_string(const T &t) {
 	return oss.str();
 }
 
+/** Heap memory of the string, zero if it fits into the string object itself. */
+inline std::size_t string_usage(const std::string &s) {
+	return s.capacity() > std::string().capacity() ? s.capacity() + 1 : 0;
+}
+
+/** Estimated heap memory of the nodes of `std::map` or `std::set`, without heap memory of the elements. */
+template <typename M>
+std::size_t tree_usage(const M &m) {
+	// color and three links
+	return m.size() * (sizeof(typename M::value_type) + 4 * sizeof(void *));
+}
+
+/** Estimated heap memory of the buckets and nodes of unordered container, without heap memory of the elements. */
+template <typename M>
+std::size_t hash_usage(const M &m) {
+	// link and cached hash
+	return m.bucket_count() * sizeof(void *) + m.size() * (sizeof(typename M::value_type) + 2 * sizeof(void *));
+}
+
 #endif
@@ -10,6 +10,22 @@ struct evaluation_error : public std::runtime_error {
 	evaluation_error(const std::string &what) : std::runtime_error(what) {}
 };
 
+/** Evaluation waits for the result of asynchronous function.
+ *
+ * Not an evaluation error, so it's not memoized: the cell is evaluated again later.
+ */
+struct pending_evaluation : public std::runtime_error {
+	pending_evaluation(const std::string &what) : std::runtime_error(what) {}
+};
+
+/** Recalculation was cancelled or ran out of time before the cell was evaluated.
+ *
+ * Not memoized either, the cell stays stale.
+ */
+struct evaluation_cancelled : public std::runtime_error {
+	evaluation_cancelled(const std::string &what) : std::runtime_error(what) {}
+};
+
 /** Indicates that string is not a formula.
  * 
  * Thrown when string does not look like formula.
@@ -12,10 +12,45 @@
 #include "cellindex.hh"
 #include "table.hh"
 
+/** Built-in operations, which evaluator can dispatch without virtual calls. */
+enum opcode {
+	op_none,
+	op_add,
+	op_sub,
+	op_mul,
+	op_div
+};
+
+/** Static properties of the function. */
+struct function_traits {
+	/** Any number of parameters, for `max_arity`. */
+	static const unsigned int variadic = ~0u;
+
+	function_traits() : min_arity(0), max_arity(variadic), pure(true), is_volatile(false), op(op_none) {}
+
+	function_traits &set_arity(unsigned int min, unsigned int max) { min_arity = min; max_arity = max; return *this; }
+	function_traits &set_impure() { pure = false; return *this; }
+	function_traits &set_volatile() { is_volatile = true; pure = false; return *this; }
+	function_traits &set_operation(opcode o) { op = o; return *this; }
+
+	/** Number of parameters, calls with other number are syntax errors. */
+	unsigned int min_arity;
+	unsigned int max_arity;
+
+	/** Result depends only on the parameters. */
+	bool pure;
+
+	/** Result can change without any cell changing, eg. time or random numbers. */
+	bool is_volatile;
+
+	/** Built-in operation the function performs, or op_none. */
+	opcode op;
+};
+
 /** Parent class for all functions, and also operators. */
 class function {
 public:
-	function(const std::string &name) : m_name(name) {}
+	function(const std::string &name, const function_traits &traits = function_traits()) : m_name(name), m_traits(traits) {}
 	virtual ~function() {}
 
 	/** Apply function, lazy application. */
@@ -25,8 +60,14 @@ public:
 	const std::string &str() const {
 		return m_name;
 	}
+
+	/** Return static properties of the function. */
+	const function_traits &traits() const {
+		return m_traits;
+	}
 private:
 	std::string m_name;
+	function_traits m_traits;
 };
 
 /** Strict function object. 
@@ -38,7 +79,7 @@ private:
  */
 class strict_function : public function {
 public:
-	strict_function(const std::string &name) : function(name) {}
+	strict_function(const std::string &name, const function_traits &traits = function_traits()) : function(name, traits) {}
 
 	/** Evaluates parameters to vector of doubles and applies function on that vector. */
 	double apply(const std::vector<astnode *> &parameters, const environment &env, std::set<cellindex> &evaluation_stack) const;
@@ -50,28 +91,28 @@ public:
 /** Plus operator, addition ie SUM */
 class plus_function : public strict_function {
 public:
-	plus_function() : strict_function("+") {}
+	plus_function() : strict_function("+", function_traits().set_operation(op_add)) {}
 	double apply(const std::vector<double> &parameters) const;
 };
 
 /** Substitution. */
 class minus_function : public strict_function {
 public:
-	minus_function() : strict_function("-") {}
+	minus_function() : strict_function("-", function_traits().set_operation(op_sub)) {}
 	double apply(const std::vector<double> &parameters) const;
 };
 
 /** Multiplication ie PRODUCT. */
 class mul_function : public strict_function {
 public:
-	mul_function() : strict_function("*") {}
+	mul_function() : strict_function("*", function_traits().set_operation(op_mul)) {}
 	double apply(const std::vector<double> &parameters) const;
 };
 
 /** Division. */
 class div_function : public strict_function {
 public:
-	div_function() : strict_function("/") {}
+	div_function() : strict_function("/", function_traits().set_operation(op_div)) {}
 	double apply(const std::vector<double> &parameters) const;
 };
 
@@ -85,14 +126,15 @@ public:
 /** Conditional ie IF. */
 class if_function : public function {
 public:
-	if_function() : function("if") {}
+	if_function() : function("if", function_traits().set_arity(3, 3)) {}
 	double apply(const std::vector<astnode *> &parameters, const environment &s, std::set<cellindex> &evaluation_stack) const;
 };
 
 /** Template to lift c++ functions into spreadsheet. They are strict as c++ is strict anyways. */
 class lifted_unary_function : public strict_function {
 public:
-	lifted_unary_function(const std::string &name, double (*f)(double)) : strict_function(name), m_f(f) {}
+	lifted_unary_function(const std::string &name, double (*f)(double), const function_traits &traits = function_traits())
+		: strict_function(name, function_traits(traits).set_arity(1, 1)), m_f(f) {}
 	double apply(const std::vector<double> &parameters) const {
 		// We expect three arguments
 		if (parameters.size() != 1) {
@@ -105,4 +147,20 @@ protected:
 	double (*m_f)(double);
 };
 
+/** Lifted c++ function without parameters, eg. RAND or NOW, which usually is volatile. */
+class lifted_nullary_function : public strict_function {
+public:
+	lifted_nullary_function(const std::string &name, double (*f)(), const function_traits &traits = function_traits())
+		: strict_function(name, function_traits(traits).set_arity(0, 0)), m_f(f) {}
+	double apply(const std::vector<double> &parameters) const {
+		if (!parameters.empty()) {
+			throw evaluation_error(str() + " requires no parameters");
+		}
+
+		return m_f();
+	}
+protected:
+	double (*m_f)();
+};
+
 #endif
@@ -0,0 +1,376 @@
+#include "journal.hh"
+#include "spreadsheet.hh"
+
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <map>
+#include <stdexcept>
+#include <utility>
+#include <vector>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+static const char magic[] = "SSJ1";
+static const std::size_t magic_size = 4;
+
+/** Type, two numbers and length of the data. */
+static const std::size_t header_size = 13;
+
+static std::runtime_error journal_error(const std::string &what, const std::string &path) {
+	return std::runtime_error("journal " + what + " -- " + path + ": " + std::strerror(errno));
+}
+
+static void put32(std::string &buffer, std::uint32_t x) {
+	for (int k = 0; k < 4; k++) {
+		buffer.push_back(static_cast<char>((x >> (8 * k)) & 0xff));
+	}
+}
+
+static std::uint32_t get32(const char *p) {
+	std::uint32_t x = 0;
+	for (int k = 3; k >= 0; k--) {
+		x = (x << 8) | static_cast<unsigned char>(p[k]);
+	}
+	return x;
+}
+
+/** FNV-1a hash, to find torn or damaged records. */
+static std::uint32_t checksum(const char *p, std::size_t size) {
+	std::uint32_t h = 2166136261u;
+	for (std::size_t k = 0; k < size; k++) {
+		h ^= static_cast<unsigned char>(p[k]);
+		h *= 16777619u;
+	}
+	return h;
+}
+
+static int open_journal(const std::string &path) {
+	int fd = ::open(path.c_str(), O_RDWR | O_APPEND | O_CREAT, 0644);
+	if (fd < 0) {
+		throw journal_error("can't open", path);
+	}
+	return fd;
+}
+
+journal::journal(const std::string &path)
+	: m_path(path), m_fd(open_journal(path)), m_appended(0), m_durable(0), m_durable_size(0), m_failures(0), m_failed_end(0), m_writing(false) {
+	char header[magic_size];
+	ssize_t n = ::pread(m_fd, header, magic_size, 0);
+	if (n == 0) {
+		write_all(m_fd, std::string(magic, magic_size));
+	} else if (n != static_cast<ssize_t>(magic_size) || std::memcmp(header, magic, magic_size) != 0) {
+		::close(m_fd);
+		throw std::runtime_error("not a journal -- " + path);
+	}
+
+	off_t size = ::lseek(m_fd, 0, SEEK_END);
+	if (size < 0) {
+		::close(m_fd);
+		throw journal_error("can't seek", path);
+	}
+	m_durable_size = size;
+}
+
+journal::~journal() {
+	try {
+		commit();
+	} catch (const std::runtime_error &e) {
+		// nothing to do in destructor
+	}
+	::close(m_fd);
+}
+
+void journal::encode(std::string &buffer, record_type type, std::uint32_t a, std::uint32_t b, const std::string &data) {
+	std::size_t start = buffer.size();
+	buffer.push_back(static_cast<char>(type));
+	put32(buffer, a);
+	put32(buffer, b);
+	put32(buffer, data.size());
+	buffer.append(data);
+	put32(buffer, checksum(buffer.data() + start, buffer.size() - start));
+}
+
+void journal::append(record_type type, std::uint32_t a, std::uint32_t b, const std::string &data) {
+	std::lock_guard<std::mutex> lock(m_mutex);
+	encode(m_buffer, type, a, b, data);
+	m_appended++;
+}
+
+void journal::record_set(const cellindex &i, const std::string &input) {
+	append(op_set, i.col, i.row, input);
+}
+
+void journal::record_erase(const cellindex &i) {
+	append(op_erase, i.col, i.row, "");
+}
+
+void journal::record_shift(const reference_shift &shift) {
+	record_type type;
+	if (shift.axis == reference_shift::rows) {
+		type = shift.insert ? op_insert_rows : op_delete_rows;
+	} else {
+		type = shift.insert ? op_insert_cols : op_delete_cols;
+	}
+	append(type, shift.at, shift.count, "");
+}
+
+/** Numbers as 64 bit little endian. */
+static std::string encode_values(const std::vector<double> &values) {
+	std::string data;
+	data.reserve(values.size() * 8);
+	for (double d : values) {
+		std::uint64_t x;
+		std::memcpy(&x, &d, sizeof(x));
+		put32(data, x & 0xffffffffu);
+		put32(data, x >> 32);
+	}
+	return data;
+}
+
+void journal::record_load(const cellindex &first, const std::vector<double> &values) {
+	append(op_load, first.col, first.row, encode_values(values));
+}
+
+void journal::record_unload(const cellindex &first) {
+	append(op_unload, first.col, first.row, "");
+}
+
+void journal::write_all(int fd, const std::string &data) {
+	const char *p = data.data();
+	std::size_t left = data.size();
+	while (left > 0) {
+		ssize_t n = ::write(fd, p, left);
+		if (n < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+			throw std::runtime_error(std::string("journal write failed: ") + std::strerror(errno));
+		}
+		p += n;
+		left -= n;
+	}
+}
+
+void journal::commit() {
+	std::unique_lock<std::mutex> lock(m_mutex);
+	std::uint64_t target = m_appended;
+	std::uint64_t failures = m_failures;
+
+	while (m_durable < target) {
+		if (m_failures != failures && target <= m_failed_end) {
+			// our records were in the failed write, they are buffered again
+			throw std::runtime_error(m_error);
+		}
+		if (m_writing) {
+			// the write in progress may contain our records too
+			m_written.wait(lock);
+			continue;
+		}
+
+		// Write everything appended so far, also records of the waiting committers.
+		m_writing = true;
+		std::string batch;
+		batch.swap(m_buffer);
+		std::uint64_t batch_end = m_appended;
+		lock.unlock();
+
+		try {
+			write_all(m_fd, batch);
+			if (::fdatasync(m_fd) != 0) {
+				throw journal_error("can't flush", m_path);
+			}
+		} catch (const std::exception &e) {
+			lock.lock();
+			// Cut off the torn record, the next write appends after the durable ones.
+			if (::ftruncate(m_fd, m_durable_size) != 0) {
+				m_error = e.what() + std::string(", ") + journal_error("can't truncate", m_path).what();
+			} else {
+				m_error = e.what();
+			}
+			batch.append(m_buffer);
+			m_buffer.swap(batch);
+			m_failures++;
+			m_failed_end = batch_end;
+			m_writing = false;
+			m_written.notify_all();
+			throw std::runtime_error(m_error);
+		}
+
+		lock.lock();
+		m_writing = false;
+		m_durable = batch_end;
+		m_durable_size += batch.size();
+		m_written.notify_all();
+	}
+}
+
+std::size_t journal::pending() const {
+	std::lock_guard<std::mutex> lock(m_mutex);
+	return m_buffer.size();
+}
+
+std::size_t journal::replay(spreadsheet &s) {
+	commit();
+
+	journal *attached = s.m_journal;
+	s.m_journal = nullptr;
+
+	std::ifstream is(m_path.c_str(), std::ios::binary);
+	is.seekg(0, std::ios::end);
+	std::uint64_t file_size = is.tellg();
+	is.seekg(magic_size);
+
+	// Last write of each cell since the previous shift, true if it is erase.
+	std::map<cellindex, std::pair<bool, std::string> > latest;
+
+	auto apply_latest = [&]() {
+		sheet_contents &contents = s.m_contents;
+		if (contents.cells.empty() && contents.syntax_errors.empty() && contents.regions->empty()) {
+			// Bulk load in O(n), the map is ordered as the table.
+			std::vector<table<cell>::value_type> cells;
+			for (auto &p : latest) {
+				if (!p.second.first) {
+					cells.push_back(table<cell>::value_type(p.first, cell(p.second.second, s.compile(p.first, p.second.second))));
+				}
+			}
+			contents.cells.assign_sorted(cells);
+		} else {
+			for (auto &p : latest) {
+				contents.syntax_errors.erase(p.first);
+				if (p.second.first) {
+					contents.remove(p.first);
+				} else {
+					contents.put(p.first, cell(p.second.second, s.compile(p.first, p.second.second)));
+				}
+			}
+		}
+		latest.clear();
+	};
+
+	std::size_t count = 0;
+	std::uint64_t valid = magic_size;
+	std::vector<char> record(header_size);
+	while (is.read(&record[0], header_size)) {
+		std::uint32_t a = get32(&record[1]);
+		std::uint32_t b = get32(&record[5]);
+		std::uint32_t size = get32(&record[9]);
+
+		// Length of damaged record may be anything, it must fit in the rest of the file.
+		if (size + std::uint64_t(4) > file_size - valid - header_size) {
+			break;
+		}
+		record.resize(header_size + size + 4);
+		if (!is.read(&record[header_size], size + 4)) {
+			break;
+		}
+		if (checksum(&record[0], header_size + size) != get32(&record[header_size + size])) {
+			break;
+		}
+
+		cellindex i(a, b);
+		switch (record[0]) {
+		case op_set:
+			latest[i] = std::make_pair(false, std::string(&record[header_size], size));
+			break;
+		case op_erase:
+			latest[i] = std::make_pair(true, std::string());
+			break;
+		case op_insert_rows:
+		case op_delete_rows:
+		case op_insert_cols:
+		case op_delete_cols: {
+			apply_latest();
+			bool rows = record[0] == op_insert_rows || record[0] == op_delete_rows;
+			bool insert = record[0] == op_insert_rows || record[0] == op_insert_cols;
+			// Rewrites of the references in the other sheets are in their own journals.
+			s.shift_cells(reference_shift(rows ? reference_shift::rows : reference_shift::columns, a, b, insert));
+			break;
+		}
+		case op_load: {
+			apply_latest();
+			std::vector<double> values(size / 8);
+			for (std::size_t k = 0; k < values.size(); k++) {
+				const char *p = &record[header_size + 8 * k];
+				std::uint64_t x = get32(p) | (static_cast<std::uint64_t>(get32(p + 4)) << 32);
+				std::memcpy(&values[k], &x, sizeof(x));
+			}
+			s.m_contents.load(a, b, values);
+			break;
+		}
+		case op_unload:
+			apply_latest();
+			s.m_contents.unload(i);
+			break;
+		default:
+			// unknown record is damage too
+			is.setstate(std::ios::failbit);
+			continue;
+		}
+
+		valid += record.size();
+		record.resize(header_size);
+		count++;
+	}
+	apply_latest();
+
+	// Cut off torn tail, so that new records follow the valid ones.
+	if (::ftruncate(m_fd, valid) != 0) {
+		throw journal_error("can't truncate", m_path);
+	}
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		m_durable_size = valid;
+	}
+
+	s.m_undo.clear();
+	s.m_redo.clear();
+	s.rebuild_references();
+	s.invalidate();
+	s.m_journal = attached;
+	return count;
+}
+
+void journal::compact(const spreadsheet &s) {
+	std::unique_lock<std::mutex> lock(m_mutex);
+	while (m_writing) {
+		m_written.wait(lock);
+	}
+
+	std::string checkpoint(magic, magic_size);
+	for (auto &p : *s.m_contents.regions) {
+		encode(checkpoint, op_load, p.first.col, p.first.row, encode_values(p.second->values()));
+	}
+	for (auto &p : s.m_contents.cells) {
+		encode(checkpoint, op_set, p.first.col, p.first.row, s.m_contents.get(p.first));
+	}
+
+	std::string tmp = m_path + ".tmp";
+	int fd = ::open(tmp.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	if (fd < 0) {
+		throw journal_error("can't open", tmp);
+	}
+	try {
+		write_all(fd, checkpoint);
+		if (::fdatasync(fd) != 0) {
+			throw journal_error("can't flush", tmp);
+		}
+	} catch (...) {
+		::close(fd);
+		throw;
+	}
+	::close(fd);
+
+	if (std::rename(tmp.c_str(), m_path.c_str()) != 0) {
+		throw journal_error("can't rename", tmp);
+	}
+	::close(m_fd);
+	m_fd = open_journal(m_path);
+
+	// Buffered records are part of the contents, so they are in the checkpoint.
+	m_buffer.clear();
+	m_durable = m_appended;
+	m_durable_size = checkpoint.size();
+}
@@ -0,0 +1,124 @@
+/** \file Append-only journal of modifications. */
+
+#ifndef JOURNAL_HH
+#define JOURNAL_HH
+
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "cellindex.hh"
+#include "definitions.hh"
+
+/** Append-only binary journal of spreadsheet modifications, for recovery after crash.
+ *
+ * Records are buffered in memory and written by `commit`, so many modifications
+ * share one write and one flush to disk (group commit). Concurrent commits wait
+ * for the write in progress instead of issuing their own.
+ *
+ * Each record has a checksum, replay stops at the first incomplete or damaged record,
+ * and cuts it off, so a crash during write loses only the uncommitted records.
+ * `compact` rewrites the journal as checkpoint, one record per non empty cell
+ * and per constant region.
+ *
+ * Typical use:
+ *
+ *     journal j("sheet.journal");
+ *     j.replay(s);
+ *     s.attach_journal(&j);
+ *     s.set("A1", "=1+2");
+ *     j.commit();
+ *
+ * \sa spreadsheet::attach_journal
+ */
+class journal {
+public:
+	/** Open or create the journal file.
+	 *
+	 * @throw std::runtime_error if the file can't be opened or is not a journal
+	 */
+	explicit journal(const std::string &path);
+
+	/** Commits the buffered records. */
+	~journal();
+
+	/** Apply the records to the spreadsheet, which should have no journal attached.
+	 * Only the last write of each cell between row or column shifts is applied.
+	 * Undo history of the spreadsheet is cleared.
+	 * Returns number of records read.
+	 */
+	std::size_t replay(spreadsheet &s);
+
+	void record_set(const cellindex &i, const std::string &input);
+	void record_erase(const cellindex &i);
+	void record_shift(const reference_shift &shift);
+	void record_load(const cellindex &first, const std::vector<double> &values);
+	void record_unload(const cellindex &first);
+
+	/** Write buffered records and flush them to disk. If the write fails, the records
+	 * stay buffered for the next commit and the partially written data is cut off.
+	 *
+	 * @throw std::runtime_error if the write of the records of this thread failed
+	 */
+	void commit();
+
+	/** Rewrite the journal as checkpoint of the spreadsheet contents. */
+	void compact(const spreadsheet &s);
+
+	/** Size of the records not yet committed, in bytes. */
+	std::size_t pending() const;
+
+private:
+	journal(const journal &);
+	journal &operator=(const journal &);
+
+	enum record_type {
+		op_set = 1,
+		op_erase = 2,
+		op_insert_rows = 3,
+		op_delete_rows = 4,
+		op_insert_cols = 5,
+		op_delete_cols = 6,
+		op_load = 7,
+		op_unload = 8
+	};
+
+	/** Encode record with its checksum to the end of the buffer. */
+	static void encode(std::string &buffer, record_type type, std::uint32_t a, std::uint32_t b, const std::string &data);
+
+	/** Append record to the buffer. */
+	void append(record_type type, std::uint32_t a, std::uint32_t b, const std::string &data);
+
+	/** Write all of the data to the file descriptor. */
+	static void write_all(int fd, const std::string &data);
+
+	std::string m_path;
+	int m_fd;
+
+	mutable std::mutex m_mutex;
+	std::condition_variable m_written;
+
+	/** Records not yet written. */
+	std::string m_buffer;
+
+	/** Sequence numbers of the appended and of the durable records. */
+	std::uint64_t m_appended;
+	std::uint64_t m_durable;
+
+	/** Size of the file up to the end of the durable records, torn writes are cut off to it. */
+	std::uint64_t m_durable_size;
+
+	/** Number of failed writes, end of the records of the last one and its error.
+	 * Committers waiting for the failed write throw the error too.
+	 */
+	std::uint64_t m_failures;
+	std::uint64_t m_failed_end;
+	std::string m_error;
+
+	/** Some commit is writing, others wait for it. */
+	bool m_writing;
+};
+
+#endif
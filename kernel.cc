@@ -0,0 +1,102 @@
+#include "kernel.hh"
+
+#include <cstring>
+
+void column_kernel::push_constant(double value) {
+	instruction i = { constant, value, 0, op_none };
+	m_program.push_back(i);
+}
+
+void column_kernel::push_input(unsigned int col, long long offset) {
+	input in(col, offset);
+	unsigned int index = 0;
+	while (index < m_inputs.size() && !(m_inputs[index] == in)) {
+		index++;
+	}
+	if (index == m_inputs.size()) {
+		m_inputs.push_back(in);
+	}
+
+	instruction i = { read, 0, index, op_none };
+	m_program.push_back(i);
+}
+
+void column_kernel::push_operation(opcode op, unsigned int arity) {
+	instruction i = { operation, 0, arity, op };
+	m_program.push_back(i);
+}
+
+bool column_kernel::operator==(const column_kernel &other) const {
+	if (m_program.size() != other.m_program.size() || !(m_inputs == other.m_inputs)) {
+		return false;
+	}
+	for (std::size_t k = 0; k < m_program.size(); k++) {
+		const instruction &a = m_program[k];
+		const instruction &b = other.m_program[k];
+		// constants are compared bitwise, also NaNs and negative zeros
+		if (a.k != b.k || a.index != b.index || a.op != b.op || std::memcmp(&a.value, &b.value, sizeof(double)) != 0) {
+			return false;
+		}
+	}
+	return true;
+}
+
+void column_kernel::run(const std::vector<std::vector<double> > &inputs, std::size_t count, std::vector<double> &results) const {
+	// Stack of columns, the loops over them are simple enough for the compiler to vectorize.
+	std::vector<std::vector<double> > stack;
+	for (const instruction &i : m_program) {
+		switch (i.k) {
+		case constant:
+			stack.push_back(std::vector<double>(count, i.value));
+			break;
+		case read:
+			stack.push_back(inputs[i.index]);
+			break;
+		case operation: {
+			unsigned int arity = i.index;
+			std::size_t first = stack.size() - arity;
+			std::vector<double> ret;
+
+			// Same as the evaluation of astnode_call
+			if (i.op == op_add || i.op == op_mul) {
+				ret.assign(count, i.op == op_add ? 0 : 1);
+				for (std::size_t p = first; p < stack.size(); p++) {
+					const double *d = stack[p].data();
+					double *r = ret.data();
+					if (i.op == op_add) {
+						for (std::size_t k = 0; k < count; k++) r[k] += d[k];
+					} else {
+						for (std::size_t k = 0; k < count; k++) r[k] *= d[k];
+					}
+				}
+			} else if (arity == 0) {
+				ret.assign(count, 1);
+			} else {
+				ret.swap(stack[first]);
+				double *r = ret.data();
+				if (arity == 1) {
+					if (i.op == op_sub) {
+						for (std::size_t k = 0; k < count; k++) r[k] = -r[k];
+					} else {
+						for (std::size_t k = 0; k < count; k++) r[k] = 1 / r[k];
+					}
+				}
+				for (std::size_t p = first + 1; p < stack.size(); p++) {
+					const double *d = stack[p].data();
+					if (i.op == op_sub) {
+						for (std::size_t k = 0; k < count; k++) r[k] -= d[k];
+					} else {
+						for (std::size_t k = 0; k < count; k++) r[k] /= d[k];
+					}
+				}
+			}
+
+			stack.resize(first);
+			stack.push_back(std::vector<double>());
+			stack.back().swap(ret);
+			break;
+		}
+		}
+	}
+	results.swap(stack.back());
+}
@@ -0,0 +1,70 @@
+/** \file Columnar evaluation of formulas filled down a column. */
+
+#ifndef KERNEL_HH
+#define KERNEL_HH
+
+#include <cstddef>
+#include <vector>
+
+#include "functions.hh"
+
+/** Formula compiled relative to its row, so that the same formula filled down
+ * the column (eg. `=A1*B1+C1`, `=A2*B2+C2`, ...) compiles to equal kernels.
+ * Only numbers, cell references and built-in operations can be compiled.
+ *
+ * Kernel is postfix program, run on whole arrays of inputs at once.
+ * Operations are applied in the same order as by the evaluator,
+ * so the results are exactly the same as of evaluating the cells one by one.
+ *
+ * \sa astnode::vectorize
+ */
+class column_kernel {
+public:
+	/** Cell read by the kernel, `offset` is relative to the row of the formula. */
+	struct input {
+		input(unsigned int col, long long offset) : col(col), offset(offset) {}
+
+		bool operator==(const input &other) const {
+			return col == other.col && offset == other.offset;
+		}
+
+		unsigned int col;
+		long long offset;
+	};
+
+	void push_constant(double value);
+	void push_input(unsigned int col, long long offset);
+	void push_operation(opcode op, unsigned int arity);
+
+	/** Distinct inputs in the order they are first read. */
+	const std::vector<input> &inputs() const {
+		return m_inputs;
+	}
+
+	/** Compute `count` results, `inputs[k]` has `count` values of the k-th input. */
+	void run(const std::vector<std::vector<double> > &inputs, std::size_t count, std::vector<double> &results) const;
+
+	bool operator==(const column_kernel &other) const;
+	bool operator!=(const column_kernel &other) const {
+		return !(*this == other);
+	}
+
+private:
+	enum kind {
+		constant,
+		read,
+		operation
+	};
+
+	struct instruction {
+		kind k;
+		double value;
+		unsigned int index;
+		opcode op;
+	};
+
+	std::vector<instruction> m_program;
+	std::vector<input> m_inputs;
+};
+
+#endif
@@ -0,0 +1,188 @@
+#include "lookup.hh"
+#include "ast.hh"
+#include "exceptions.hh"
+
+#include <algorithm>
+#include <cmath>
+
+const unsigned int lookup_index::npos;
+
+unsigned int lookup_index::checked(unsigned int found) const {
+	// npos is after every error
+	if (m_error_position < found) {
+		throw evaluation_error(m_error);
+	}
+	return found;
+}
+
+unsigned int lookup_index::exact(double value) const {
+	auto iter = m_exact.find(value);
+	return checked(iter == m_exact.end() ? npos : iter->second);
+}
+
+unsigned int lookup_index::at_most(double value) const {
+	// first greater than (value, any position), one before it
+	auto iter = std::upper_bound(m_sorted.begin(), m_sorted.end(), std::make_pair(value, npos));
+	if (iter == m_sorted.begin()) {
+		return checked(npos);
+	}
+	--iter;
+	return checked(iter->second);
+}
+
+unsigned int lookup_index::at_least(double value) const {
+	auto iter = std::lower_bound(m_sorted.begin(), m_sorted.end(), std::make_pair(value, 0u));
+	return checked(iter == m_sorted.end() ? npos : iter->second);
+}
+
+std::size_t lookup_index::memory_usage() const {
+	return sizeof(*this) + hash_usage(m_exact) + m_sorted.capacity() * sizeof(std::pair<double, unsigned int>) + string_usage(m_error);
+}
+
+std::shared_ptr<const lookup_index> lookup_cache::build(const cellindex &first, unsigned int count, bool horizontal, const environment &env, std::set<cellindex> &evaluation_stack) {
+	std::shared_ptr<lookup_index> ret = std::make_shared<lookup_index>();
+	for (unsigned int k = 0; k < count; k++) {
+		cellindex i = horizontal ? cellindex(first.col + k, first.row) : cellindex(first.col, first.row + k);
+		if (evaluation_stack.find(i) != evaluation_stack.end()) {
+			throw evaluation_error("circular reference");
+		}
+
+		// empty and string cells are not found
+		if (!env.has_value(i)) {
+			continue;
+		}
+
+		double value;
+		try {
+			value = env.find_in_range(i, evaluation_stack);
+		} catch (const evaluation_error &e) {
+			if (ret->m_error_position == lookup_index::npos) {
+				ret->m_error_position = k;
+				ret->m_error = e.what();
+			}
+			continue;
+		}
+		if (std::isnan(value)) {
+			continue;
+		}
+
+		ret->m_exact.insert(std::make_pair(value, k));
+		ret->m_sorted.push_back(std::make_pair(value, k));
+	}
+	std::sort(ret->m_sorted.begin(), ret->m_sorted.end());
+	return ret;
+}
+
+std::shared_ptr<const lookup_index> lookup_cache::index(const cellindex &first, unsigned int count, bool horizontal, const environment &env, std::set<cellindex> &evaluation_stack) {
+	key k(first.col, first.row, count, horizontal);
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		auto iter = m_indexes.find(k);
+		if (iter != m_indexes.end()) {
+			return iter->second;
+		}
+	}
+
+	// Built outside of the lock, as building evaluates cells. If other thread stored index first, it's kept.
+	std::shared_ptr<const lookup_index> built = build(first, count, horizontal, env, evaluation_stack);
+	std::lock_guard<std::mutex> lock(m_mutex);
+	return m_indexes.insert(std::make_pair(k, built)).first->second;
+}
+
+void lookup_cache::clear() {
+	std::lock_guard<std::mutex> lock(m_mutex);
+	m_indexes.clear();
+}
+
+std::size_t lookup_cache::memory_usage() const {
+	std::lock_guard<std::mutex> lock(m_mutex);
+	std::size_t ret = tree_usage(m_indexes);
+	for (auto &p : m_indexes) {
+		ret += p.second->memory_usage();
+	}
+	return ret;
+}
+
+const astnode_range &range_function::range(const astnode *parameter) const {
+	const astnode_range *r = dynamic_cast<const astnode_range *>(parameter);
+	if (r == nullptr) {
+		throw evaluation_error(str() + " requires range");
+	}
+	return *r;
+}
+
+std::shared_ptr<const lookup_index> range_function::index(const cellindex &first, unsigned int count, bool horizontal, const environment &env, std::set<cellindex> &evaluation_stack) const {
+	lookup_cache *lookups = env.lookups();
+	if (lookups == nullptr) {
+		return lookup_cache::build(first, count, horizontal, env, evaluation_stack);
+	}
+	return lookups->index(first, count, horizontal, env, evaluation_stack);
+}
+
+/** Position from 1 to zero based offset, checked against the size. */
+static unsigned int position(double p, unsigned int size, const std::string &name) {
+	if (!(p >= 1 && p < size + 1.0)) {
+		throw evaluation_error(name + " position out of range");
+	}
+	return static_cast<unsigned int>(p) - 1;
+}
+
+double vlookup_function::apply(const std::vector<astnode *> &parameters, const environment &env, std::set<cellindex> &evaluation_stack) const {
+	if (parameters.size() < 3 || parameters.size() > 4) {
+		throw evaluation_error(str() + " requires 3 or 4 parameters");
+	}
+
+	const astnode_range &r = range(parameters[1]);
+	double value = parameters[0]->evaluate(env, evaluation_stack);
+	unsigned int col = position(parameters[2]->evaluate(env, evaluation_stack), r.cols(), str());
+	bool approximate = parameters.size() < 4 || parameters[3]->evaluate(env, evaluation_stack) != 0;
+
+	env.range_dependency(r.first, r.last);
+	std::shared_ptr<const lookup_index> idx = index(r.first, r.rows(), false, env, evaluation_stack);
+	unsigned int row = approximate ? idx->at_most(value) : idx->exact(value);
+	if (row == lookup_index::npos) {
+		throw evaluation_error(str() + " value not found");
+	}
+	return env.find(cellindex(r.first.col + col, r.first.row + row), evaluation_stack);
+}
+
+double match_function::apply(const std::vector<astnode *> &parameters, const environment &env, std::set<cellindex> &evaluation_stack) const {
+	if (parameters.size() < 2 || parameters.size() > 3) {
+		throw evaluation_error(str() + " requires 2 or 3 parameters");
+	}
+
+	const astnode_range &r = range(parameters[1]);
+	if (r.cols() != 1 && r.rows() != 1) {
+		throw evaluation_error(str() + " requires one column or one row range");
+	}
+	double value = parameters[0]->evaluate(env, evaluation_stack);
+	double type = parameters.size() < 3 ? 1 : parameters[2]->evaluate(env, evaluation_stack);
+
+	env.range_dependency(r.first, r.last);
+	bool horizontal = r.rows() == 1 && r.cols() != 1;
+	std::shared_ptr<const lookup_index> idx = index(r.first, horizontal ? r.cols() : r.rows(), horizontal, env, evaluation_stack);
+	unsigned int found = type > 0 ? idx->at_most(value) : type < 0 ? idx->at_least(value) : idx->exact(value);
+	if (found == lookup_index::npos) {
+		throw evaluation_error(str() + " value not found");
+	}
+	return found + 1;
+}
+
+double index_function::apply(const std::vector<astnode *> &parameters, const environment &env, std::set<cellindex> &evaluation_stack) const {
+	if (parameters.size() < 2 || parameters.size() > 3) {
+		throw evaluation_error(str() + " requires 2 or 3 parameters");
+	}
+
+	const astnode_range &r = range(parameters[0]);
+	double first = parameters[1]->evaluate(env, evaluation_stack);
+	unsigned int row = 0, col = 0;
+	if (parameters.size() == 3) {
+		row = position(first, r.rows(), str());
+		col = position(parameters[2]->evaluate(env, evaluation_stack), r.cols(), str());
+	} else if (r.rows() == 1) {
+		col = position(first, r.cols(), str());
+	} else {
+		row = position(first, r.rows(), str());
+	}
+	return env.find(cellindex(r.first.col + col, r.first.row + row), evaluation_stack);
+}
@@ -0,0 +1,136 @@
+/** \file Lookup functions and their search indexes. */
+
+#ifndef LOOKUP_HH
+#define LOOKUP_HH
+
+#include <map>
+#include <memory>
+#include <mutex>
+#include <tuple>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "functions.hh"
+
+/** Search index of the cells in one column or row of a range.
+ * Hash for exact matches, sorted values for approximate matches,
+ * so approximate match doesn't require the cells to be sorted.
+ * Empty and string cells are not indexed. The first error cell is kept, and lookups
+ * which would reach it by linear search throw its error.
+ */
+class lookup_index {
+public:
+	/** Not found position. */
+	static const unsigned int npos = ~0u;
+
+	lookup_index() : m_error_position(npos) {}
+
+	/** Position of the first cell equal to the value.
+	 *
+	 * @throw evaluation_error of the error cell before the found position, or of any if not found
+	 */
+	unsigned int exact(double value) const;
+
+	/** Position of the largest value not greater than the value, last of the equal ones.
+	 *
+	 * @throw evaluation_error as `exact`
+	 */
+	unsigned int at_most(double value) const;
+
+	/** Position of the smallest value not less than the value, first of the equal ones.
+	 *
+	 * @throw evaluation_error as `exact`
+	 */
+	unsigned int at_least(double value) const;
+
+	/** Memory used by the index, in bytes. */
+	std::size_t memory_usage() const;
+
+private:
+	friend class lookup_cache;
+
+	/** Throws the error if it is before the found position. */
+	unsigned int checked(unsigned int found) const;
+
+	std::unordered_map<double, unsigned int> m_exact;
+
+	/** Values with their positions, ordered. */
+	std::vector<std::pair<double, unsigned int> > m_sorted;
+
+	/** First error cell, npos if there is none. */
+	unsigned int m_error_position;
+	std::string m_error;
+};
+
+/** Lookup indexes of ranges, shared by all formulas evaluated with the same state.
+ * Indexes are built on first use from the evaluated cells, and forgotten with the memoized values.
+ * Thread safe.
+ */
+class lookup_cache {
+public:
+	/** Index of `count` cells from `first` down the column, or along the row if `horizontal`.
+	 *
+	 * @throw evaluation_error if the cells are being evaluated (circular reference)
+	 * @throw pending_evaluation, evaluation_cancelled and then index is not built
+	 */
+	std::shared_ptr<const lookup_index> index(const cellindex &first, unsigned int count, bool horizontal, const environment &env, std::set<cellindex> &evaluation_stack);
+
+	/** Forget all indexes. */
+	void clear();
+
+	/** Memory used by the indexes, in bytes. */
+	std::size_t memory_usage() const;
+
+	/** Build index, without caching it. */
+	static std::shared_ptr<const lookup_index> build(const cellindex &first, unsigned int count, bool horizontal, const environment &env, std::set<cellindex> &evaluation_stack);
+
+private:
+	typedef std::tuple<unsigned int, unsigned int, unsigned int, bool> key;
+
+	mutable std::mutex m_mutex;
+	std::map<key, std::shared_ptr<const lookup_index> > m_indexes;
+};
+
+/** Parent class of functions taking range parameters. Ranges are not evaluated, so these are lazy. */
+class range_function : public function {
+public:
+	range_function(const std::string &name, const function_traits &traits) : function(name, traits) {}
+
+protected:
+	/** The parameter, which must be range. */
+	const astnode_range &range(const astnode *parameter) const;
+
+	/** Index of the cells, cached in the environment if it has lookup cache. */
+	std::shared_ptr<const lookup_index> index(const cellindex &first, unsigned int count, bool horizontal, const environment &env, std::set<cellindex> &evaluation_stack) const;
+};
+
+/** VLOOKUP(value, range, column, [approximate = 1]).
+ * Finds the value in the first column of the range, and returns the cell of the column (from 1) in the found row.
+ * Approximate match finds the largest value not greater than the value.
+ */
+class vlookup_function : public range_function {
+public:
+	vlookup_function() : range_function("vlookup", function_traits().set_arity(3, 4)) {}
+	double apply(const std::vector<astnode *> &parameters, const environment &env, std::set<cellindex> &evaluation_stack) const;
+};
+
+/** MATCH(value, range, [type = 1]), position (from 1) of the value in one column or row range.
+ * Type 0 is exact match, 1 the largest value not greater, -1 the smallest value not less than the value.
+ */
+class match_function : public range_function {
+public:
+	match_function() : range_function("match", function_traits().set_arity(2, 3)) {}
+	double apply(const std::vector<astnode *> &parameters, const environment &env, std::set<cellindex> &evaluation_stack) const;
+};
+
+/** INDEX(range, row, [column = 1]), the cell of the range (positions from 1).
+ * For one row range, the second parameter is the column.
+ */
+class index_function : public range_function {
+public:
+	index_function() : range_function("index", function_traits().set_arity(2, 3)) {}
+	double apply(const std::vector<astnode *> &parameters, const environment &env, std::set<cellindex> &evaluation_stack) const;
+};
+
+#endif
@@ -0,0 +1,155 @@
+#include "paging.hh"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <stdexcept>
+#include <vector>
+
+#include <fcntl.h>
+#include <stdlib.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+const std::size_t page_file::chunk_size;
+
+static std::runtime_error page_error(const std::string &what, const std::string &path) {
+	return std::runtime_error("page file " + what + " -- " + path + ": " + std::strerror(errno));
+}
+
+/** Create new file named by the path with unique suffix, existing files are not touched. */
+static int create_unique(std::string &path) {
+	std::vector<char> name(path.begin(), path.end());
+	const char suffix[] = ".XXXXXX";
+	name.insert(name.end(), suffix, suffix + sizeof(suffix));
+	int fd = ::mkstemp(&name[0]);
+	path = &name[0];
+	return fd;
+}
+
+page_file::page_file(const std::string &path, std::size_t budget)
+	: m_path(path), m_fd(create_unique(m_path)), m_hand(0), m_budget(budget),
+	m_resident(0), m_size(0), m_page_ins(0), m_page_outs(0) {
+	if (m_fd < 0) {
+		throw page_error("can't create", m_path);
+	}
+	::unlink(m_path.c_str());
+}
+
+page_file::~page_file() {
+	for (tile &t : m_tiles) {
+		::munmap(const_cast<char *>(t.data), t.mapped);
+	}
+	::close(m_fd);
+}
+
+page_file::tile *page_file::append(const void *data, std::size_t size) {
+	std::lock_guard<std::mutex> lock(m_mutex);
+
+	// Tiles start at page boundary, so each is mapped on its own.
+	std::size_t page = ::sysconf(_SC_PAGESIZE);
+	std::size_t mapped = (std::max<std::size_t>(size, 1) + page - 1) / page * page;
+	std::size_t written = 0;
+	while (written < size) {
+		ssize_t n = ::pwrite(m_fd, static_cast<const char *>(data) + written, size - written, m_size + written);
+		if (n < 0 && errno != EINTR) {
+			throw page_error("can't write", m_path);
+		}
+		written += n > 0 ? n : 0;
+	}
+	if (::ftruncate(m_fd, m_size + mapped) != 0) {
+		throw page_error("can't extend", m_path);
+	}
+
+	void *mapping = ::mmap(nullptr, mapped, PROT_READ, MAP_SHARED, m_fd, m_size);
+	if (mapping == MAP_FAILED) {
+		throw page_error("can't map", m_path);
+	}
+	// Pages written through the file are not needed in memory until accessed.
+	::posix_fadvise(m_fd, m_size, mapped, POSIX_FADV_DONTNEED);
+
+	m_tiles.emplace_back();
+	tile &t = m_tiles.back();
+	t.data = static_cast<const char *>(mapping);
+	t.mapped = mapped;
+	t.offset = m_size;
+	t.size = size;
+	std::size_t chunks = (mapped + chunk_size - 1) / chunk_size;
+	t.chunks.reset(new chunk[chunks]);
+	for (std::size_t k = 0; k < chunks; k++) {
+		m_clock.push_back(slot(&t, k));
+	}
+
+	m_size += mapped;
+	return &t;
+}
+
+void page_file::page_in(tile &t, std::size_t k) {
+	std::lock_guard<std::mutex> lock(m_mutex);
+	chunk &c = t.chunks[k];
+	if (c.resident.load(std::memory_order_relaxed)) {
+		return;
+	}
+
+	// Pages are read by the first access, advice only starts reading them ahead.
+	::madvise(const_cast<char *>(t.data) + k * chunk_size, chunk_bytes(t, k), MADV_WILLNEED);
+	c.resident.store(true, std::memory_order_release);
+	m_resident += chunk_bytes(t, k);
+	m_page_ins++;
+	sweep(&c);
+}
+
+void page_file::sweep(const chunk *keep) {
+	// Two rounds of the clock clear all used marks, so they are enough to fit the budget.
+	for (std::size_t n = 0; n < 2 * m_clock.size() && m_resident > m_budget; n++) {
+		slot &s = m_clock[m_hand];
+		m_hand = (m_hand + 1) % m_clock.size();
+		chunk &c = s.t->chunks[s.k];
+		if (&c == keep || !c.resident.load(std::memory_order_relaxed)) {
+			continue;
+		}
+		if (c.used.load(std::memory_order_relaxed)) {
+			c.used.store(false, std::memory_order_relaxed);
+			continue;
+		}
+
+		// Readers of the chunk still see its contents, the dropped pages are read from the file again.
+		std::size_t bytes = chunk_bytes(*s.t, s.k);
+		c.resident.store(false, std::memory_order_relaxed);
+		::madvise(const_cast<char *>(s.t->data) + s.k * chunk_size, bytes, MADV_DONTNEED);
+		::posix_fadvise(m_fd, s.t->offset + s.k * chunk_size, bytes, POSIX_FADV_DONTNEED);
+		m_resident -= bytes;
+		m_page_outs++;
+	}
+}
+
+void page_file::set_budget(std::size_t budget) {
+	std::lock_guard<std::mutex> lock(m_mutex);
+	m_budget = budget;
+	sweep(nullptr);
+}
+
+std::size_t page_file::budget() const {
+	std::lock_guard<std::mutex> lock(m_mutex);
+	return m_budget;
+}
+
+std::size_t page_file::resident() const {
+	std::lock_guard<std::mutex> lock(m_mutex);
+	return m_resident;
+}
+
+std::size_t page_file::file_size() const {
+	std::lock_guard<std::mutex> lock(m_mutex);
+	return m_size;
+}
+
+std::size_t page_file::page_ins() const {
+	std::lock_guard<std::mutex> lock(m_mutex);
+	return m_page_ins;
+}
+
+std::size_t page_file::page_outs() const {
+	std::lock_guard<std::mutex> lock(m_mutex);
+	return m_page_outs;
+}
@@ -0,0 +1,126 @@
+/** \file Memory-mapped backing file for data larger than memory. */
+
+#ifndef PAGING_HH
+#define PAGING_HH
+
+#include <atomic>
+#include <cstddef>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+/** Backing file of immutable tiles, mapped read only into memory.
+ *
+ * Tiles are paged in and out by chunks of `chunk_size` bytes. Resident chunks are tracked
+ * by the clock algorithm: when they exceed the memory budget, chunks not used since the last
+ * sweep of the clock are paged out. Their pages are dropped, and read from the file again
+ * on next access. Hot chunks stay resident.
+ *
+ * Accessing tile is thread safe, also while other thread pages it out or appends tiles.
+ * Using resident chunk costs two atomic loads, paging in and out takes the lock.
+ * Space of tiles no longer used is not reused, the file only grows.
+ */
+class page_file {
+public:
+	static const std::size_t chunk_size = 64 * 1024;
+
+	struct chunk {
+		chunk() : used(false), resident(false) {}
+
+		/** Used since the last sweep of the clock. */
+		std::atomic<bool> used;
+		std::atomic<bool> resident;
+	};
+
+	/** Tile of the file. Address is stable, regions keep pointers to it. */
+	struct tile {
+		tile() : data(nullptr), mapped(0), offset(0), size(0) {}
+
+		const char *data;
+		/** Mapped bytes, whole pages from the offset in the file. */
+		std::size_t mapped;
+		std::size_t offset;
+		std::size_t size;
+		std::unique_ptr<chunk[]> chunks;
+	};
+
+	/** Create the backing file, named by `path` with unique suffix, so existing files are
+	 * never overwritten. It is removed right away, so it doesn't outlive the process.
+	 *
+	 * @throw std::runtime_error if the file can't be created
+	 */
+	page_file(const std::string &path, std::size_t budget);
+
+	~page_file();
+
+	/** Write the data as new tile, which is mapped, but not resident until accessed. */
+	tile *append(const void *data, std::size_t size);
+
+	/** Mark the chunk with the byte of the tile used, paging it in if it is not resident. */
+	void touch(tile &t, std::size_t offset) {
+		std::size_t k = offset / chunk_size;
+		chunk &c = t.chunks[k];
+		if (!c.used.load(std::memory_order_relaxed)) {
+			c.used.store(true, std::memory_order_relaxed);
+		}
+		if (!c.resident.load(std::memory_order_acquire)) {
+			page_in(t, k);
+		}
+	}
+
+	/** Change the memory budget, paging out chunks over it. */
+	void set_budget(std::size_t budget);
+
+	std::size_t budget() const;
+
+	/** Bytes of the resident chunks. */
+	std::size_t resident() const;
+
+	/** Bytes of the backing file. */
+	std::size_t file_size() const;
+
+	/** Number of chunks paged in and out so far. */
+	std::size_t page_ins() const;
+	std::size_t page_outs() const;
+
+private:
+	page_file(const page_file &);
+	page_file &operator=(const page_file &);
+
+	/** Chunk on the clock. */
+	struct slot {
+		slot(tile *t, std::size_t k) : t(t), k(k) {}
+
+		tile *t;
+		std::size_t k;
+	};
+
+	void page_in(tile &t, std::size_t k);
+
+	/** Mapped bytes of the chunk. */
+	static std::size_t chunk_bytes(const tile &t, std::size_t k) {
+		return std::min(chunk_size, t.mapped - k * chunk_size);
+	}
+
+	/** Page out chunks until the resident ones fit the budget, must be called locked.
+	 * The chunk being paged in is kept.
+	 */
+	void sweep(const chunk *keep);
+
+	std::string m_path;
+	int m_fd;
+
+	mutable std::mutex m_mutex;
+	std::deque<tile> m_tiles;
+	std::vector<slot> m_clock;
+	std::size_t m_hand;
+	std::size_t m_budget;
+	std::size_t m_resident;
+	std::size_t m_size;
+	std::size_t m_page_ins;
+	std::size_t m_page_outs;
+};
+
+#endif
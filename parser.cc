@@ -14,6 +14,8 @@
  *       prim
  *
  * prim: NAME ( expr_list )
+ *       NAME ! NAME  // cell of other sheet
+ *       NAME : NAME  // range
  *       NAME
  *       NUMBER
  *       ( expr )
@@ -43,7 +45,9 @@ public:
 		DIV = '/',
 		LP = '(',
 		RP = ')',
-		COMMA = ','
+		COMMA = ',',
+		EXCL = '!',
+		COLON = ':'
 	};
 
 	type get_type() const {
@@ -88,6 +92,7 @@ std::deque<token> tokenize(std::istream &is) {
 		case '+': case '-':
 		case '*': case '/':
 		case '(': case ')': case ',':
+		case '!': case ':':
 			tokenstream.push_back(token((token::type) ch));
 			break;
 
@@ -118,23 +123,36 @@ std::deque<token> tokenize(std::istream &is) {
 }
 
 // Forward declaration of parsing functions.
-astnode *expr(std::deque<token> &tokenstream, const functionmap &fm);
-astnode *term(std::deque<token> &tokenstream, const functionmap &fm);
-astnode *prim(std::deque<token> &tokenstream, const functionmap &fm);
+astnode *expr(std::deque<token> &tokenstream, const function_registry &fm);
+astnode *term(std::deque<token> &tokenstream, const function_registry &fm);
+astnode *prim(std::deque<token> &tokenstream, const function_registry &fm);
 
-astnode *parse(const std::string &input, const functionmap &fm) {
+input_kind classify(const std::string &input, double &number) {
 	// first try if it a number
 	{
 		std::istringstream iss(input);
-		double d;
-		if (iss >> d && iss.eof()) {
-			return new astnode_number(d);
+		if (iss >> number && iss.eof()) {
+			return input_number;
 		}
 	}
 
 	// it's not formula if not begins with =
 	if (input.size() == 0 || input[0] != '=') {
+		return input_string;
+	}
+
+	return input_formula;
+}
+
+astnode *parse(const std::string &input, const function_registry &fm) {
+	double d;
+	switch (classify(input, d)) {
+	case input_number:
+		return new astnode_number(d);
+	case input_string:
 		throw not_formula_error("not formula");
+	case input_formula:
+		break;
 	}
 
 	// parse the formula
@@ -162,26 +180,44 @@ astnode *parse(const std::string &input, const functionmap &fm) {
 	return expr(tokenstream, fm);
 }
 
-function *findfm(const functionmap &m, const std::string &key) {
-	auto iter = m.find(key);
-	if (iter == m.end()) {
+astnode *parse(const std::string &input, const functionmap &fm) {
+	function_registry registry(fm);
+	return parse(input, registry);
+}
+
+unsigned int findfm(const function_registry &m, const std::string &key) {
+	unsigned int id = m.id(key);
+	if (id == function_registry::npos) {
 		throw syntax_error("no function -- " + key);
 	}
-	return iter->second;
+	return id;
+}
+
+unsigned int findop(const function_registry &m, char op) {
+	if (m.binary_operator(op) == nullptr) {
+		throw syntax_error(std::string("no function -- ") + op);
+	}
+	return m.id(std::string(1, op));
 }
 
-astnode *expr(std::deque<token> &tokenstream, const functionmap &fm) {
+/** Call node of the binary operator. */
+astnode *opcall(const function_registry &m, char op, astnode *left, astnode *right) {
+	unsigned int id = findop(m, op);
+	return new astnode_call(m[id], left, right, id);
+}
+
+astnode *expr(std::deque<token> &tokenstream, const function_registry &fm) {
 	astnode *left = term(tokenstream, fm);
 
 	while (true) {
 		switch (tokenstream.front().get_type()) {
 		case token::PLUS:
 			tokenstream.pop_front();
-			left = new astnode_call(findfm(fm, "+"), left, term(tokenstream, fm));
+			left = opcall(fm, '+', left, term(tokenstream, fm));
 			break;
 		case token::MINUS:
 			tokenstream.pop_front();
-			left = new astnode_call(findfm(fm, "-"), left, term(tokenstream, fm));
+			left = opcall(fm, '-', left, term(tokenstream, fm));
 			break;
 		default:
 			return left;
@@ -189,18 +225,18 @@ astnode *expr(std::deque<token> &tokenstream, const functionmap &fm) {
 	}
 }
 
-astnode *term(std::deque<token> &tokenstream, const functionmap &fm) {
+astnode *term(std::deque<token> &tokenstream, const function_registry &fm) {
 	astnode *left = prim(tokenstream, fm);
 
 	while (true) {
 		switch (tokenstream.front().get_type()) {
 		case token::MUL:
 			tokenstream.pop_front();
-			left = new astnode_call(findfm(fm, "*"), left, prim(tokenstream, fm));
+			left = opcall(fm, '*', left, prim(tokenstream, fm));
 			break;
 		case token::DIV:
 			tokenstream.pop_front();
-			left = new astnode_call(findfm(fm, "/"), left, prim(tokenstream, fm));
+			left = opcall(fm, '/', left, prim(tokenstream, fm));
 			break;
 		default:
 			return left;
@@ -208,7 +244,7 @@ astnode *term(std::deque<token> &tokenstream, const functionmap &fm) {
 	}
 }
 
-astnode *prim(std::deque<token> &tokenstream, const functionmap &fm) {
+astnode *prim(std::deque<token> &tokenstream, const function_registry &fm) {
 	astnode *ret;
 
 	switch (tokenstream.front().get_type()) {
@@ -222,7 +258,23 @@ astnode *prim(std::deque<token> &tokenstream, const functionmap &fm) {
 		tokenstream.pop_front();
 		std::string string_value = t.get_name();
 
-		if (tokenstream.front().get_type() != token::LP) {
+		if (tokenstream.front().get_type() == token::EXCL) {
+			tokenstream.pop_front(); // eat !
+			if (tokenstream.front().get_type() != token::NAME) {
+				throw syntax_error("cannot parse, no cell after sheet -- " + string_value);
+			}
+			std::string cell_name = tokenstream.front().get_name();
+			tokenstream.pop_front();
+			ret = new astnode_sheet_cell(string_value, cellindex(cell_name));
+		} else if (tokenstream.front().get_type() == token::COLON) {
+			tokenstream.pop_front(); // eat :
+			if (tokenstream.front().get_type() != token::NAME) {
+				throw syntax_error("cannot parse, no cell after range start -- " + string_value);
+			}
+			std::string last_name = tokenstream.front().get_name();
+			tokenstream.pop_front();
+			ret = new astnode_range(cellindex(string_value), cellindex(last_name));
+		} else if (tokenstream.front().get_type() != token::LP) {
 			ret = new astnode_cell(cellindex(string_value));
 		} else {
 			tokenstream.pop_front();  // eat (
@@ -241,7 +293,12 @@ astnode *prim(std::deque<token> &tokenstream, const functionmap &fm) {
 				}
 				tokenstream.pop_front(); // eat )
 			}
-			ret = new astnode_call(findfm(fm, string_value), rands);
+			unsigned int id = findfm(fm, string_value);
+			const function_traits &traits = fm[id]->traits();
+			if (rands.size() < traits.min_arity || rands.size() > traits.max_arity) {
+				throw syntax_error("wrong number of parameters -- " + string_value);
+			}
+			ret = new astnode_call(fm[id], rands, id);
 		}
 		return ret;
 	}
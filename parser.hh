@@ -5,12 +5,34 @@
 
 #include "definitions.hh"
 #include "ast.hh"
+#include "registry.hh"
+
+/** Kind of the cell input. */
+enum input_kind {
+	input_number,
+	input_formula,
+	input_string
+};
+
+/** Cheap classification of the input, formulas are not parsed.
+ *
+ * @param number set to the value if input is number
+ */
+input_kind classify(const std::string &, double &number);
 
 /** Parse string into astnode tree.
  *
  * @throw not_formula_error
  * @throw syntax_error
  */
+astnode *parse(const std::string &, const function_registry &);
+
+/** Parse with temporary registry of the functions.
+ * Function ids in the tree are valid for registries built from the same map.
+ *
+ * @throw not_formula_error
+ * @throw syntax_error
+ */
 astnode *parse(const std::string &, const functionmap &);
 
 #endif
@@ -0,0 +1,135 @@
+#include "profiler.hh"
+
+#include <algorithm>
+
+void profiler::record(const cellindex &index, double inclusive, double exclusive) {
+	std::lock_guard<std::mutex> lock(m_mutex);
+	auto iter = m_cells.insert(std::make_pair(index, cell_profile())).first;
+	iter->second.inclusive += inclusive;
+	iter->second.exclusive += exclusive;
+	iter->second.evaluations++;
+}
+
+void profiler::dependency(const cellindex &dependent, const cellindex &precedent) {
+	std::lock_guard<std::mutex> lock(m_mutex);
+	m_precedents[dependent].insert(precedent);
+}
+
+std::vector<std::pair<cellindex, cell_profile> > profiler::top(std::size_t n) const {
+	std::lock_guard<std::mutex> lock(m_mutex);
+
+	// cellindex is not assignable, so sort iterators.
+	typedef std::map<cellindex, cell_profile>::const_iterator iterator;
+	std::vector<iterator> cells;
+	for (iterator iter = m_cells.begin(); iter != m_cells.end(); ++iter) {
+		cells.push_back(iter);
+	}
+
+	auto more_expensive = [](const iterator &a, const iterator &b) {
+		return a->second.exclusive > b->second.exclusive;
+	};
+	std::stable_sort(cells.begin(), cells.end(), more_expensive);
+
+	std::vector<std::pair<cellindex, cell_profile> > ret;
+	for (std::size_t k = 0; k < cells.size() && k < n; k++) {
+		ret.push_back(*cells[k]);
+	}
+	return ret;
+}
+
+/** Length of the longest path starting in the cell, memoized in `lengths`.
+ * Edges closing a cycle (circular references) are ignored.
+ */
+double profiler::longest_path(const cellindex &index, std::map<cellindex, double> &lengths, std::set<cellindex> &visiting) const {
+	auto found = lengths.find(index);
+	if (found != lengths.end()) {
+		return found->second;
+	}
+
+	double longest = 0;
+	auto precedents = m_precedents.find(index);
+	if (precedents != m_precedents.end()) {
+		visiting.insert(index);
+		for (const cellindex &precedent : precedents->second) {
+			if (visiting.find(precedent) == visiting.end()) {
+				longest = std::max(longest, longest_path(precedent, lengths, visiting));
+			}
+		}
+		visiting.erase(index);
+	}
+
+	auto cell = m_cells.find(index);
+	double length = longest + (cell == m_cells.end() ? 0 : cell->second.exclusive);
+	lengths.insert(std::make_pair(index, length));
+	return length;
+}
+
+std::vector<cellindex> profiler::critical_path(double &cost) const {
+	std::lock_guard<std::mutex> lock(m_mutex);
+	std::map<cellindex, double> lengths;
+	std::set<cellindex> visiting;
+	std::vector<cellindex> path;
+	cost = 0;
+
+	// Start from the cell with the longest path
+	for (auto &p : m_cells) {
+		double length = longest_path(p.first, lengths, visiting);
+		if (path.empty() || length > cost) {
+			path.clear();
+			path.push_back(p.first);
+			cost = length;
+		}
+	}
+
+	// and follow the precedents with the longest paths.
+	while (!path.empty()) {
+		auto precedents = m_precedents.find(path.back());
+		if (precedents == m_precedents.end()) {
+			break;
+		}
+
+		const cellindex *next = nullptr;
+		double next_length = 0;
+		for (const cellindex &precedent : precedents->second) {
+			bool on_path = std::find(path.begin(), path.end(), precedent) != path.end();
+			double length = longest_path(precedent, lengths, visiting);
+			if (!on_path && (next == nullptr || length > next_length)) {
+				next = &precedent;
+				next_length = length;
+			}
+		}
+		if (next == nullptr) {
+			break;
+		}
+		path.push_back(*next);
+	}
+
+	return path;
+}
+
+void profiler::write_json(std::ostream &os, std::size_t n) const {
+	std::vector<std::pair<cellindex, cell_profile> > cells = top(n);
+	double cost;
+	std::vector<cellindex> path = critical_path(cost);
+
+	os << "{\"top\":[";
+	for (std::size_t k = 0; k < cells.size(); k++) {
+		const cell_profile &p = cells[k].second;
+		os << (k == 0 ? "" : ",")
+			<< "{\"cell\":\"" << cells[k].first << "\""
+			<< ",\"exclusive_us\":" << p.exclusive
+			<< ",\"inclusive_us\":" << p.inclusive
+			<< ",\"evaluations\":" << p.evaluations << "}";
+	}
+	os << "],\"critical_path\":{\"cost_us\":" << cost << ",\"cells\":[";
+	for (std::size_t k = 0; k < path.size(); k++) {
+		os << (k == 0 ? "" : ",") << "\"" << path[k] << "\"";
+	}
+	os << "]}}";
+}
+
+void profiler::clear() {
+	std::lock_guard<std::mutex> lock(m_mutex);
+	m_cells.clear();
+	m_precedents.clear();
+}
@@ -0,0 +1,65 @@
+/** \file Per-cell evaluation profiler. */
+
+#ifndef PROFILER_HH
+#define PROFILER_HH
+
+#include <map>
+#include <mutex>
+#include <ostream>
+#include <set>
+#include <vector>
+
+#include "cellindex.hh"
+
+/** Evaluation cost of one cell, times in microseconds. */
+struct cell_profile {
+	cell_profile() : inclusive(0), exclusive(0), evaluations(0) {}
+
+	/** Time spent evaluating the cell, including its precedents. */
+	double inclusive;
+
+	/** Time spent in the cell itself, without evaluation of its precedents. */
+	double exclusive;
+
+	/** How many times the cell was evaluated (not found in cache). */
+	unsigned long evaluations;
+};
+
+/** Records evaluation times of cells and dependencies between them.
+ * Thread safe, concurrent evaluations can record into the same profiler.
+ *
+ * \sa environment::set_profiler
+ */
+class profiler {
+public:
+	/** Add one evaluation of the cell. */
+	void record(const cellindex &index, double inclusive, double exclusive);
+
+	/** Record that evaluation of `dependent` looked up `precedent`. */
+	void dependency(const cellindex &dependent, const cellindex &precedent);
+
+	/** Cells with the highest exclusive time, most expensive first. */
+	std::vector<std::pair<cellindex, cell_profile> > top(std::size_t n) const;
+
+	/** Longest chain of dependencies weighted by exclusive times, which limits parallel recalculation.
+	 * First cell is the dependent one, last is the precedent without further precedents.
+	 *
+	 * @param cost set to the sum of exclusive times on the path
+	 */
+	std::vector<cellindex> critical_path(double &cost) const;
+
+	/** Write report with top-N cells and the critical path as JSON. */
+	void write_json(std::ostream &os, std::size_t n) const;
+
+	/** Forget everything recorded. */
+	void clear();
+
+private:
+	double longest_path(const cellindex &index, std::map<cellindex, double> &lengths, std::set<cellindex> &visiting) const;
+
+	mutable std::mutex m_mutex;
+	std::map<cellindex, cell_profile> m_cells;
+	std::map<cellindex, std::set<cellindex> > m_precedents;
+};
+
+#endif
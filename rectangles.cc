@@ -0,0 +1,103 @@
+#include "rectangles.hh"
+
+#include <algorithm>
+
+/** Median of the midpoints of the intervals, which is contained in at least one of them. */
+template <typename Low, typename High>
+static unsigned int center(const std::vector<std::size_t> &items, Low low, High high) {
+	std::vector<unsigned long long> mids;
+	mids.reserve(items.size());
+	for (std::size_t k : items) {
+		// doubled, so that it doesn't round
+		mids.push_back(static_cast<unsigned long long>(low(k)) + high(k));
+	}
+	std::nth_element(mids.begin(), mids.begin() + mids.size() / 2, mids.end());
+	return static_cast<unsigned int>(mids[mids.size() / 2] / 2);
+}
+
+rectangle_index::rectangle_index(const std::vector<rectangle> &rectangles) : m_rectangles(rectangles) {
+	std::vector<std::size_t> items;
+	for (std::size_t k = 0; k < m_rectangles.size(); k++) {
+		items.push_back(k);
+	}
+	m_root = build_cols(items);
+}
+
+int rectangle_index::build_cols(std::vector<std::size_t> &items) {
+	if (items.empty()) {
+		return -1;
+	}
+
+	auto low = [this](std::size_t k) { return m_rectangles[k].first.col; };
+	auto high = [this](std::size_t k) { return m_rectangles[k].last.col; };
+	unsigned int c = center(items, low, high);
+
+	std::vector<std::size_t> left, right, here;
+	for (std::size_t k : items) {
+		if (high(k) < c) {
+			left.push_back(k);
+		} else if (low(k) > c) {
+			right.push_back(k);
+		} else {
+			here.push_back(k);
+		}
+	}
+	items.clear();
+
+	int n = m_cols.size();
+	m_cols.push_back(col_node());
+	m_cols[n].center = c;
+	m_cols[n].root = build_rows(m_cols[n].rows, here);
+	int l = build_cols(left);
+	int r = build_cols(right);
+	m_cols[n].left = l;
+	m_cols[n].right = r;
+	return n;
+}
+
+int rectangle_index::build_rows(std::vector<row_node> &nodes, std::vector<std::size_t> &items) {
+	if (items.empty()) {
+		return -1;
+	}
+
+	auto low = [this](std::size_t k) { return m_rectangles[k].first.row; };
+	auto high = [this](std::size_t k) { return m_rectangles[k].last.row; };
+	unsigned int c = center(items, low, high);
+
+	std::vector<std::size_t> left, right;
+	row_node node;
+	node.center = c;
+	for (std::size_t k : items) {
+		if (high(k) < c) {
+			left.push_back(k);
+		} else if (low(k) > c) {
+			right.push_back(k);
+		} else {
+			node.by_low.push_back(k);
+		}
+	}
+	items.clear();
+
+	node.by_high = node.by_low;
+	std::sort(node.by_low.begin(), node.by_low.end(), [&](std::size_t a, std::size_t b) { return low(a) < low(b); });
+	std::sort(node.by_high.begin(), node.by_high.end(), [&](std::size_t a, std::size_t b) { return high(a) > high(b); });
+
+	int n = nodes.size();
+	nodes.push_back(node);
+	int l = build_rows(nodes, left);
+	int r = build_rows(nodes, right);
+	nodes[n].left = l;
+	nodes[n].right = r;
+	return n;
+}
+
+std::size_t rectangle_index::memory_usage() const {
+	std::size_t ret = m_rectangles.capacity() * sizeof(rectangle) + m_cols.capacity() * sizeof(col_node);
+	for (const col_node &c : m_cols) {
+		ret += c.rows.capacity() * sizeof(row_node);
+		for (const row_node &r : c.rows) {
+			ret += (r.by_low.capacity() + r.by_high.capacity()) * sizeof(std::size_t);
+		}
+	}
+	return ret;
+}
@@ -0,0 +1,110 @@
+/** \file Spatial index of rectangles of cells. */
+
+#ifndef RECTANGLES_HH
+#define RECTANGLES_HH
+
+#include <cstddef>
+#include <vector>
+
+#include "cellindex.hh"
+
+/** Rectangle of cells with identifier of its owner. */
+struct rectangle {
+	rectangle(const cellindex &first, const cellindex &last, std::size_t id) : first(first), last(last), id(id) {}
+
+	bool contains(const cellindex &i) const {
+		return i.col >= first.col && i.col <= last.col && i.row >= first.row && i.row <= last.row;
+	}
+
+	cellindex first;
+	cellindex last;
+	std::size_t id;
+};
+
+/** Immutable index of rectangles, finding the ones containing a cell (stabbing query).
+ *
+ * Centered interval tree over columns: each node keeps the rectangles containing its center column,
+ * the smaller ones are in the left and right subtrees. Rectangles of the node are in
+ * centered interval tree over rows, and their columns are checked only when the rows match.
+ * Building is O(n log n), query O(log^2 n) plus the rectangles of the visited nodes containing the row.
+ */
+class rectangle_index {
+public:
+	rectangle_index() : m_root(-1) {}
+	explicit rectangle_index(const std::vector<rectangle> &rectangles);
+
+	/** Call `f(id)` for each rectangle containing the cell. */
+	template <typename F>
+	void find(const cellindex &i, F f) const {
+		for (int c = m_root; c >= 0;) {
+			const col_node &cn = m_cols[c];
+			for (int r = cn.root; r >= 0;) {
+				const row_node &rn = cn.rows[r];
+				if (i.row < rn.center) {
+					for (std::size_t k = 0; k < rn.by_low.size() && m_rectangles[rn.by_low[k]].first.row <= i.row; k++) {
+						report(rn.by_low[k], i, f);
+					}
+					r = rn.left;
+				} else if (i.row > rn.center) {
+					for (std::size_t k = 0; k < rn.by_high.size() && m_rectangles[rn.by_high[k]].last.row >= i.row; k++) {
+						report(rn.by_high[k], i, f);
+					}
+					r = rn.right;
+				} else {
+					for (std::size_t k : rn.by_low) {
+						report(k, i, f);
+					}
+					break;
+				}
+			}
+
+			if (i.col == cn.center) {
+				break;
+			}
+			c = i.col < cn.center ? cn.left : cn.right;
+		}
+	}
+
+	std::size_t size() const {
+		return m_rectangles.size();
+	}
+
+	/** Memory used by the index, in bytes. */
+	std::size_t memory_usage() const;
+
+private:
+	/** Rectangles containing the center row, by increasing first row and by decreasing last row. */
+	struct row_node {
+		unsigned int center;
+		std::vector<std::size_t> by_low;
+		std::vector<std::size_t> by_high;
+		int left;
+		int right;
+	};
+
+	/** Rectangles containing the center column, in their own tree over rows. */
+	struct col_node {
+		unsigned int center;
+		std::vector<row_node> rows;
+		int root;
+		int left;
+		int right;
+	};
+
+	template <typename F>
+	void report(std::size_t k, const cellindex &i, F &f) const {
+		const rectangle &r = m_rectangles[k];
+		if (i.col >= r.first.col && i.col <= r.last.col) {
+			f(r.id);
+		}
+	}
+
+	int build_cols(std::vector<std::size_t> &items);
+	int build_rows(std::vector<row_node> &nodes, std::vector<std::size_t> &items);
+
+	std::vector<rectangle> m_rectangles;
+	std::vector<col_node> m_cols;
+	int m_root;
+};
+
+#endif
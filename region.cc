@@ -0,0 +1,287 @@
+#include "region.hh"
+
+#include <algorithm>
+#include <cstring>
+#include <unordered_map>
+
+/** Shorter runs and sequences are stored as literals. */
+static const unsigned int min_run = 4;
+
+static const std::size_t max_dictionary = 256;
+
+/** Values are compared bitwise, so that also NaNs and negative zeros are kept. */
+static std::uint64_t bits(double d) {
+	std::uint64_t ret;
+	std::memcpy(&ret, &d, sizeof(ret));
+	return ret;
+}
+
+constant_region::constant_region(unsigned int col, unsigned int first_row, const std::vector<double> &values)
+	: m_col(col), m_first_row(first_row), m_size(values.size()), m_codes_data(nullptr), m_raw_data(nullptr), m_tile(nullptr), m_codes_offset(0) {
+	std::size_t n = values.size();
+	std::size_t literals = 0;
+	std::size_t p = 0;
+	while (p < n) {
+		std::size_t q = p + 1;
+		while (q < n && bits(values[q]) == bits(values[p])) {
+			q++;
+		}
+
+		segment s;
+		s.offset = p;
+		s.base = values[p];
+		s.step = 0;
+		s.data = 0;
+		if (q - p >= min_run) {
+			s.kind = run;
+		} else {
+			// Sequence is kept only if decoding gives the same bits, also of zero signs.
+			s.kind = sequence;
+			s.step = p + 1 < n ? values[p + 1] - values[p] : 0;
+			q = p;
+			while (q < n && bits(s.base + (q - p) * s.step) == bits(values[q])) {
+				q++;
+			}
+			if (q - p < min_run) {
+				p++;
+				continue;
+			}
+		}
+
+		if (literals < p) {
+			append_literals(&values[literals], p - literals);
+		}
+		s.count = q - p;
+		m_segments.push_back(s);
+		p = q;
+		literals = q;
+	}
+	if (literals < n) {
+		append_literals(&values[literals], n - literals);
+	}
+	bind();
+}
+
+void constant_region::append_literals(const double *values, unsigned int count) {
+	segment s;
+	s.offset = m_segments.empty() ? 0 : m_segments.back().offset + m_segments.back().count;
+	s.count = count;
+	s.base = 0;
+	s.step = 0;
+
+	std::unordered_map<std::uint64_t, std::uint8_t> codes;
+	for (std::size_t k = 0; k < m_dictionary.size(); k++) {
+		codes.insert(std::make_pair(bits(m_dictionary[k]), k));
+	}
+
+	std::size_t added = 0;
+	bool fits = true;
+	for (unsigned int k = 0; k < count && fits; k++) {
+		if (codes.find(bits(values[k])) == codes.end()) {
+			if (m_dictionary.size() + added >= max_dictionary) {
+				fits = false;
+			} else {
+				codes.insert(std::make_pair(bits(values[k]), m_dictionary.size() + added));
+				added++;
+			}
+		}
+	}
+
+	if (fits) {
+		s.kind = dictionary;
+		s.data = m_codes.size();
+		m_dictionary.resize(m_dictionary.size() + added);
+		for (unsigned int k = 0; k < count; k++) {
+			std::uint8_t code = codes[bits(values[k])];
+			m_dictionary[code] = values[k];
+			m_codes.push_back(code);
+		}
+	} else {
+		s.kind = raw;
+		s.data = m_raw.size();
+		m_raw.insert(m_raw.end(), values, values + count);
+	}
+	m_segments.push_back(s);
+}
+
+double constant_region::at(unsigned int row) const {
+	unsigned int offset = row - m_first_row;
+	auto iter = std::upper_bound(m_segments.begin(), m_segments.end(), offset, [](unsigned int o, const segment &s) {
+		return o < s.offset;
+	});
+	--iter;
+	return decode(*iter, offset - iter->offset);
+}
+
+void constant_region::copy(unsigned int row, unsigned int count, double *out) const {
+	unsigned int from = row - m_first_row;
+	unsigned int to = from + count;
+	auto iter = std::upper_bound(m_segments.begin(), m_segments.end(), from, [](unsigned int o, const segment &s) {
+		return o < s.offset;
+	});
+	for (--iter; iter != m_segments.end() && iter->offset < to; ++iter) {
+		unsigned int begin = std::max(from, iter->offset);
+		unsigned int end = std::min(to, iter->offset + iter->count);
+		for (unsigned int k = begin; k < end; k++) {
+			out[k - from] = decode(*iter, k - iter->offset);
+		}
+	}
+}
+
+double constant_region::sum() const {
+	double ret = 0;
+	for (const segment &s : m_segments) {
+		switch (s.kind) {
+		case run:
+			ret += s.count * s.base;
+			break;
+		case sequence:
+			ret += s.count * s.base + s.step * (static_cast<double>(s.count) * (s.count - 1) / 2);
+			break;
+		default:
+			for (unsigned int k = 0; k < s.count; k++) {
+				ret += decode(s, k);
+			}
+		}
+	}
+	return ret;
+}
+
+std::vector<double> constant_region::values() const {
+	std::vector<double> ret;
+	ret.reserve(m_size);
+	for_each([&ret](unsigned int row, double value) {
+		ret.push_back(value);
+	});
+	return ret;
+}
+
+std::shared_ptr<const constant_region> constant_region::slice(unsigned int row, unsigned int count, unsigned int new_col, unsigned int new_first_row) const {
+	if (m_tile != nullptr) {
+		std::shared_ptr<const constant_region> shared = shared_slice(row, count, new_col, new_first_row);
+		if (shared) {
+			return shared;
+		}
+	}
+
+	std::shared_ptr<constant_region> ret(new constant_region(new_col, new_first_row));
+	ret->m_dictionary = m_dictionary;
+
+	unsigned int from = row - m_first_row;
+	unsigned int to = from + count;
+	for (const segment &s : m_segments) {
+		unsigned int begin = std::max(from, s.offset);
+		unsigned int end = std::min(to, s.offset + s.count);
+		if (begin >= end) {
+			continue;
+		}
+
+		segment t = s;
+		unsigned int skip = begin - s.offset;
+		t.offset = begin - from;
+		t.count = end - begin;
+		switch (s.kind) {
+		case run:
+			break;
+		case sequence:
+			t.base = s.base + skip * s.step;
+			// rebasing may round, then the values are kept raw
+			for (unsigned int k = 0; k < t.count; k++) {
+				if (bits(t.base + k * t.step) != bits(decode(s, skip + k))) {
+					t.kind = raw;
+					break;
+				}
+			}
+			if (t.kind == raw) {
+				t.data = ret->m_raw.size();
+				for (unsigned int k = 0; k < t.count; k++) {
+					ret->m_raw.push_back(decode(s, skip + k));
+				}
+			}
+			break;
+		case dictionary:
+			t.data = ret->m_codes.size();
+			ret->m_codes.insert(ret->m_codes.end(), m_codes_data + s.data + skip, m_codes_data + s.data + skip + t.count);
+			break;
+		case raw:
+			t.data = ret->m_raw.size();
+			ret->m_raw.insert(ret->m_raw.end(), m_raw_data + s.data + skip, m_raw_data + s.data + skip + t.count);
+			break;
+		}
+		ret->m_segments.push_back(t);
+		ret->m_size += t.count;
+	}
+	ret->bind();
+	return ret;
+}
+
+std::shared_ptr<const constant_region> constant_region::shared_slice(unsigned int row, unsigned int count, unsigned int new_col, unsigned int new_first_row) const {
+	std::shared_ptr<constant_region> ret(new constant_region(new_col, new_first_row));
+	ret->m_dictionary = m_dictionary;
+
+	unsigned int from = row - m_first_row;
+	unsigned int to = from + count;
+	for (const segment &s : m_segments) {
+		unsigned int begin = std::max(from, s.offset);
+		unsigned int end = std::min(to, s.offset + s.count);
+		if (begin >= end) {
+			continue;
+		}
+
+		segment t = s;
+		unsigned int skip = begin - s.offset;
+		t.offset = begin - from;
+		t.count = end - begin;
+		if (s.kind == sequence) {
+			t.base = s.base + skip * s.step;
+			for (unsigned int k = 0; k < t.count; k++) {
+				if (bits(t.base + k * t.step) != bits(decode(s, skip + k))) {
+					return nullptr;
+				}
+			}
+		} else if (s.kind != run) {
+			t.data = s.data + skip;
+		}
+		ret->m_segments.push_back(t);
+		ret->m_size += t.count;
+	}
+
+	ret->m_codes_data = m_codes_data;
+	ret->m_raw_data = m_raw_data;
+	ret->m_pages = m_pages;
+	ret->m_tile = m_tile;
+	ret->m_codes_offset = m_codes_offset;
+	return ret;
+}
+
+std::shared_ptr<const constant_region> constant_region::paged(const std::shared_ptr<page_file> &pages, std::size_t min_bytes) const {
+	std::size_t raw_bytes = m_raw.size() * sizeof(double);
+	std::size_t bytes = raw_bytes + m_codes.size();
+	if (m_tile != nullptr || bytes < min_bytes) {
+		return nullptr;
+	}
+
+	// Raw values first, they are aligned at the page boundary.
+	std::vector<char> data(bytes);
+	std::memcpy(data.data(), m_raw.data(), raw_bytes);
+	std::memcpy(data.data() + raw_bytes, m_codes.data(), m_codes.size());
+
+	std::shared_ptr<constant_region> ret(new constant_region(m_col, m_first_row));
+	ret->m_size = m_size;
+	ret->m_segments = m_segments;
+	ret->m_dictionary = m_dictionary;
+	ret->m_pages = pages;
+	ret->m_tile = pages->append(data.data(), bytes);
+	ret->m_raw_data = reinterpret_cast<const double *>(ret->m_tile->data);
+	ret->m_codes_data = reinterpret_cast<const std::uint8_t *>(ret->m_tile->data + raw_bytes);
+	ret->m_codes_offset = raw_bytes;
+	return ret;
+}
+
+std::size_t constant_region::memory_usage() const {
+	return sizeof(*this)
+		+ m_segments.capacity() * sizeof(segment)
+		+ m_dictionary.capacity() * sizeof(double)
+		+ m_codes.capacity() * sizeof(std::uint8_t)
+		+ m_raw.capacity() * sizeof(double);
+}
@@ -0,0 +1,151 @@
+/** \file Compressed regions of constant numbers. */
+
+#ifndef REGION_HH
+#define REGION_HH
+
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+#include "paging.hh"
+
+/** Compressed block of numbers in consecutive rows of one column, eg. imported data.
+ * Rows are split into segments, each encoded as run of one value, arithmetic sequence,
+ * codes into small dictionary or raw values, whichever fits. Encoding is lossless.
+ *
+ * Reading one value is O(log segments), visiting all of them is sequential decoding.
+ * Region is immutable, shared between versions of the contents.
+ *
+ * Codes and raw values of paged region are in tile of page file, paged in when the region is read.
+ */
+class constant_region {
+public:
+	/** Encode values of rows [first_row, first_row + values.size()). */
+	constant_region(unsigned int col, unsigned int first_row, const std::vector<double> &values);
+
+	unsigned int col() const { return m_col; }
+	unsigned int first_row() const { return m_first_row; }
+
+	/** Number of rows. */
+	unsigned int size() const { return m_size; }
+
+	/** One past the last row. */
+	unsigned int end_row() const { return m_first_row + m_size; }
+
+	bool contains(unsigned int row) const {
+		return row >= m_first_row && row - m_first_row < m_size;
+	}
+
+	/** Value of the row, which must be in the region. */
+	double at(unsigned int row) const;
+
+	/** Visit values of the rows in order, calling `f(row, value)`. */
+	template <typename F>
+	void for_each(F f) const {
+		for (const segment &s : m_segments) {
+			for (unsigned int k = 0; k < s.count; k++) {
+				f(m_first_row + s.offset + k, decode(s, k));
+			}
+		}
+	}
+
+	/** Decode `count` values from the row into `out`, the rows must be in the region. */
+	void copy(unsigned int row, unsigned int count, double *out) const;
+
+	/** Sum of the values, without decoding runs and sequences. */
+	double sum() const;
+
+	/** Decoded values. */
+	std::vector<double> values() const;
+
+	/** Region of `count` rows starting from `row`, moved to `new_col` and `new_first_row`.
+	 * Segments are sliced, not decoded. Slice of paged region shares its tile.
+	 */
+	std::shared_ptr<const constant_region> slice(unsigned int row, unsigned int count, unsigned int new_col, unsigned int new_first_row) const;
+
+	/** Copy of the region with the codes and raw values written to the page file.
+	 * Returns nullptr if they are smaller than `min_bytes`, or the region is paged already.
+	 */
+	std::shared_ptr<const constant_region> paged(const std::shared_ptr<page_file> &pages, std::size_t min_bytes) const;
+
+	bool is_paged() const { return m_tile != nullptr; }
+
+	/** Memory used by the region, in bytes. Tile of paged region is not included. */
+	std::size_t memory_usage() const;
+
+private:
+	constant_region(unsigned int col, unsigned int first_row)
+		: m_col(col), m_first_row(first_row), m_size(0), m_codes_data(nullptr), m_raw_data(nullptr), m_tile(nullptr), m_codes_offset(0) {}
+
+	/** Slice sharing the codes and raw values, nullptr if some sequence has to be decoded. */
+	std::shared_ptr<const constant_region> shared_slice(unsigned int row, unsigned int count, unsigned int new_col, unsigned int new_first_row) const;
+
+	/** Point the data to the codes and raw vectors. */
+	void bind() {
+		m_codes_data = m_codes.data();
+		m_raw_data = m_raw.data();
+	}
+
+	/** Page in the byte of the tile, no-op if the region is not paged. */
+	void page_in(std::size_t offset) const {
+		if (m_tile != nullptr) {
+			m_pages->touch(*m_tile, offset);
+		}
+	}
+
+	enum encoding {
+		run,
+		sequence,
+		dictionary,
+		raw
+	};
+
+	/** Rows [offset, offset + count) of the region.
+	 * Value of k-th row is `base` for runs, `base + k * step` for sequences,
+	 * and `data + k`-th element of codes or raw values otherwise.
+	 */
+	struct segment {
+		unsigned int offset;
+		unsigned int count;
+		encoding kind;
+		double base;
+		double step;
+		std::size_t data;
+	};
+
+	double decode(const segment &s, unsigned int k) const {
+		switch (s.kind) {
+		case run: return s.base;
+		case sequence: return s.base + k * s.step;
+		case dictionary:
+			page_in(m_codes_offset + s.data + k);
+			return m_dictionary[m_codes_data[s.data + k]];
+		case raw: break;
+		}
+		page_in((s.data + k) * sizeof(double));
+		return m_raw_data[s.data + k];
+	}
+
+	/** Append segment of literal values, as dictionary codes if they fit in the dictionary. */
+	void append_literals(const double *values, unsigned int count);
+
+	unsigned int m_col;
+	unsigned int m_first_row;
+	unsigned int m_size;
+
+	std::vector<segment> m_segments;
+	std::vector<double> m_dictionary;
+	std::vector<std::uint8_t> m_codes;
+	std::vector<double> m_raw;
+
+	/** Codes and raw values, in the vectors or in the tile. */
+	const std::uint8_t *m_codes_data;
+	const double *m_raw_data;
+
+	/** Tile of paged region, the codes follow the raw values in it. */
+	std::shared_ptr<page_file> m_pages;
+	page_file::tile *m_tile;
+	std::size_t m_codes_offset;
+};
+
+#endif
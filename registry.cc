@@ -0,0 +1,43 @@
+#include "registry.hh"
+
+#include <cctype>
+#include <stdexcept>
+
+static std::string upper(const std::string &s) {
+	std::string ret(s);
+	for (char &c : ret) {
+		c = std::toupper(static_cast<unsigned char>(c));
+	}
+	return ret;
+}
+
+function_registry::function_registry(const functionmap &fm) {
+	for (auto &p : fm) {
+		unsigned int id = m_functions.size();
+		if (!m_ids.insert(std::make_pair(upper(p.first), id)).second) {
+			throw std::runtime_error("duplicate function name -- " + p.first);
+		}
+		m_functions.push_back(p.second);
+		m_names.push_back(p.first);
+	}
+
+	m_plus = find("+");
+	m_minus = find("-");
+	m_mul = find("*");
+	m_div = find("/");
+}
+
+unsigned int function_registry::id(const std::string &name) const {
+	auto iter = m_ids.find(upper(name));
+	return iter == m_ids.end() ? npos : iter->second;
+}
+
+function *function_registry::binary_operator(char op) const {
+	switch (op) {
+	case '+': return m_plus;
+	case '-': return m_minus;
+	case '*': return m_mul;
+	case '/': return m_div;
+	default: return nullptr;
+	}
+}
@@ -0,0 +1,66 @@
+/** \file Compiled function registry. */
+
+#ifndef REGISTRY_HH
+#define REGISTRY_HH
+
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "definitions.hh"
+
+/** Compiled `functionmap`.
+ * Every function gets dense id in the order of the map, names are resolved
+ * case insensitively in O(1). Operators are resolved once, when registry is built.
+ *
+ * \sa function
+ */
+class function_registry {
+public:
+	/** Not found id. */
+	static const unsigned int npos = ~0u;
+
+	/** @throw std::runtime_error if two names differ only in case */
+	explicit function_registry(const functionmap &fm);
+
+	/** Id of the function, or npos if there is no such function. */
+	unsigned int id(const std::string &name) const;
+
+	/** Function by name, nullptr if not found. */
+	function *find(const std::string &name) const {
+		unsigned int i = id(name);
+		return i == npos ? nullptr : m_functions[i];
+	}
+
+	/** Function by id. */
+	function *operator[](unsigned int id) const {
+		return m_functions[id];
+	}
+
+	/** Name of the function as it is in the functionmap. */
+	const std::string &name(unsigned int id) const {
+		return m_names[id];
+	}
+
+	/** Function of binary operator `+`, `-`, `*` or `/`, nullptr if not registered. */
+	function *binary_operator(char op) const;
+
+	/** Number of functions. */
+	std::size_t size() const {
+		return m_functions.size();
+	}
+
+private:
+	std::vector<function *> m_functions;
+	std::vector<std::string> m_names;
+
+	/** Upper case name to id. */
+	std::unordered_map<std::string, unsigned int> m_ids;
+
+	function *m_plus;
+	function *m_minus;
+	function *m_mul;
+	function *m_div;
+};
+
+#endif
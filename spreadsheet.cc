@@ -2,77 +2,1141 @@
 
 #include "parser.hh"
 #include "exceptions.hh"
+#include "cancellation.hh"
+#include "workbook.hh"
+#include "journal.hh"
 
-void spreadsheet::set(const cellindex &i, const std::string &s) {
-	erase(i);
+#include <algorithm>
 
-	// Insert into inputs
-	inputs.set(i, s);
+std::size_t evaluation_state::tick() {
+	trace_scope ts(trace, "tick");
+	std::vector<cellindex> stale = dependencies.take_volatile();
+	for (const cellindex &i : stale) {
+		values.erase(i);
+	}
+	if (!stale.empty()) {
+		// indexes don't know which cells they contain
+		lookups.clear();
+		aggregates.clear();
+	}
 
-	// Insert parsed astnode into asts
-	try {
-		asts.set(i, parse(s, m_function_map));
-	} catch (const not_formula_error &e) {
-		// if not formula, then it's not.
-	} catch (const syntax_error &e) {
-		syntax_errors.insert(std::make_pair(i, e.what()));
+	// Volatile asynchronous functions are impure, so they are called again.
+	calls.forget_completed(false);
+	return stale.size();
+}
+
+void evaluation_state::forget(const std::vector<cellindex> &cells) {
+	for (const cellindex &i : dependencies.take_dependents(cells)) {
+		values.erase(i);
 	}
+	lookups.clear();
+	aggregates.clear();
 }
 
-std::string spreadsheet::get(const cellindex &i) const {
-	auto inputs_iter = inputs.find(i);
-	if (inputs_iter == inputs.end()) {
+void evaluation_state::forget_external() {
+	std::vector<cellindex> stale = dependencies.take_external();
+	for (const cellindex &i : stale) {
+		values.erase(i);
+	}
+	if (!stale.empty()) {
+		lookups.clear();
+		aggregates.clear();
+	}
+}
+
+std::string sheet_contents::get(const cellindex &i) const {
+	auto cells_iter = cells.find(i);
+	if (cells_iter == cells.end()) {
+		const constant_region *r = region(i);
+		if (r != nullptr) {
+			std::ostringstream oss;
+			astnode_number(r->at(i.row)).write_formula(oss, *functions);
+			return oss.str();
+		}
+
 		// no input, return empty
 		return "";
 	}
-	return inputs_iter->second;
+
+	const cell &c = cells_iter->second;
+	if (c.input.empty() && c.ast) {
+		// moved formula, regenerate the text
+		std::ostringstream oss;
+		oss << '=';
+		c.ast->write_formula(oss, *functions);
+		return oss.str();
+	}
+	return c.input;
 }
 
-std::string spreadsheet::evaluate(const cellindex &i) const {
-	auto inputs_iter = inputs.find(i);
-	if (inputs_iter == inputs.end()) {
+std::string sheet_contents::evaluate(const cellindex &i, evaluation_state &state) const {
+	auto cells_iter = cells.find(i);
+	if (cells_iter == cells.end()) {
+		const constant_region *r = region(i);
+		if (r != nullptr) {
+			return to_string(r->at(i.row));
+		}
+
 		// no input, return empty
 		return "";
 	}
+	return evaluate(i, cells_iter->second, state);
+}
+
+std::string sheet_contents::evaluate(const cellindex &i, const cell &c, evaluation_state &state) const {
+	environment env(*this, &state.values);
+	setup(env, state);
+	return evaluate(i, c, env);
+}
 
-	auto syntax_errors_iter = syntax_errors.find(i);
-	if (syntax_errors_iter != syntax_errors.end()) {
-		return std::string("#SYNTAX_ERROR " + syntax_errors_iter->second);
+std::string sheet_contents::evaluate(const cellindex &i, const cell &c, environment &env) const {
+	if (!syntax_errors.empty()) {
+		auto syntax_errors_iter = syntax_errors.find(i);
+		if (syntax_errors_iter != syntax_errors.end()) {
+			return std::string("#SYNTAX_ERROR " + syntax_errors_iter->second);
+		}
 	}
 
-	auto asts_iter = asts.find(i);
-	if (asts_iter == asts.end()) {
+	const astnode *ast = c.ast.get();
+	if (ast == nullptr) {
 		// no ast, string value
-		return inputs_iter->second;
+		return c.input;
+	}
+
+	auto lazy = dynamic_cast<const astnode_lazy *>(ast);
+	if (lazy != nullptr && lazy->compile() == nullptr) {
+		return std::string("#SYNTAX_ERROR " + lazy->syntax_error_message());
 	}
 
+	double value;
 	try {
-		// calling global evaluate!
-		return to_string(::evaluate(asts_iter->second, asts));
+		std::set<cellindex> evaluation_stack;
+		value = env.find(i, evaluation_stack);
 	} catch (const evaluation_error &e) {
 		return std::string("#EVAL_ERROR ") + e.what();
+	} catch (const pending_evaluation &e) {
+		return "#PENDING";
 	}
+
+	trace_scope ts(env.trace(), "format", &i);
+	return to_string(value);
 }
 
-void spreadsheet::erase(const cellindex &i) {
-	// CLearing syntax error
-	syntax_errors.erase(i);
+std::vector<std::string> sheet_contents::evaluate_range(const cellindex &first, const cellindex &last, evaluation_state &state, const reference_graph *references) const {
+	unsigned int left = std::min(first.col, last.col);
+	unsigned int right = std::max(first.col, last.col);
+	unsigned int top = std::min(first.row, last.row);
+	unsigned int bottom = std::max(first.row, last.row);
+	unsigned int width = right - left + 1;
+	std::vector<std::string> ret(static_cast<std::size_t>(width) * (bottom - top + 1));
+
+	environment env(*this, &state.values);
+	setup(env, state);
 
-	// Remove old one from asts, if exists
-	auto iter = asts.find(i);
-	if (iter != asts.end()) {
-		delete iter->second;
+	// Precedents are memoized first, so cells shared by the cones are evaluated once
+	// and evaluation doesn't recurse deep into chains of references.
+	if (references != nullptr) {
+		std::vector<cellindex> formulas;
+		for (unsigned int col = left; col <= right; col++) {
+			for (auto iter = cells.lower_bound(cellindex(col, top)); iter != cells.end() && iter->first.col == col && iter->first.row <= bottom; ++iter) {
+				if (iter->second.ast) {
+					formulas.push_back(iter->first);
+				}
+			}
+		}
+		for (const cellindex &i : references->cone(formulas)) {
+			if (formula(i) != nullptr) {
+				try {
+					std::set<cellindex> evaluation_stack;
+					env.find(i, evaluation_stack);
+				} catch (const evaluation_error &e) {
+					// error is the value
+				} catch (const pending_evaluation &e) {
+					// waits for the result
+				}
+			}
+		}
 	}
 
-	// Remove from tables
-	inputs.erase(i);
-	asts.erase(i);
+	for (unsigned int col = left; col <= right; col++) {
+		auto iter = cells.lower_bound(cellindex(col, top));
+		for (unsigned int row = top; row <= bottom; row++) {
+			std::string &value = ret[static_cast<std::size_t>(row - top) * width + (col - left)];
+			if (iter != cells.end() && iter->first.col == col && iter->first.row == row) {
+				value = evaluate(iter->first, iter->second, env);
+				++iter;
+			} else {
+				const constant_region *r = region(cellindex(col, row));
+				if (r != nullptr) {
+					value = to_string(r->at(row));
+				}
+			}
+		}
+	}
+	return ret;
 }
 
-std::set<cellindex> spreadsheet::non_empty_cells() const {
+void sheet_contents::setup(environment &env, evaluation_state &state) const {
+	env.set_profiler(state.profile);
+	env.set_dependencies(&state.dependencies);
+	env.set_async_calls(&state.calls);
+	env.set_sheet_link(state.link);
+	env.set_lookup_cache(&state.lookups);
+	env.set_aggregate_cache(&state.aggregates);
+	env.set_tracer(state.trace);
+}
+
+double sheet_contents::value(const cellindex &i, evaluation_state &state) const {
+	std::set<cellindex> evaluation_stack;
+	environment env(*this, &state.values);
+	setup(env, state);
+	return env.find(i, evaluation_stack);
+}
+
+std::size_t sheet_contents::calculate(bool wait, const cancellation *cancel, evaluation_state &state, const reference_graph *references) const {
+	environment env(*this, &state.values);
+	setup(env, state);
+	env.set_cancellation(cancel);
+	trace_scope ts(state.trace, "calculate");
+
+	// Profile is recorded per cell, so blocks are not used while profiling.
+	if (state.profile == nullptr) {
+		trace_scope blocks(state.trace, "blocks");
+		try {
+			evaluate_blocks(env, state);
+		} catch (const evaluation_cancelled &e) {
+			// the loop below stops at the first stale cell
+		}
+	}
+
+	// In topological order precedents are memoized before their dependents,
+	// so evaluation doesn't recurse deep into long chains of references.
+	std::vector<cellindex> pending;
+	if (references != nullptr) {
+		for (const cellindex &i : references->order()) {
+			if (formula(i) != nullptr) {
+				pending.push_back(i);
+			}
+		}
+	} else {
+		for (auto &p : cells) {
+			if (p.second.ast) {
+				pending.push_back(p.first);
+			}
+		}
+	}
+
+	while (true) {
+		// Evaluated cells are memoized, so next rounds evaluate only what was waiting.
+		std::vector<cellindex> waiting;
+		for (std::size_t k = 0; k < pending.size(); k++) {
+			try {
+				std::set<cellindex> evaluation_stack;
+				env.find(pending[k], evaluation_stack);
+			} catch (const evaluation_error &e) {
+				// error is the value
+			} catch (const pending_evaluation &e) {
+				waiting.push_back(pending[k]);
+			} catch (const evaluation_cancelled &e) {
+				// the rest stays stale
+				return stale_cells(state).size();
+			}
+		}
+
+		if (waiting.empty() || !wait) {
+			return stale_cells(state).size();
+		}
+
+		state.calls.wait_any(cancel);
+		if (cancel != nullptr && cancel->stopped()) {
+			return stale_cells(state).size();
+		}
+		pending.swap(waiting);
+	}
+}
+
+/** Shorter blocks are evaluated cell by cell. */
+static const unsigned int min_block_rows = 8;
+
+void sheet_contents::evaluate_blocks(environment &env, evaluation_state &state) const {
+	// Table is ordered by column and row, so rows of the block are consecutive.
+	column_kernel block;
+	unsigned int col = 0, first_row = 0, count = 0;
+	for (auto &p : cells) {
+		column_kernel kernel;
+		bool compiled = p.second.ast && p.second.ast->vectorize(p.first, kernel);
+		if (compiled && count > 0 && p.first.col == col && p.first.row == first_row + count && kernel == block) {
+			count++;
+			continue;
+		}
+
+		if (count >= min_block_rows) {
+			evaluate_block(col, first_row, count, block, env, state);
+		}
+		count = compiled ? 1 : 0;
+		col = p.first.col;
+		first_row = p.first.row;
+		std::swap(block, kernel);
+	}
+	if (count >= min_block_rows) {
+		evaluate_block(col, first_row, count, block, env, state);
+	}
+}
+
+void sheet_contents::evaluate_block(unsigned int col, unsigned int first_row, unsigned int count, const column_kernel &kernel, environment &env, evaluation_state &state) const {
+	const std::vector<column_kernel::input> &inputs = kernel.inputs();
+	for (const column_kernel::input &in : inputs) {
+		// Block reading itself depends on its own results, it is left to be evaluated cell by cell.
+		long long from = first_row + in.offset;
+		if (in.col == col && from < static_cast<long long>(first_row + count) && from + count > first_row) {
+			return;
+		}
+	}
+
+	// Inputs from constant regions are decoded at once, the others are found row by row.
+	std::vector<std::vector<double> > values(inputs.size(), std::vector<double>(count));
+	std::vector<bool> decoded(inputs.size(), false);
+	for (std::size_t k = 0; k < inputs.size(); k++) {
+		unsigned int row = first_row + inputs[k].offset;
+		const constant_region *r = region(cellindex(inputs[k].col, row));
+		if (r != nullptr && r->contains(row + count - 1)) {
+			r->copy(row, count, values[k].data());
+			decoded[k] = true;
+		}
+	}
+
+	// Rows with error or pending input, or evaluated already, are left out.
+	std::vector<bool> done(count, false);
+	cached_value cached;
+	for (unsigned int n = 0; n < count; n++) {
+		cellindex i(col, first_row + n);
+		if (state.values.find(i, cached)) {
+			done[n] = true;
+			continue;
+		}
+
+		// Inputs are found in the order the formula reads them, with the cell on the stack.
+		std::set<cellindex> evaluation_stack;
+		evaluation_stack.insert(i);
+		try {
+			for (std::size_t k = 0; k < inputs.size(); k++) {
+				if (!decoded[k]) {
+					values[k][n] = env.find(cellindex(inputs[k].col, first_row + n + inputs[k].offset), evaluation_stack);
+				}
+			}
+		} catch (const evaluation_error &e) {
+			done[n] = true;
+		} catch (const pending_evaluation &e) {
+			done[n] = true;
+		}
+	}
+
+	std::vector<double> results;
+	kernel.run(values, count, results);
+
+	for (unsigned int n = 0; n < count; n++) {
+		if (done[n]) {
+			continue;
+		}
+
+		// Decoded inputs are recorded too, editing the region cell forgets only its dependents.
+		cellindex i(col, first_row + n);
+		for (std::size_t k = 0; k < inputs.size(); k++) {
+			state.dependencies.add(i, cellindex(inputs[k].col, first_row + n + inputs[k].offset));
+		}
+		cached.error = false;
+		cached.value = results[n];
+		state.values.store(i, cached);
+	}
+}
+
+std::set<cellindex> sheet_contents::stale_cells(const evaluation_state &state) const {
+	std::set<cellindex> ret;
+	cached_value cached;
+	for (auto &p : cells) {
+		if (p.second.ast && !state.values.find(p.first, cached)) {
+			ret.insert(p.first);
+		}
+	}
+	return ret;
+}
+
+std::set<cellindex> sheet_contents::non_empty_cells() const {
 	std::set<cellindex> ret;
-	for (auto &p : inputs) {
+	for (auto &p : cells) {
 		ret.insert(p.first);
 	}
+	for (auto &p : *regions) {
+		for (unsigned int row = p.second->first_row(); row < p.second->end_row(); row++) {
+			ret.insert(cellindex(p.second->col(), row));
+		}
+	}
 	return ret;
 }
+
+/** Visits cells of the regions in row-major order, one cursor per region. */
+class region_cursors {
+public:
+	region_cursors(const region_map &regions) {
+		for (auto &p : regions) {
+			cursors.push_back(cursor(p.second.get(), p.second->first_row()));
+		}
+		std::make_heap(cursors.begin(), cursors.end(), later);
+	}
+
+	/** Visit cells before the index, or all if index is nullptr. */
+	void visit_before(const cellindex *index, const value_callback &f) {
+		while (!cursors.empty() && (index == nullptr || before(cursors.front(), *index))) {
+			std::pop_heap(cursors.begin(), cursors.end(), later);
+			cursor &c = cursors.back();
+			f(cellindex(c.first->col(), c.second), to_string(c.first->at(c.second)));
+			if (++c.second < c.first->end_row()) {
+				std::push_heap(cursors.begin(), cursors.end(), later);
+			} else {
+				cursors.pop_back();
+			}
+		}
+	}
+
+private:
+	/** Region and its next row. */
+	typedef std::pair<const constant_region *, unsigned int> cursor;
+
+	static bool before(const cursor &c, const cellindex &i) {
+		return c.second < i.row || (c.second == i.row && c.first->col() < i.col);
+	}
+
+	static bool later(const cursor &a, const cursor &b) {
+		return a.second > b.second || (a.second == b.second && a.first->col() > b.first->col());
+	}
+
+	std::vector<cursor> cursors;
+};
+
+void sheet_contents::for_each_value(const value_callback &f, evaluation_state &state) const {
+	region_cursors rc(*regions);
+	cells.for_each_row_major([&](const table<cell>::value_type &p) {
+		rc.visit_before(&p.first, f);
+		f(p.first, evaluate(p.first, p.second, state));
+	});
+	rc.visit_before(nullptr, f);
+}
+
+/** Writes fields of the table, padding rows to the same width. */
+class field_writer {
+public:
+	field_writer(std::ostream &os, export_format format, unsigned int width)
+		: os(os), format(format), separator(format == export_csv ? ',' : '\t'), width(width), row(0), col(0) {}
+
+	void write(const cellindex &i, const std::string &value) {
+		while (row < i.row) {
+			end_row();
+		}
+		for (; col < i.col; col++) {
+			separate();
+		}
+		separate();
+		escape(value);
+		col++;
+	}
+
+	/** Pad and end the current row. */
+	void end_row() {
+		for (; col < width; col++) {
+			separate();
+		}
+		os << '\n';
+		row++;
+		col = 0;
+	}
+
+private:
+	void separate() {
+		if (col != 0) {
+			os << separator;
+		}
+	}
+
+	void escape(const std::string &value) {
+		if (format == export_tsv) {
+			for (char c : value) {
+				switch (c) {
+				case '\t': os << "\\t"; break;
+				case '\n': os << "\\n"; break;
+				case '\r': os << "\\r"; break;
+				case '\\': os << "\\\\"; break;
+				default: os << c;
+				}
+			}
+		} else if (value.find_first_of(",\"\r\n") == std::string::npos) {
+			os << value;
+		} else {
+			os << '"';
+			for (char c : value) {
+				if (c == '"') {
+					os << '"';
+				}
+				os << c;
+			}
+			os << '"';
+		}
+	}
+
+	std::ostream &os;
+	export_format format;
+	char separator;
+	unsigned int width;
+
+	/** Position of the next field. */
+	unsigned int row;
+	unsigned int col;
+};
+
+void sheet_contents::export_values(std::ostream &os, export_format format, evaluation_state &state) const {
+	if (cells.empty() && regions->empty()) {
+		return;
+	}
+
+	// last cell (and last region) is in the last column
+	unsigned int width = 0;
+	if (!cells.empty()) {
+		width = cells.last()->first.col + 1;
+	}
+	if (!regions->empty()) {
+		width = std::max(width, regions->rbegin()->first.col + 1);
+	}
+	field_writer writer(os, format, width);
+	for_each_value([&](const cellindex &i, const std::string &value) {
+		writer.write(i, value);
+	}, state);
+	writer.end_row();
+}
+
+const astnode *sheet_contents::formula(const cellindex &index) const {
+	auto iter = cells.find(index);
+	return iter == cells.end() ? nullptr : iter->second.ast.get();
+}
+
+const astnode *sheet_contents::checked_formula(const cellindex &index, bool &check_cycles) const {
+	auto iter = cells.find(index);
+	if (iter == cells.end()) {
+		check_cycles = true;
+		return nullptr;
+	}
+	check_cycles = iter->second.check_cycles;
+	return iter->second.ast.get();
+}
+
+bool sheet_contents::constant(const cellindex &index, double &value) const {
+	const constant_region *r = region(index);
+	if (r == nullptr) {
+		return false;
+	}
+	value = r->at(index.row);
+	return true;
+}
+
+const constant_region *sheet_contents::region(const cellindex &i) const {
+	// last region starting before or at the cell
+	auto iter = regions->upper_bound(i);
+	if (iter == regions->begin()) {
+		return nullptr;
+	}
+	--iter;
+	const constant_region *r = iter->second.get();
+	return r->col() == i.col && r->contains(i.row) ? r : nullptr;
+}
+
+void sheet_contents::cut_regions(unsigned int col, unsigned int from, unsigned int to) {
+	std::shared_ptr<region_map> copy;
+	for (auto iter = regions->lower_bound(cellindex(col, 0)); iter != regions->end() && iter->first.col == col; ++iter) {
+		const constant_region &r = *iter->second;
+		if (r.end_row() <= from || r.first_row() >= to) {
+			continue;
+		}
+
+		if (!copy) {
+			copy = std::make_shared<region_map>(*regions);
+		}
+		copy->erase(iter->first);
+		if (r.first_row() < from) {
+			copy->insert(std::make_pair(iter->first, r.slice(r.first_row(), from - r.first_row(), col, r.first_row())));
+		}
+		if (r.end_row() > to) {
+			copy->insert(std::make_pair(cellindex(col, to), r.slice(to, r.end_row() - to, col, to)));
+		}
+	}
+	if (copy) {
+		regions = copy;
+	}
+}
+
+/** Smaller regions stay in memory, tiles are whole pages. */
+static const std::size_t min_paged_bytes = 4096;
+
+void sheet_contents::put(const cellindex &i, const cell &c) {
+	cut_regions(i.col, i.row, i.row + 1);
+	cells.set(i, c);
+}
+
+void sheet_contents::remove(const cellindex &i) {
+	cut_regions(i.col, i.row, i.row + 1);
+	cells.erase(i);
+}
+
+void sheet_contents::load(unsigned int col, unsigned int first_row, const std::vector<double> &values) {
+	if (values.empty()) {
+		return;
+	}
+
+	unsigned int end_row = first_row + values.size();
+	cut_regions(col, first_row, end_row);
+
+	std::vector<cellindex> replaced;
+	for (auto iter = cells.lower_bound(cellindex(col, first_row)); iter != cells.end() && iter->first.col == col && iter->first.row < end_row; ++iter) {
+		replaced.push_back(iter->first);
+	}
+	for (const cellindex &i : replaced) {
+		cells.erase(i);
+		syntax_errors.erase(i);
+	}
+
+	std::shared_ptr<const constant_region> r = std::make_shared<constant_region>(col, first_row, values);
+	if (pages) {
+		std::shared_ptr<const constant_region> paged = r->paged(pages, min_paged_bytes);
+		if (paged) {
+			r = paged;
+		}
+	}
+
+	std::shared_ptr<region_map> copy = std::make_shared<region_map>(*regions);
+	copy->insert(std::make_pair(cellindex(col, first_row), r));
+	regions = copy;
+}
+
+void sheet_contents::page_regions() {
+	std::shared_ptr<region_map> copy = std::make_shared<region_map>(*regions);
+	for (auto &p : *copy) {
+		std::shared_ptr<const constant_region> paged = p.second->paged(pages, min_paged_bytes);
+		if (paged) {
+			p.second = paged;
+		}
+	}
+	regions = copy;
+}
+
+void sheet_contents::unload(const cellindex &first) {
+	if (regions->find(first) == regions->end()) {
+		return;
+	}
+	std::shared_ptr<region_map> copy = std::make_shared<region_map>(*regions);
+	copy->erase(first);
+	regions = copy;
+}
+
+void sheet_contents::shift_regions(const reference_shift &shift) {
+	if (regions->empty()) {
+		return;
+	}
+
+	std::shared_ptr<region_map> copy = std::make_shared<region_map>();
+	for (auto &p : *regions) {
+		const constant_region &r = *p.second;
+		if (shift.axis == reference_shift::columns) {
+			cellindex first(r.col(), r.first_row());
+			if (!shift.deletes(first)) {
+				cellindex moved = shift.apply(first);
+				copy->insert(std::make_pair(moved, shift.moves(first) ? r.slice(r.first_row(), r.size(), moved.col, moved.row) : p.second));
+			}
+			continue;
+		}
+
+		// Rows before the shift stay, the rest (except deleted) move together.
+		unsigned int before_end = std::min(r.end_row(), std::max(r.first_row(), shift.at));
+		if (before_end > r.first_row()) {
+			copy->insert(std::make_pair(p.first, before_end == r.end_row() ? p.second : r.slice(r.first_row(), before_end - r.first_row(), r.col(), r.first_row())));
+		}
+
+		unsigned int after_begin = std::max(before_end, shift.insert ? shift.at : shift.at + shift.count);
+		if (after_begin < r.end_row()) {
+			cellindex moved = shift.apply(cellindex(r.col(), after_begin));
+			copy->insert(std::make_pair(moved, r.slice(after_begin, r.end_row() - after_begin, moved.col, moved.row)));
+		}
+	}
+	regions = copy;
+}
+
+void sheet_contents::memory_usage(memory_report &report, std::unordered_set<const void *> *seen) const {
+	report.tables += cells.memory_usage(seen, [&](const table<cell>::value_type &v) {
+		report.inputs += string_usage(v.second.input);
+		const astnode *ast = v.second.ast.get();
+		if (ast != nullptr && (seen == nullptr || seen->insert(ast).second)) {
+			// with the shared_ptr control block
+			report.formulas += ast->memory_usage() + 2 * sizeof(void *);
+		}
+	});
+	report.tables += syntax_errors.memory_usage(seen, [&](const table<std::string>::value_type &v) {
+		report.syntax_errors += string_usage(v.second);
+	});
+
+	if (seen != nullptr && !seen->insert(regions.get()).second) {
+		return;
+	}
+	report.tables += sizeof(region_map) + tree_usage(*regions);
+	for (auto &p : *regions) {
+		if (seen == nullptr || seen->insert(p.second.get()).second) {
+			std::size_t bytes = p.second->memory_usage() + 2 * sizeof(void *);
+			report.regions += bytes;
+			report.region_details.push_back(region_memory(p.first, p.second->size(), bytes));
+		}
+	}
+}
+
+void memory_report::write_json(std::ostream &os) const {
+	os << "{\"total\":" << total()
+		<< ",\"inputs\":" << inputs
+		<< ",\"formulas\":" << formulas
+		<< ",\"tables\":" << tables
+		<< ",\"syntax_errors\":" << syntax_errors
+		<< ",\"regions\":" << regions
+		<< ",\"pages\":" << pages
+		<< ",\"references\":" << references
+		<< ",\"values\":" << values
+		<< ",\"dependencies\":" << dependencies
+		<< ",\"lookups\":" << lookups
+		<< ",\"async_results\":" << async_results
+		<< ",\"history\":" << history
+		<< ",\"region_details\":[";
+	for (std::size_t k = 0; k < region_details.size(); k++) {
+		const region_memory &r = region_details[k];
+		os << (k == 0 ? "" : ",")
+			<< "{\"first\":\"" << r.first << "\""
+			<< ",\"rows\":" << r.rows
+			<< ",\"bytes\":" << r.bytes << "}";
+	}
+	os << "]}";
+}
+
+std::shared_ptr<const astnode> spreadsheet::compile(const cellindex &i, const std::string &s) {
+	if (m_lazy) {
+		double number;
+		switch (classify(s, number)) {
+		case input_number:
+			return std::make_shared<astnode_number>(number);
+		case input_formula:
+			return std::make_shared<astnode_lazy>(s, m_contents.functions, i);
+		case input_string:
+			break;
+		}
+		return nullptr;
+	}
+
+	try {
+		return std::shared_ptr<const astnode>(parse(s, *m_contents.functions));
+	} catch (const not_formula_error &e) {
+		// if not formula, then it's not.
+	} catch (const syntax_error &e) {
+		m_contents.syntax_errors.set(i, e.what());
+	}
+	return nullptr;
+}
+
+void spreadsheet::set(const cellindex &i, const std::string &s) {
+	trace_scope ts(m_state.trace, "set", &i);
+	record_undo();
+
+	// Values depending on this cell
+	invalidate(i);
+
+	// CLearing syntax error
+	m_contents.syntax_errors.erase(i);
+
+	std::shared_ptr<const astnode> ast;
+	{
+		trace_scope parse(m_state.trace, "parse", &i);
+		ast = compile(i, s);
+	}
+	m_contents.put(i, cell(s, ast));
+	update_references(i);
+
+	if (m_journal != nullptr) {
+		m_journal->record_set(i, s);
+	}
+}
+
+std::string spreadsheet::get(const cellindex &i) const {
+	return m_contents.get(i);
+}
+
+std::string spreadsheet::evaluate(const cellindex &i) const {
+	trace_scope ts(m_state.trace, "evaluate", &i);
+	return m_contents.evaluate(i, m_state);
+}
+
+void spreadsheet::erase(const cellindex &i) {
+	if (m_contents.cells.find(i) == m_contents.cells.end() && m_contents.region(i) == nullptr) {
+		// nothing to erase
+		return;
+	}
+
+	record_undo();
+
+	// Values depending on this cell
+	invalidate(i);
+
+	m_contents.syntax_errors.erase(i);
+	m_contents.remove(i);
+	update_references(i);
+
+	if (m_journal != nullptr) {
+		m_journal->record_erase(i);
+	}
+}
+
+void spreadsheet::load_column(unsigned int col, unsigned int first_row, const std::vector<double> &values) {
+	if (values.empty()) {
+		return;
+	}
+
+	record_undo();
+	invalidate();
+
+	std::vector<cellindex> replaced;
+	unsigned int end_row = first_row + values.size();
+	for (auto iter = m_contents.cells.lower_bound(cellindex(col, first_row)); iter != m_contents.cells.end() && iter->first.col == col && iter->first.row < end_row; ++iter) {
+		replaced.push_back(iter->first);
+	}
+	m_contents.load(col, first_row, values);
+	for (const cellindex &i : replaced) {
+		update_references(i);
+	}
+
+	if (m_journal != nullptr) {
+		m_journal->record_load(cellindex(col, first_row), values);
+	}
+}
+
+void spreadsheet::enable_paging(const std::string &path, std::size_t budget) {
+	m_pages = std::make_shared<page_file>(path, budget);
+	m_contents.pages = m_pages;
+	m_contents.page_regions();
+}
+
+std::set<cellindex> spreadsheet::non_empty_cells() const {
+	return m_contents.non_empty_cells();
+}
+
+memory_report spreadsheet::memory_usage(bool history) const {
+	memory_report report;
+	std::unordered_set<const void *> seen;
+	bool versions = history && (!m_undo.empty() || !m_redo.empty());
+	m_contents.memory_usage(report, versions ? &seen : nullptr);
+
+	if (versions) {
+		memory_report previous;
+		for (const sheet_contents &contents : m_undo) {
+			contents.memory_usage(previous, &seen);
+		}
+		for (const sheet_contents &contents : m_redo) {
+			contents.memory_usage(previous, &seen);
+		}
+		report.history = previous.total();
+	}
+
+	report.references = m_references.memory_usage();
+	report.pages = m_contents.pages ? m_contents.pages->resident() : 0;
+	report.values = m_state.values.memory_usage();
+	report.dependencies = m_state.dependencies.memory_usage();
+	report.lookups = m_state.lookups.memory_usage() + m_state.aggregates.memory_usage();
+	report.async_results = m_state.calls.memory_usage();
+	return report;
+}
+
+void spreadsheet::invalidate() {
+	trace_scope ts(m_state.trace, "invalidate");
+	forget_values();
+	m_state.calls.forget_completed(false);
+
+	if (m_workbook != nullptr) {
+		m_workbook->invalidate_except(this);
+	}
+}
+
+void spreadsheet::invalidate(const cellindex &i) {
+	trace_scope ts(m_state.trace, "invalidate", &i);
+	m_state.forget(std::vector<cellindex>(1, i));
+	m_state.calls.forget_completed(false);
+
+	if (m_workbook != nullptr) {
+		m_state.forget_external();
+		m_workbook->invalidate_except(this);
+	}
+}
+
+void spreadsheet::forget_external() {
+	m_state.forget_external();
+}
+
+void spreadsheet::forget_values() {
+	m_state.values.clear();
+	m_state.dependencies.clear();
+	m_state.lookups.clear();
+	m_state.aggregates.clear();
+}
+
+void spreadsheet::record_undo() {
+	m_redo.clear();
+	if (m_undo_limit == 0) {
+		return;
+	}
+
+	if (m_undo.size() >= m_undo_limit) {
+		m_undo.pop_front();
+	}
+	m_undo.push_back(m_contents);
+}
+
+void spreadsheet::update_references(const cellindex &i) {
+	trace_scope ts(m_state.trace, "references", &i);
+	std::vector<cellindex> changed;
+	const astnode *node = m_contents.formula(i);
+	if (node != nullptr) {
+		std::vector<cellindex> precedents;
+		node->references(precedents);
+		m_references.set(i, precedents, changed);
+		changed.push_back(i);
+	} else {
+		m_references.remove(i, changed);
+	}
+	update_checks(changed);
+}
+
+void spreadsheet::rebuild_references() {
+	trace_scope ts(m_state.trace, "references");
+	m_references.clear();
+
+	std::vector<cellindex> changed;
+	std::vector<cellindex> precedents;
+	for (auto &p : m_contents.cells) {
+		if (p.second.ast) {
+			precedents.clear();
+			p.second.ast->references(precedents);
+			m_references.set(p.first, precedents, changed);
+			changed.push_back(p.first);
+		}
+	}
+	update_checks(changed);
+}
+
+void spreadsheet::update_checks(const std::vector<cellindex> &changed) {
+	std::vector<cellindex> precedents;
+	for (const cellindex &i : changed) {
+		auto iter = m_contents.cells.find(i);
+		if (iter == m_contents.cells.end() || !iter->second.ast) {
+			continue;
+		}
+
+		// Cells with references known only during evaluation are always checked.
+		const cell &c = iter->second;
+		precedents.clear();
+		bool check = !c.ast->references(precedents) || m_references.cyclic(i);
+		if (check != c.check_cycles) {
+			m_contents.cells.set(i, cell(c.input, c.ast, check));
+		}
+	}
+}
+
+bool spreadsheet::undo() {
+	if (m_undo.empty()) {
+		return false;
+	}
+
+	m_redo.push_back(m_contents);
+	m_contents = m_undo.back();
+	m_contents.pages = m_pages;
+	m_undo.pop_back();
+	rebuild_references();
+	invalidate();
+	journal_changes(m_redo.back());
+	return true;
+}
+
+bool spreadsheet::redo() {
+	if (m_redo.empty()) {
+		return false;
+	}
+
+	m_undo.push_back(m_contents);
+	m_contents = m_redo.back();
+	m_contents.pages = m_pages;
+	m_redo.pop_back();
+	rebuild_references();
+	invalidate();
+	journal_changes(m_undo.back());
+	return true;
+}
+
+void spreadsheet::journal_changes(const sheet_contents &previous) {
+	if (m_journal == nullptr) {
+		return;
+	}
+
+	// Regions are unloaded before the cells and loaded after them, as setting cells splits regions.
+	bool regions_changed = previous.regions != m_contents.regions;
+	if (regions_changed) {
+		for (auto &p : *previous.regions) {
+			auto iter = m_contents.regions->find(p.first);
+			if (iter == m_contents.regions->end() || iter->second != p.second) {
+				m_journal->record_unload(p.first);
+			}
+		}
+	}
+
+	// Both tables are ordered, so they are merged in one pass.
+	auto a = previous.cells.begin();
+	auto b = m_contents.cells.begin();
+	while (a != previous.cells.end() || b != m_contents.cells.end()) {
+		if (b == m_contents.cells.end() || (a != previous.cells.end() && a->first < b->first)) {
+			m_journal->record_erase(a->first);
+			++a;
+		} else if (a == previous.cells.end() || b->first < a->first) {
+			m_journal->record_set(b->first, m_contents.get(b->first));
+			++b;
+		} else {
+			if (a->second.input != b->second.input || a->second.ast != b->second.ast) {
+				m_journal->record_set(b->first, m_contents.get(b->first));
+			}
+			++a;
+			++b;
+		}
+	}
+
+	if (!regions_changed) {
+		return;
+	}
+	for (auto &p : *m_contents.regions) {
+		auto iter = previous.regions->find(p.first);
+		if (iter == previous.regions->end() || iter->second != p.second) {
+			m_journal->record_load(p.first, p.second->values());
+		}
+	}
+}
+
+void spreadsheet::set_undo_limit(std::size_t limit) {
+	m_undo_limit = limit;
+	while (m_undo.size() > m_undo_limit) {
+		m_undo.pop_front();
+	}
+}
+
+void spreadsheet::enable_profiling() {
+	if (!m_profiler) {
+		m_profiler.reset(new profiler());
+		m_state.profile = m_profiler.get();
+	}
+	forget_values();
+}
+
+void spreadsheet::disable_profiling() {
+	m_state.profile = nullptr;
+	m_profiler.reset();
+}
+
+void spreadsheet::insert_rows(unsigned int row, unsigned int count) {
+	shift(reference_shift(reference_shift::rows, row, count, true));
+}
+
+void spreadsheet::delete_rows(unsigned int row, unsigned int count) {
+	shift(reference_shift(reference_shift::rows, row, count, false));
+}
+
+void spreadsheet::insert_cols(unsigned int col, unsigned int count) {
+	shift(reference_shift(reference_shift::columns, col, count, true));
+}
+
+void spreadsheet::delete_cols(unsigned int col, unsigned int count) {
+	shift(reference_shift(reference_shift::columns, col, count, false));
+}
+
+void spreadsheet::shift(const reference_shift &shift) {
+	if (shift.count == 0) {
+		return;
+	}
+
+	if (m_workbook == nullptr) {
+		shift_cells(shift);
+		return;
+	}
+
+	reference_shift named = shift;
+	named.sheet = m_workbook->name(this);
+	shift_cells(named);
+	m_workbook->shift_references(this, named);
+}
+
+void spreadsheet::shift_cells(const reference_shift &shift) {
+	if (shift.count == 0) {
+		return;
+	}
+
+	record_undo();
+	invalidate();
+
+	if (m_journal != nullptr) {
+		m_journal->record_shift(shift);
+	}
+
+	// Shifting rows or columns keeps the order of the remaining cells.
+	std::vector<table<cell>::value_type> cells;
+	cells.reserve(m_contents.cells.size());
+	for (auto &p : m_contents.cells) {
+		if (shift.deletes(p.first)) {
+			continue;
+		}
+
+		const cell &c = p.second;
+		astnode *rewritten = c.ast ? c.ast->rewrite(shift) : nullptr;
+		if (rewritten == nullptr) {
+			cells.push_back(table<cell>::value_type(shift.apply(p.first), c));
+		} else if (dynamic_cast<astnode_lazy *>(rewritten) != nullptr) {
+			// formula with syntax error, the text stays
+			cells.push_back(table<cell>::value_type(shift.apply(p.first), cell(c.input, std::shared_ptr<const astnode>(rewritten))));
+		} else {
+			cells.push_back(table<cell>::value_type(shift.apply(p.first), cell("", std::shared_ptr<const astnode>(rewritten))));
+		}
+	}
+	m_contents.cells.assign_sorted(cells);
+
+	std::vector<table<std::string>::value_type> syntax_errors;
+	for (auto &p : m_contents.syntax_errors) {
+		if (!shift.deletes(p.first)) {
+			syntax_errors.push_back(table<std::string>::value_type(shift.apply(p.first), p.second));
+		}
+	}
+	m_contents.syntax_errors.assign_sorted(syntax_errors);
+
+	m_contents.shift_regions(shift);
+	rebuild_references();
+}
+
+void spreadsheet::rewrite_references(const reference_shift &shift) {
+	std::vector<std::pair<cellindex, std::shared_ptr<const astnode> > > rewritten;
+	for (auto &p : m_contents.cells) {
+		astnode *node = p.second.ast ? p.second.ast->rewrite(shift) : nullptr;
+		if (node != nullptr) {
+			rewritten.push_back(std::make_pair(p.first, std::shared_ptr<const astnode>(node)));
+		}
+	}
+	if (rewritten.empty()) {
+		return;
+	}
+
+	record_undo();
+	forget_values();
+	sheet_contents previous = m_contents;
+	for (auto &p : rewritten) {
+		m_contents.put(p.first, cell("", p.second));
+		update_references(p.first);
+	}
+	journal_changes(previous);
+}
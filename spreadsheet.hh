@@ -3,25 +3,388 @@
 #ifndef SPREADSHEET_HH
 #define SPREADSHEET_HH
 
+#include <deque>
+#include <functional>
+#include <map>
+#include <memory>
+#include <ostream>
 #include <set>
+#include <unordered_set>
+#include <vector>
 
 #include "table.hh"
 #include "ast.hh"
+#include "registry.hh"
+#include "profiler.hh"
+#include "async.hh"
+#include "cancellation.hh"
+#include "region.hh"
+#include "lookup.hh"
+#include "aggregate.hh"
+#include "topology.hh"
+#include "trace.hh"
+
+/** Contents of non empty cell. */
+struct cell {
+	cell(const std::string &input, const std::shared_ptr<const astnode> &ast, bool check_cycles = true)
+		: input(input), ast(ast), check_cycles(check_cycles) {}
+
+	/** Input as it was set.
+	 * Empty for formulas moved by row or column insertion or deletion,
+	 * their text is regenerated from the ast when needed.
+	 */
+	std::string input;
+
+	/** Compiled formula or number, nullptr for strings and formulas with syntax error.
+	 * Shared between versions of the contents.
+	 */
+	std::shared_ptr<const astnode> ast;
+
+	/** Evaluation checks the cell for circular references.
+	 * False only for formulas known not to be on a cycle of references.
+	 */
+	bool check_cycles;
+};
+
+/** Format of exported values. */
+enum export_format {
+	/** Comma separated, fields with separators, quotes or newlines are quoted. */
+	export_csv,
+	/** Tab separated, tabs, newlines and backslashes are escaped with backslash. */
+	export_tsv
+};
+
+/** Callback receiving index and evaluated value of the cell. */
+typedef std::function<void(const cellindex &, const std::string &)> value_callback;
+
+/** State of one reader of the contents: memoized values with their dependencies,
+ * asynchronous calls and optional profiler.
+ */
+struct evaluation_state {
+	evaluation_state() : profile(nullptr), trace(nullptr), link(nullptr) {}
+
+	/** Forget values of volatile cells and their transitive dependents.
+	 * Returns number of forgotten values.
+	 */
+	std::size_t tick();
+
+	/** Forget values of the cells and of their transitive dependents. */
+	void forget(const std::vector<cellindex> &cells);
+
+	/** Forget values of the cells reading other sheets and of their transitive dependents. */
+	void forget_external();
+
+	value_cache values;
+	dependency_graph dependencies;
+	lookup_cache lookups;
+	aggregate_cache aggregates;
+	async_calls calls;
+	profiler *profile;
+	tracer *trace;
+
+	/** Other sheets of the workbook, nullptr if not in workbook. */
+	const sheet_link *link;
+};
+
+/** Memory used by one constant region. */
+struct region_memory {
+	region_memory(const cellindex &first, unsigned int rows, std::size_t bytes) : first(first), rows(rows), bytes(bytes) {}
+
+	cellindex first;
+	unsigned int rows;
+	std::size_t bytes;
+};
+
+/** Memory used by the spreadsheet in bytes, by parts.
+ * Sizes are estimates of the heap use: capacities of strings and vectors,
+ * and nodes of the containers, without allocator overhead.
+ *
+ * \sa spreadsheet::memory_usage
+ */
+struct memory_report {
+	memory_report()
+		: inputs(0), formulas(0), tables(0), syntax_errors(0), regions(0),
+		references(0), pages(0), values(0), dependencies(0), lookups(0), async_results(0), history(0) {}
+
+	/** Input strings of the cells. */
+	std::size_t inputs;
+
+	/** Compiled formulas and numbers. */
+	std::size_t formulas;
+
+	/** Nodes of the cell and syntax error tables and of the region map. */
+	std::size_t tables;
+
+	/** Syntax error messages. */
+	std::size_t syntax_errors;
+
+	/** Compressed constant regions. */
+	std::size_t regions;
+
+	/** References between the formulas in topological order. */
+	std::size_t references;
+
+	/** Resident tiles of paged regions. */
+	std::size_t pages;
+
+	/** Memoized values and evaluation errors. */
+	std::size_t values;
+
+	/** Dependencies recorded for recalculation of volatile cells. */
+	std::size_t dependencies;
+
+	/** Indexes of the lookup functions and aggregates of the range functions. */
+	std::size_t lookups;
+
+	/** Asynchronous calls and their results. */
+	std::size_t async_results;
+
+	/** Versions kept for undo and redo, the parts not shared with the current version. */
+	std::size_t history;
+
+	/** Regions of the current version, ordered by their first cell. */
+	std::vector<region_memory> region_details;
+
+	std::size_t total() const {
+		return inputs + formulas + tables + syntax_errors + regions + references + pages + values + dependencies + lookups + async_results + history;
+	}
+
+	/** Write the report as JSON object. */
+	void write_json(std::ostream &os) const;
+};
+
+/** Constant regions keyed by their first cell. */
+typedef std::map<cellindex, std::shared_ptr<const constant_region> > region_map;
+
+/** All cells of the spreadsheet.
+ * Tables are persistent, so copying contents is O(1) and the copy is immutable version.
+ * Both spreadsheet and its snapshots read and evaluate cells through this.
+ *
+ * Large blocks of numbers are kept in compressed constant regions instead of cells.
+ * Every cell is either in the cells table or in one region.
+ */
+class sheet_contents : public formula_source {
+public:
+	sheet_contents(const std::shared_ptr<const function_registry> &functions)
+		: regions(std::make_shared<region_map>()), functions(functions) {}
+
+	/** Get non evaluated cell value. */
+	std::string get(const cellindex &i) const;
+
+	/** Get evaluated cell value, memoizing values in the state.
+	 * Cells waiting for asynchronous functions are `#PENDING`.
+	 */
+	std::string evaluate(const cellindex &i, evaluation_state &state) const;
+
+	/** Evaluate the cell to number.
+	 *
+	 * @throw evaluation_error
+	 * @throw pending_evaluation
+	 */
+	double value(const cellindex &i, evaluation_state &state) const;
+
+	/** Evaluate the rectangle, see `spreadsheet::evaluate_range`.
+	 * Precedents of its formulas are evaluated first, in the order of the references if given.
+	 */
+	std::vector<std::string> evaluate_range(const cellindex &first, const cellindex &last, evaluation_state &state, const reference_graph *references = nullptr) const;
+
+	/** Evaluate all formulas until done or cancelled, returns number of formula cells left without memoized value.
+	 * Formulas are evaluated in the order of the references if given, otherwise in table order.
+	 */
+	std::size_t calculate(bool wait, const cancellation *cancel, evaluation_state &state, const reference_graph *references = nullptr) const;
+
+	/** Formula cells without memoized value. */
+	std::set<cellindex> stale_cells(const evaluation_state &state) const;
+
+	/** Get indexes of all non empty cells. */
+	std::set<cellindex> non_empty_cells() const;
+
+	/** Evaluate non empty cells in row-major order, passing values to the callback. */
+	void for_each_value(const value_callback &f, evaluation_state &state) const;
+
+	/** Write evaluated values as table starting from A1, row per line.
+	 * Values are streamed, memory use does not depend on the number of cells.
+	 */
+	void export_values(std::ostream &os, export_format format, evaluation_state &state) const;
+
+	const astnode *formula(const cellindex &index) const;
+
+	/** Formula and the cycle check flag of the cell. */
+	const astnode *checked_formula(const cellindex &index, bool &check_cycles) const;
+
+	/** Value of the cell in constant region. */
+	bool constant(const cellindex &index, double &value) const;
+
+	/** Region containing the cell, nullptr if there is none. */
+	const constant_region *region(const cellindex &i) const;
+
+	/** Set the cell, splitting the region containing it. */
+	void put(const cellindex &i, const cell &c);
+
+	/** Erase the cell, also from the region containing it. */
+	void remove(const cellindex &i);
+
+	/** Replace rows of the column with constant region of the values. */
+	void load(unsigned int col, unsigned int first_row, const std::vector<double> &values);
+
+	/** Remove the region starting at the cell. */
+	void unload(const cellindex &first);
+
+	/** Write the regions to the page file. */
+	void page_regions();
+
+	/** Move and split regions by the row or column shift. */
+	void shift_regions(const reference_shift &shift);
+
+	/** Add memory used by the cells, syntax errors and regions to the report.
+	 * If `seen` is not nullptr, parts in it are skipped and counted ones are added,
+	 * so that parts shared between versions are counted once.
+	 */
+	void memory_usage(memory_report &report, std::unordered_set<const void *> *seen) const;
+
+	table<cell> cells;
+
+	/** cells with syntax error in formula, second part is error message */
+	table<std::string> syntax_errors;
+
+	/** Compressed constant regions. Shared between versions, copied on write.
+	 * There are few of them, so copying the map is cheap.
+	 */
+	std::shared_ptr<const region_map> regions;
+
+	/** Page file for new regions, nullptr if they are kept in memory. */
+	std::shared_ptr<page_file> pages;
+
+private:
+	/** Remove rows [from, to) of the column from the regions, splitting them. */
+	void cut_regions(unsigned int col, unsigned int from, unsigned int to);
+
+	std::string evaluate(const cellindex &i, const cell &c, evaluation_state &state) const;
+
+	/** Evaluated value of the cell as text, with the environment shared by many cells. */
+	std::string evaluate(const cellindex &i, const cell &c, environment &env) const;
+
+	/** Point the environment to the parts of the state. */
+	void setup(environment &env, evaluation_state &state) const;
+
+	/** Evaluate formulas filled down columns as blocks, memoizing their values.
+	 * Cells which can't be evaluated in the block are left for evaluation one by one.
+	 */
+	void evaluate_blocks(environment &env, evaluation_state &state) const;
+
+	/** Evaluate `count` rows of the column from `first_row` with the kernel. */
+	void evaluate_block(unsigned int col, unsigned int first_row, unsigned int count, const column_kernel &kernel, environment &env, evaluation_state &state) const;
+
+public:
+	/** Functions the formulas are compiled with, needed to write formula text.
+	 * Shared with lazily compiled formulas, which can outlive the spreadsheet in snapshots.
+	 */
+	std::shared_ptr<const function_registry> functions;
+};
+
+/** Immutable view of the spreadsheet at the time it was taken.
+ * Taking and copying snapshot is O(1). Snapshot can be evaluated concurrently
+ * from many threads, also while the spreadsheet is modified.
+ * Copies of the snapshot share memoized values.
+ *
+ * \sa spreadsheet::take_snapshot
+ */
+class snapshot {
+public:
+	/** Get non evaluated cell value. */
+	std::string get(const cellindex &i) const {
+		return m_contents.get(i);
+	}
+
+	/** Get evaluated cell value. */
+	std::string evaluate(const cellindex &i) const {
+		return m_contents.evaluate(i, *m_state);
+	}
+
+	/** Evaluate the rectangle, see `spreadsheet::evaluate_range`. */
+	std::vector<std::string> evaluate_range(const cellindex &first, const cellindex &last) const {
+		return m_contents.evaluate_range(first, last, *m_state);
+	}
+
+	/** Evaluate all formulas, see `spreadsheet::calculate`. */
+	std::size_t calculate(bool wait = true) const {
+		return m_contents.calculate(wait, nullptr, *m_state);
+	}
+
+	/** Evaluate formulas until done or cancelled. */
+	std::size_t calculate(const cancellation &cancel, bool wait = true) const {
+		return m_contents.calculate(wait, &cancel, *m_state);
+	}
+
+	/** Formula cells not evaluated yet. */
+	std::set<cellindex> stale_cells() const {
+		return m_contents.stale_cells(*m_state);
+	}
+
+	/** Recompute volatile cells, see `spreadsheet::tick`. */
+	std::size_t tick() {
+		return m_state->tick();
+	}
+
+	/** Get indexes of all non empty cells. */
+	std::set<cellindex> non_empty_cells() const {
+		return m_contents.non_empty_cells();
+	}
+
+	/** Evaluate non empty cells in row-major order, passing values to the callback. */
+	void for_each_value(const value_callback &f) const {
+		m_contents.for_each_value(f, *m_state);
+	}
+
+	/** Write evaluated values as csv or tsv. */
+	void export_values(std::ostream &os, export_format format = export_csv) const {
+		m_contents.export_values(os, format, *m_state);
+	}
+
+private:
+	friend class spreadsheet;
+
+	snapshot(const sheet_contents &contents) : m_contents(contents), m_state(new evaluation_state()) {}
+
+	sheet_contents m_contents;
+	std::shared_ptr<evaluation_state> m_state;
+};
 
 /** Class encapsulating almost all spreadsheet actions.
  * You need to provide functionmap with function used in the spreadsheet.
+ * The functionmap is compiled into registry when spreadsheet is constructed,
+ * functions must outlive the spreadsheet and its snapshots.
+ *
+ * In lazy mode `set` only classifies the input (number, formula or string),
+ * formulas are parsed when first needed, for evaluation or for the references.
+ * Syntax errors are reported by `evaluate` in both modes.
+ *
+ * Evaluated values are memoized. `evaluate` (and other const members) can be
+ * called concurrently from many threads, all sharing the memoized values.
+ * Modifying members (`set`, `erase`, `undo`, `redo`) must not run concurrently with
+ * anything else, they invalidate the memoized values.
+ * Readers which need to run during modifications should use snapshots.
+ * Snapshots of workbook sheets don't see the other sheets.
+ *
+ * Dependencies are recorded during evaluation, so that `tick` recomputes only volatile cells,
+ * and `set` and `erase` forget only values depending on the edited cell.
+ *
+ * Asynchronous functions don't block the evaluation: cells depending on pending
+ * calls evaluate to `#PENDING`, until the results are delivered.
+ *
+ * Every modification keeps the previous version of the contents for `undo`.
+ * Versions share the unchanged cells, so this is cheap.
  *
  * \sa function
  */
 class spreadsheet {
 public:
-	spreadsheet(const functionmap &fm) : m_function_map(fm) {}
+	spreadsheet(const functionmap &fm, bool lazy = false)
+		: m_contents(std::make_shared<function_registry>(fm)), m_lazy(lazy), m_undo_limit(100), m_workbook(nullptr), m_journal(nullptr) {}
 
-	~spreadsheet() {
-		for (auto &p : asts) {
-			delete p.second;
-		}
-	}
+	/** Spreadsheet sharing already compiled functions, eg. with other sheets of workbook. */
+	spreadsheet(const std::shared_ptr<const function_registry> &functions, bool lazy = false)
+		: m_contents(functions), m_lazy(lazy), m_undo_limit(100), m_workbook(nullptr), m_journal(nullptr) {}
 
 	/** Set cell value. */
 	void set(const cellindex &i, const std::string &s);
@@ -32,23 +395,245 @@ public:
 	/** Get evaluated cell value. */
 	std::string evaluate(const cellindex &i) const;
 
+	/** Evaluate cells of the rectangle between the corners, eg. the visible window.
+	 * Returns values as `evaluate` does, row by row: value of cell (col, row) is at
+	 * `(row - top) * width + (col - left)`.
+	 *
+	 * Only the formulas of the rectangle and their precedents are evaluated, each once,
+	 * precedents first. Cost does not depend on the rest of the sheet.
+	 */
+	std::vector<std::string> evaluate_range(const cellindex &first, const cellindex &last) const {
+		return m_contents.evaluate_range(first, last, m_state, &m_references);
+	}
+
 	/** Clear cell value. */
 	void erase(const cellindex &i);
 
+	/** Evaluate all formulas. While asynchronous calls are pending, independent cells are evaluated,
+	 * the dependent ones are finished as the results arrive.
+	 * If `wait` is false, only starts the calls and evaluates what is available.
+	 * Returns number of formula cells still stale, which is zero when waiting.
+	 */
+	std::size_t calculate(bool wait = true) const {
+		return m_contents.calculate(wait, nullptr, m_state, &m_references);
+	}
+
+	/** Evaluate formulas until done, or until cancelled or the deadline passes.
+	 * Cancellation is checked before each cell, so recalculation stops at cell granularity.
+	 * Cells evaluated so far stay memoized and valid, the rest are stale.
+	 * Calling it again resumes, finished cells are not evaluated again.
+	 * Returns number of formula cells still stale, the size of `stale_cells`.
+	 *
+	 * \sa cancellation
+	 */
+	std::size_t calculate(const cancellation &cancel, bool wait = true) const {
+		return m_contents.calculate(wait, &cancel, m_state, &m_references);
+	}
+
+	/** Formula cells not evaluated since last modification. */
+	std::set<cellindex> stale_cells() const {
+		return m_contents.stale_cells(m_state);
+	}
+
+	/** The cell is on a cycle of references, found when the formulas were set.
+	 * Cycle doesn't have to be an error, eg. when it goes through branch of IF which is not taken.
+	 */
+	bool circular(const cellindex &i) const {
+		return m_references.cyclic(i);
+	}
+
+	/** Make volatile cells (calling volatile functions eg. time or random numbers)
+	 * and their transitive dependents stale, the rest of the values stay memoized.
+	 * They are recomputed when evaluated next time.
+	 * Returns number of stale cells.
+	 */
+	std::size_t tick() {
+		return m_state.tick();
+	}
+
 	/** Get indexes of all non empty cells. */
 	std::set<cellindex> non_empty_cells() const;
 
+	/** Evaluate non empty cells in row-major order, passing values to the callback.
+	 * Unlike iterating `non_empty_cells`, indexes are not copied.
+	 */
+	void for_each_value(const value_callback &f) const {
+		m_contents.for_each_value(f, m_state);
+	}
+
+	/** Write evaluated values as csv or tsv, streaming them in row-major order. */
+	void export_values(std::ostream &os, export_format format = export_csv) const {
+		m_contents.export_values(os, format, m_state);
+	}
+
+	/** Insert empty rows before the row, moving cells below down.
+	 * References to moved cells are rewritten in the compiled formulas, without reparsing.
+	 * Text of formulas with syntax errors is kept as it is.
+	 */
+	void insert_rows(unsigned int row, unsigned int count = 1);
+
+	/** Delete rows, moving cells below up. References to deleted cells become `#REF!`.
+	 * In workbook, references to this sheet in the other sheets are rewritten too.
+	 */
+	void delete_rows(unsigned int row, unsigned int count = 1);
+
+	/** Insert empty columns before the column, moving cells right. */
+	void insert_cols(unsigned int col, unsigned int count = 1);
+
+	/** Delete columns, moving cells on the right left. References to deleted cells become `#REF!`. */
+	void delete_cols(unsigned int col, unsigned int count = 1);
+
+	/** Start recording evaluation times of cells.
+	 * Memoized values are forgotten, so following evaluations are measured.
+	 */
+	void enable_profiling();
+
+	/** Stop recording evaluation times, and forget the profile. */
+	void disable_profiling();
+
+	/** Recorded profile, nullptr if profiling is not enabled. */
+	const profiler *profile() const {
+		return m_profiler.get();
+	}
+
+	/** Record spans of modifications, parsing, evaluation of cells and formatting of values
+	 * into the tracer, nullptr detaches it. The tracer must outlive the spreadsheet, or be detached.
+	 * Snapshots are not traced.
+	 */
+	void set_tracer(tracer *t) {
+		m_state.trace = t;
+	}
+
+	/** Replace rows of the column starting from `first_row` with the numbers.
+	 * They are stored compressed, as runs, sequences or small dictionary codes,
+	 * and read as number cells. Setting or erasing cell in the region splits it.
+	 */
+	void load_column(unsigned int col, unsigned int first_row, const std::vector<double> &values);
+
+	/** Record following modifications into the journal, nullptr detaches it.
+	 * Undo and redo are recorded as sets and erases of the changed cells.
+	 * The journal must outlive the spreadsheet, or be detached.
+	 *
+	 * \sa journal
+	 */
+	void attach_journal(journal *j) {
+		m_journal = j;
+	}
+
+	/** Memory used by the spreadsheet, its memoized values, dependencies and indexes.
+	 * Walks all cells. Versions kept for undo are counted only if `history` is true,
+	 * which needs temporary memory proportional to the number of cells.
+	 */
+	memory_report memory_usage(bool history = false) const;
+
+	/** Keep constant regions in memory-mapped backing file, with at most `budget` bytes
+	 * of them resident. Regions used least recently are paged out, and read back from
+	 * the file when evaluated or scanned. Loaded regions are paged too.
+	 * Formulas and other cells stay in memory. The file is named by `path` with unique suffix.
+	 *
+	 * @throw std::runtime_error if the file can't be created
+	 */
+	void enable_paging(const std::string &path, std::size_t budget);
+
+	/** Page file of the regions, nullptr if paging is not enabled. */
+	const page_file *pages() const {
+		return m_pages.get();
+	}
+
+	/** Take immutable O(1) snapshot of current contents. */
+	snapshot take_snapshot() const {
+		return snapshot(m_contents);
+	}
+
+	/** Revert last modification. Returns false if there is nothing to undo. */
+	bool undo();
+
+	/** Redo last undone modification. Returns false if there is nothing to redo. */
+	bool redo();
+
+	/** Set how many versions are kept for `undo`. Zero disables undo. */
+	void set_undo_limit(std::size_t limit);
+
 private:
+	friend class workbook;
+	friend class journal;
+
 	spreadsheet(const spreadsheet &);
 	spreadsheet &operator=(const spreadsheet &);
 
-	table<std::string> inputs;
-	table<astnode *> asts;
+	/** Compile the input into ast, classify only in lazy mode. Syntax errors are recorded. */
+	std::shared_ptr<const astnode> compile(const cellindex &i, const std::string &s);
 
-	/** cells with syntax error in formula, second part is error message */
-	std::map<cellindex, std::string> syntax_errors;
+	/** Shift this sheet, and rewrite references to it in the other sheets of the workbook. */
+	void shift(const reference_shift &shift);
+
+	/** Move all cells and rewrite references in one pass, rebuilding the tables in O(n). */
+	void shift_cells(const reference_shift &shift);
+
+	/** Rewrite references to the other sheet shifted in the workbook, the cells don't move.
+	 * Rewritten formulas are recorded for undo and into the journal.
+	 */
+	void rewrite_references(const reference_shift &shift);
+
+	/** Remember current version for undo, and forget undone ones. */
+	void record_undo();
+
+	/** Update references of the cell after it was set or erased. */
+	void update_references(const cellindex &i);
+
+	/** Build references of all cells again, after the contents were replaced. */
+	void rebuild_references();
+
+	/** Update cycle check flags of the cells, after their references changed. */
+	void update_checks(const std::vector<cellindex> &changed);
+
+	/** Forget memoized values and results of impure asynchronous calls after modification.
+	 * Values of the other sheets of the workbook are forgotten too.
+	 */
+	void invalidate();
+
+	/** Forget memoized values depending on the edited cell and results of impure asynchronous calls.
+	 * Values of the other sheets of the workbook are forgotten as whole, and so are values
+	 * of this sheet reading them, which may read the edited cell back.
+	 */
+	void invalidate(const cellindex &i);
+
+	/** Forget memoized values of the cells reading other sheets. */
+	void forget_external();
+
+	/** Forget memoized values of this sheet only. */
+	void forget_values();
+
+	/** Record cells differing from the previous version into the journal. */
+	void journal_changes(const sheet_contents &previous);
+
+	sheet_contents m_contents;
+
+	/** Previous versions, last one is the most recent. */
+	std::deque<sheet_contents> m_undo;
+	std::deque<sheet_contents> m_redo;
+
+	/** Parse formulas on first evaluation instead of in `set`. */
+	bool m_lazy;
+
+	std::size_t m_undo_limit;
+
+	/** Page file of the regions, kept by all versions of the contents. */
+	std::shared_ptr<page_file> m_pages;
+
+	/** References of the current version, giving the order of calculation and cycles. */
+	reference_graph m_references;
+
+	/** Memoized values, shared by concurrent readers. */
+	mutable evaluation_state m_state;
+
+	std::unique_ptr<profiler> m_profiler;
+
+	/** Workbook the sheet belongs to, or nullptr. */
+	workbook *m_workbook;
 
-	const functionmap &m_function_map;
+	/** Journal of the modifications, or nullptr. */
+	journal *m_journal;
 };
 
 #endif
@@ -2,23 +2,117 @@
 #ifndef TABLE_HH
 #define TABLE_HH
 
-#include <map>
+#include <algorithm>
+#include <cstddef>
+#include <iterator>
+#include <memory>
+#include <unordered_set>
+#include <utility>
+#include <vector>
 
 #include "cellindex.hh"
 #include "definitions.hh"
 
-/** Helper table class. */
+/** Helper table class.
+ *
+ * Table is persistent: nodes are immutable and shared between copies,
+ * modification copies only the path from the root to the changed cell.
+ * So copying the table is O(1) and the copy is not affected by later modifications
+ * of the original, which makes it usable as a snapshot.
+ * Table can be read concurrently, also while other copy of it is modified.
+ *
+ * Internally it's a treap ordered by cellindex. Priorities are hashes of the keys,
+ * so the shape of the tree depends only on its contents.
+ */
 template <typename T>
 class table {
 public:
-	typedef typename std::map<cellindex, T>::const_iterator const_iterator;
+	typedef std::pair<const cellindex, T> value_type;
 
-	const_iterator begin() const { return data.begin(); }
-	const_iterator end() const { return data.end(); }
+private:
+	struct node;
+	typedef std::shared_ptr<const node> node_ptr;
+
+	struct node {
+		node(const value_type &value, const node_ptr &left, const node_ptr &right) : value(value), left(left), right(right) {}
+
+		value_type value;
+		node_ptr left;
+		node_ptr right;
+	};
+
+public:
+	/** In-order iterator. Invalidated by modifications of the table. */
+	class const_iterator {
+	public:
+		typedef std::forward_iterator_tag iterator_category;
+		typedef typename table::value_type value_type;
+		typedef std::ptrdiff_t difference_type;
+		typedef const value_type *pointer;
+		typedef const value_type &reference;
+
+		const_iterator() {}
+
+		reference operator*() const { return m_stack.back()->value; }
+		pointer operator->() const { return &m_stack.back()->value; }
+
+		const_iterator &operator++() {
+			const node *n = m_stack.back();
+			m_stack.pop_back();
+			push_left(n->right.get());
+			return *this;
+		}
+
+		const_iterator operator++(int) {
+			const_iterator ret = *this;
+			++*this;
+			return ret;
+		}
+
+		bool operator==(const const_iterator &other) const {
+			if (m_stack.empty() || other.m_stack.empty()) {
+				return m_stack.empty() && other.m_stack.empty();
+			}
+			return m_stack.back() == other.m_stack.back();
+		}
+
+		bool operator!=(const const_iterator &other) const {
+			return !(*this == other);
+		}
+
+	private:
+		friend class table;
+
+		/** Push node and its left spine, so that leftmost is on the top. */
+		void push_left(const node *n) {
+			for (; n != nullptr; n = n->left.get()) {
+				m_stack.push_back(n);
+			}
+		}
+
+		/** Nodes which are still to be visited, next one on the top. */
+		std::vector<const node *> m_stack;
+	};
+
+	table() : m_size(0) {}
+
+	const_iterator begin() const {
+		const_iterator iter;
+		iter.push_left(m_root.get());
+		return iter;
+	}
+
+	const_iterator end() const { return const_iterator(); }
+
+	std::size_t size() const { return m_size; }
+	bool empty() const { return m_size == 0; }
 
 	void set(const cellindex &i, const T &t) {
-		data.erase(i);
-		data.insert(std::make_pair(i, t));
+		bool inserted = false;
+		m_root = insert(m_root, value_type(i, t), inserted);
+		if (inserted) {
+			m_size++;
+		}
 	}
 
 	void set(unsigned int col, unsigned int row, const T &t) {
@@ -26,15 +120,233 @@ public:
 	}
 
 	const_iterator find(const cellindex &index) const {
-		return data.find(index);
+		// Stack contains nodes where we went left, as they are visited after found one.
+		const_iterator iter;
+		const node *n = m_root.get();
+		while (n != nullptr) {
+			if (index < n->value.first) {
+				iter.m_stack.push_back(n);
+				n = n->left.get();
+			} else if (n->value.first < index) {
+				n = n->right.get();
+			} else {
+				iter.m_stack.push_back(n);
+				return iter;
+			}
+		}
+		return end();
+	}
+
+	/** Iterator to the last cell, ie. the one in the last column with the highest row. */
+	const_iterator last() const {
+		const_iterator iter;
+		const node *n = m_root.get();
+		while (n != nullptr && n->right) {
+			n = n->right.get();
+		}
+		if (n != nullptr) {
+			iter.m_stack.push_back(n);
+		}
+		return iter;
+	}
+
+	/** Iterator to the first cell not less than index. */
+	const_iterator lower_bound(const cellindex &index) const {
+		// Stack contains nodes where we went left, as they are visited after found one.
+		const_iterator iter;
+		const node *n = m_root.get();
+		while (n != nullptr) {
+			if (n->value.first < index) {
+				n = n->right.get();
+			} else {
+				iter.m_stack.push_back(n);
+				n = n->left.get();
+			}
+		}
+		return iter;
+	}
+
+	/** Visit cells in row-major order (table is ordered column-first).
+	 * Merges one cursor per column, so needs memory only O(columns * log n).
+	 */
+	template <typename F>
+	void for_each_row_major(F f) const {
+		// Cursors are keyed by (row, col) of the current cell, heap top is the smallest.
+		typedef std::pair<unsigned long long, const_iterator> cursor;
+		auto key = [](const cellindex &i) {
+			return (static_cast<unsigned long long>(i.row) << 32) | i.col;
+		};
+		auto later = [](const cursor &a, const cursor &b) {
+			return a.first > b.first;
+		};
+
+		std::vector<cursor> cursors;
+		for (const_iterator iter = begin(); iter != end(); iter = lower_bound(cellindex(iter->first.col + 1, 0))) {
+			cursors.push_back(cursor(key(iter->first), iter));
+		}
+		std::make_heap(cursors.begin(), cursors.end(), later);
+
+		while (!cursors.empty()) {
+			std::pop_heap(cursors.begin(), cursors.end(), later);
+			const_iterator iter = cursors.back().second;
+			cursors.pop_back();
+
+			f(*iter);
+
+			unsigned int col = iter->first.col;
+			++iter;
+			if (iter != end() && iter->first.col == col) {
+				cursors.push_back(cursor(key(iter->first), iter));
+				std::push_heap(cursors.begin(), cursors.end(), later);
+			}
+		}
 	}
 
 	void erase(const cellindex &i) {
-		data.erase(i);
+		bool erased = false;
+		m_root = remove(m_root, i, erased);
+		if (erased) {
+			m_size--;
+		}
+	}
+
+	/** Replace contents with values sorted by strictly increasing index, in O(n). */
+	void assign_sorted(const std::vector<value_type> &values) {
+		// Build the treap along its right spine, stack holds the spine.
+		std::vector<std::shared_ptr<node> > spine;
+		for (const value_type &value : values) {
+			std::shared_ptr<node> n = std::make_shared<node>(value, node_ptr(), node_ptr());
+			std::shared_ptr<node> last;
+			while (!spine.empty() && priority(spine.back()->value.first) < priority(value.first)) {
+				last = spine.back();
+				spine.pop_back();
+			}
+			n->left = last;
+			if (!spine.empty()) {
+				spine.back()->right = n;
+			}
+			spine.push_back(n);
+		}
+
+		m_root = spine.empty() ? node_ptr() : spine.front();
+		m_size = values.size();
+	}
+
+	/** Memory used by the nodes of the table, in bytes, without heap memory of the values.
+	 * Calls `f(value)` for each visited node, so that the caller can count the values.
+	 *
+	 * If `seen` is not nullptr, nodes already in it are skipped and the visited ones are added.
+	 * Skipped node is shared with table counted before, and so is its whole subtree.
+	 * This counts versions sharing nodes (copies of the table) only once.
+	 */
+	template <typename F>
+	std::size_t memory_usage(std::unordered_set<const void *> *seen, F f) const {
+		std::size_t ret = 0;
+		std::vector<const node *> stack;
+		if (m_root) {
+			stack.push_back(m_root.get());
+		}
+		while (!stack.empty()) {
+			const node *n = stack.back();
+			stack.pop_back();
+			if (seen != nullptr && !seen->insert(n).second) {
+				continue;
+			}
+
+			// node allocated together with its shared_ptr control block
+			ret += sizeof(node) + 2 * sizeof(void *);
+			f(n->value);
+			if (n->left) stack.push_back(n->left.get());
+			if (n->right) stack.push_back(n->right.get());
+		}
+		return ret;
 	}
 
 private:
-	std::map<cellindex, T> data;
+	/** Priority of the key, mixed bits of the index. */
+	static unsigned int priority(const cellindex &i) {
+		unsigned long long x = (static_cast<unsigned long long>(i.col) << 32) | i.row;
+		x ^= x >> 33;
+		x *= 0xff51afd7ed558ccdULL;
+		x ^= x >> 33;
+		x *= 0xc4ceb9fe1a85ec53ULL;
+		x ^= x >> 33;
+		return static_cast<unsigned int>(x);
+	}
+
+	static node_ptr make(const value_type &value, const node_ptr &left, const node_ptr &right) {
+		return std::make_shared<node>(value, left, right);
+	}
+
+	/** Split tree into keys less than and greater than index, which must not be present. */
+	static void split(const node_ptr &t, const cellindex &index, node_ptr &less, node_ptr &greater) {
+		if (!t) {
+			less.reset();
+			greater.reset();
+		} else if (t->value.first < index) {
+			node_ptr l;
+			split(t->right, index, l, greater);
+			less = make(t->value, t->left, l);
+		} else {
+			node_ptr g;
+			split(t->left, index, less, g);
+			greater = make(t->value, g, t->right);
+		}
+	}
+
+	/** Merge trees, all keys of `less` must be less than keys of `greater`. */
+	static node_ptr merge(const node_ptr &less, const node_ptr &greater) {
+		if (!less) return greater;
+		if (!greater) return less;
+
+		if (priority(less->value.first) > priority(greater->value.first)) {
+			return make(less->value, less->left, merge(less->right, greater));
+		} else {
+			return make(greater->value, merge(less, greater->left), greater->right);
+		}
+	}
+
+	static node_ptr insert(const node_ptr &t, const value_type &value, bool &inserted) {
+		if (!t) {
+			inserted = true;
+			return make(value, node_ptr(), node_ptr());
+		}
+
+		const cellindex &index = value.first;
+		if (priority(index) > priority(t->value.first)) {
+			// Equal keys have equal priorities, so index is not in this subtree.
+			node_ptr less, greater;
+			split(t, index, less, greater);
+			inserted = true;
+			return make(value, less, greater);
+		} else if (index < t->value.first) {
+			return make(t->value, insert(t->left, value, inserted), t->right);
+		} else if (t->value.first < index) {
+			return make(t->value, t->left, insert(t->right, value, inserted));
+		} else {
+			return make(value, t->left, t->right);
+		}
+	}
+
+	static node_ptr remove(const node_ptr &t, const cellindex &index, bool &erased) {
+		if (!t) {
+			return t;
+		}
+
+		if (index < t->value.first) {
+			node_ptr left = remove(t->left, index, erased);
+			return erased ? make(t->value, left, t->right) : t;
+		} else if (t->value.first < index) {
+			node_ptr right = remove(t->right, index, erased);
+			return erased ? make(t->value, t->left, right) : t;
+		} else {
+			erased = true;
+			return merge(t->left, t->right);
+		}
+	}
+
+	node_ptr m_root;
+	std::size_t m_size;
 };
 
 #endif
@@ -0,0 +1,142 @@
+#include "spreadsheet.hh"
+#include "functions.hh"
+#include "aggregate.hh"
+
+#include <iostream>
+
+void test() {
+	functionmap functions;
+	functions["+"] = new plus_function();
+	functions["-"] = new minus_function();
+	functions["SUM"] = new sum_function();
+	functions["AVERAGE"] = new average_function();
+	functions["COUNT"] = new count_function();
+
+	spreadsheet s(functions);
+
+	// Running totals and sliding windows over data column, quadratic without shared aggregates
+	const unsigned int rows = 5000;
+	std::vector<double> data;
+	for (unsigned int k = 1; k <= rows; k++) {
+		data.push_back(k);
+	}
+	s.load_column(0, 0, data);
+	for (unsigned int k = 1; k <= rows; k++) {
+		s.set(cellindex(1, k - 1), "=SUM(A1:A" + to_string(k) + ")");
+		if (k >= 10) {
+			s.set(cellindex(2, k - 1), "=AVERAGE(A" + to_string(k - 9) + ":A" + to_string(k) + ")");
+		}
+	}
+	s.calculate();
+
+	unsigned int wrong = 0;
+	for (unsigned int k = 1; k <= rows; k++) {
+		if (s.evaluate(cellindex(1, k - 1)) != to_string(k * (k + 1.0) / 2)) {
+			wrong++;
+		}
+		if (k >= 10 && s.evaluate(cellindex(2, k - 1)) != to_string(k - 4.5)) {
+			wrong++;
+		}
+	}
+	std::cout << "wrong: " << wrong << std::endl;
+
+	std::cout << "CHANGE" << std::endl;
+	s.set("A5", "105");
+	std::cout << "B4: " << s.evaluate("B4") << std::endl;
+	std::cout << "B" << rows << ": " << s.evaluate(cellindex(1, rows - 1)) << std::endl;
+	std::cout << "C14: " << s.evaluate("C14") << std::endl;
+
+	std::cout << "MIXED" << std::endl;
+	s.set("D1", "1");
+	s.set("D2", "text");
+	s.set("D4", "=2+2");
+	s.set("D20", "5");
+	s.set("E1", "=SUM(D1:D20)");
+	s.set("E2", "=COUNT(D1:D20)");
+	s.set("E3", "=AVERAGE(D1:D20, 10)");
+	s.set("E4", "=SUM(D1:D2, D4, 1)");
+	s.set("E5", "=AVERAGE(D5:D19)");
+	for (const char *c : {"E1", "E2", "E3", "E4", "E5"}) {
+		std::cout << c << ": " << s.evaluate(c) << std::endl;
+	}
+
+	std::cout << "ERRORS" << std::endl;
+	s.set("D10", "=D10");
+	s.set("F1", "=SUM(F2:F30)");
+	std::cout << "E1: " << s.evaluate("E1") << std::endl;
+	std::cout << "E4: " << s.evaluate("E4") << std::endl;
+	std::cout << "F1: " << s.evaluate("F1") << std::endl;
+	s.set("F20", "=F1");
+	std::cout << "F1: " << s.evaluate("F1") << std::endl;
+
+	// Running totals over formulas extend the blocks one row at a time
+	std::cout << "FORMULAS" << std::endl;
+	spreadsheet f(functions);
+	const unsigned int formula_rows = 2000;
+	for (unsigned int k = 1; k <= formula_rows; k++) {
+		f.set(cellindex(0, k - 1), "=" + to_string(k) + " + 0");
+		f.set(cellindex(1, k - 1), "=SUM(A1:A" + to_string(k) + ")");
+	}
+	f.calculate();
+	wrong = 0;
+	for (unsigned int k = 1; k <= formula_rows; k++) {
+		if (f.evaluate(cellindex(1, k - 1)) != to_string(k * (k + 1.0) / 2)) {
+			wrong++;
+		}
+	}
+	std::cout << "wrong: " << wrong << std::endl;
+
+	// Sums of the same range are the same, whichever ranges were aggregated before
+	std::cout << "ORDER" << std::endl;
+	std::vector<double> fractions;
+	for (unsigned int k = 0; k < 1000; k++) {
+		fractions.push_back((k % 7 + 1) / (k + 3.0));
+	}
+	spreadsheet first(functions), second(functions);
+	unsigned int seed = 1;
+	for (spreadsheet *t : {&first, &second}) {
+		t->load_column(0, 0, fractions);
+		t->set("B1", "=SUM(A1:A100)");
+	}
+	const unsigned int ranges = 300;
+	for (unsigned int k = 0; k < ranges; k++) {
+		seed = seed * 1103515245 + 12345;
+		unsigned int from = seed / 65536 % 900 + 1;
+		unsigned int to = from + 8 + seed / 256 % 50;
+		std::string sum = "=SUM(A" + to_string(from) + ":A" + to_string(to) + ") - (A" + to_string(from);
+		for (unsigned int row = from + 1; row <= to; row++) {
+			sum += " + A" + to_string(row);
+		}
+		for (spreadsheet *t : {&first, &second}) {
+			t->set(cellindex(2, k), sum + ")");
+		}
+	}
+	first.evaluate("B1");
+	std::vector<std::string> reversed(ranges);
+	for (unsigned int k = ranges; k > 0; k--) {
+		reversed[k - 1] = second.evaluate(cellindex(2, k - 1));
+	}
+	unsigned int differ = 0;
+	for (unsigned int k = 0; k < ranges; k++) {
+		if (first.evaluate(cellindex(2, k)) != reversed[k]) {
+			differ++;
+		}
+	}
+	std::cout << "differ: " << differ << std::endl;
+
+	for (auto &p : functions) {
+		delete p.second;
+	}
+}
+
+int main() {
+	try {
+		test();
+	} catch (const std::exception &e) {
+		std::cout << "FATAL: " << e.what() << std::endl;
+		return 1;
+	} catch (...) {
+		std::cout << "CATCHED SOMETHING" << std::endl;
+		return 1;
+	}
+}
@@ -0,0 +1,90 @@
+#include "spreadsheet.hh"
+#include "functions.hh"
+#include "async.hh"
+#include "parser.hh"
+
+#include <atomic>
+#include <chrono>
+#include <iostream>
+#include <thread>
+
+/** Stub of slow external lookup: delivers the parameter multiplied by ten after a while. */
+class slow_function : public async_function {
+public:
+	slow_function() : async_function("SLOW", function_traits().set_arity(1, 1)), calls(0) {}
+
+	void start(const std::vector<double> &parameters, const std::shared_ptr<async_result> &result) const {
+		calls++;
+		double x = parameters[0];
+		std::thread([x, result]() {
+			std::this_thread::sleep_for(std::chrono::milliseconds(50));
+			if (x < 0) {
+				result->reject("negative lookup");
+			} else {
+				result->resolve(x * 10);
+			}
+		}).detach();
+	}
+
+	mutable std::atomic<int> calls;
+};
+
+void test() {
+	slow_function slow;
+
+	functionmap functions;
+	functions["+"] = new plus_function();
+	functions["-"] = new minus_function();
+	functions["*"] = new mul_function();
+	functions["SLOW"] = &slow;
+
+	spreadsheet s(functions);
+
+	s.set("A1", "=SLOW(1)");
+	s.set("A2", "=SLOW(A1)");
+	s.set("A3", "=A2 + 1");
+	s.set("A4", "=SLOW(0 - 1)");
+	s.set("B1", "=2 * 3");
+	s.set("B2", "=B1 + SLOW(1)");
+
+	// Independent cells are evaluated while calls are pending
+	std::cout << "STARTED" << std::endl;
+	std::cout << "pending: " << s.calculate(false) << std::endl;
+	for (const cellindex &i : s.non_empty_cells()) {
+		std::cout << i << ": " << s.evaluate(i) << std::endl;
+	}
+	std::cout << std::endl;
+
+	std::cout << "CALCULATED" << std::endl;
+	std::cout << "pending: " << s.calculate() << std::endl;
+	for (const cellindex &i : s.non_empty_cells()) {
+		std::cout << i << ": " << s.evaluate(i) << std::endl;
+	}
+	// Same calls are made once
+	std::cout << "calls: " << slow.calls << std::endl;
+	std::cout << std::endl;
+
+	// Results of pure calls are kept over modifications
+	s.set("B1", "=3 * 3");
+	std::cout << "CHANGED" << std::endl;
+	std::cout << "pending: " << s.calculate(false) << std::endl;
+	std::cout << "B2: " << s.evaluate("B2") << std::endl;
+	std::cout << "calls: " << slow.calls << std::endl;
+	std::cout << std::endl;
+
+	// Without async tracking the call is waited for
+	table<astnode *> t;
+	t.set("A1", parse("=SLOW(2) + 1", function_registry(functions)));
+	std::cout << "SYNC" << std::endl;
+	std::cout << "A1: " << evaluate(t.find("A1")->second, t) << std::endl;
+
+	delete t.find("A1")->second;
+	delete functions["+"];
+	delete functions["-"];
+	delete functions["*"];
+}
+
+int main() {
+	test();
+	return 0;
+}
@@ -0,0 +1,105 @@
+#include "spreadsheet.hh"
+#include "functions.hh"
+
+#include <cstdlib>
+#include <iostream>
+
+static double counters[2];
+
+double next_block() {
+	return ++counters[0];
+}
+
+double next_cell() {
+	return ++counters[1];
+}
+
+void fill(spreadsheet &s) {
+	std::vector<double> numbers;
+	for (int row = 1; row <= 200; row++) {
+		std::string r = to_string(row);
+		numbers.push_back(row % 7 == 0 ? 0 : row * 0.1);
+		if (row % 10 != 3) {
+			s.set("B" + r, to_string(row * 3));
+		}
+		s.set("C" + r, row == 50 ? "=1 / 0 + 1 +" : "=A" + r + " * B" + r + " + 0.5");
+		s.set("D" + r, "=(C" + r + " - A" + r + ") / A" + r + " - (2 * B" + r + ")");
+		s.set("E" + r, "=E" + to_string(row + 1) + " + 1");
+	}
+	s.set("E201", "1");
+	s.load_column(0, 0, numbers);
+	s.set("B20", "text");
+	s.set("F1", "=TICK()");
+	for (int row = 2; row <= 30; row++) {
+		s.set("F" + to_string(row), "=F" + to_string(row - 1) + " * 2 + F1");
+	}
+	for (int row = 1; row <= 30; row++) {
+		s.set("G" + to_string(row), "=F" + to_string(row) + " + A" + to_string(row));
+	}
+}
+
+void test() {
+	functionmap functions;
+	functions["+"] = new plus_function();
+	functions["-"] = new minus_function();
+	functions["*"] = new mul_function();
+	functions["/"] = new div_function();
+
+	// Blocks are evaluated by calculate, cells one by one by evaluate
+	functions["TICK"] = new lifted_nullary_function("tick", next_block, function_traits().set_volatile());
+	spreadsheet blocks(functions);
+	functions["TICK"] = new lifted_nullary_function("tick", next_cell, function_traits().set_volatile());
+	spreadsheet cells(functions);
+	fill(blocks);
+	fill(cells);
+
+	blocks.calculate();
+	std::set<cellindex> all = cells.non_empty_cells();
+	std::size_t different = 0;
+	for (const cellindex &i : all) {
+		if (blocks.evaluate(i) != cells.evaluate(i)) {
+			std::cout << i << ": " << blocks.evaluate(i) << " != " << cells.evaluate(i) << std::endl;
+			different++;
+		}
+	}
+	std::cout << "CALCULATED" << std::endl;
+	std::cout << "cells: " << all.size() << " different: " << different << std::endl;
+	for (const char *cell : {"C1", "C7", "C20", "C50", "D1", "D7", "D13", "E200", "G30"}) {
+		std::cout << cell << ": " << blocks.evaluate(cell) << std::endl;
+	}
+	std::cout << std::endl;
+
+	// Volatile cells reach the block cells reading them
+	std::size_t stale = blocks.tick();
+	blocks.calculate();
+	std::cout << "TICKED" << std::endl;
+	std::cout << "stale: " << stale << std::endl;
+	std::cout << "F1: " << blocks.evaluate("F1") << std::endl;
+	std::cout << "G1: " << blocks.evaluate("G1") << std::endl;
+	std::cout << "G30: " << blocks.evaluate("G30") << std::endl;
+	std::cout << "C1: " << blocks.evaluate("C1") << std::endl;
+	std::cout << std::endl;
+
+	// Editing a cell of the loaded region forgets the block cells reading it
+	spreadsheet region(functions);
+	std::vector<double> numbers;
+	for (int row = 0; row < 20; row++) {
+		numbers.push_back(row);
+		region.set("B" + to_string(row + 1), "=A" + to_string(row + 1) + " * 2");
+	}
+	region.load_column(0, 0, numbers);
+	region.calculate();
+	region.set("A6", "100");
+	std::cout << "EDITED REGION" << std::endl;
+	std::cout << "B6: " << region.evaluate("B6") << std::endl;
+	std::cout << "B7: " << region.evaluate("B7") << std::endl;
+}
+
+int main() {
+	try {
+		test();
+	} catch (const std::exception &e) {
+		std::cout << "exception: " << e.what() << std::endl;
+	}
+	return 0;
+}
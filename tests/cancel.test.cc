@@ -0,0 +1,93 @@
+#include "spreadsheet.hh"
+#include "functions.hh"
+#include "cancellation.hh"
+
+#include <iostream>
+
+/** Identity function which cancels the recalculation when applied. */
+class trip_function : public strict_function {
+public:
+	trip_function() : strict_function("TRIP", function_traits().set_arity(1, 1).set_impure()), token(nullptr), applied(0) {}
+
+	double apply(const std::vector<double> &parameters) const {
+		applied++;
+		if (token != nullptr) {
+			token->cancel();
+		}
+		return parameters[0];
+	}
+
+	cancellation *token;
+	mutable int applied;
+};
+
+void print_calculated(std::size_t left, const spreadsheet &s) {
+	std::cout << "left: " << left << std::endl;
+	std::cout << "left is stale: " << (left == s.stale_cells().size() ? "yes" : "no") << std::endl;
+}
+
+void print_stale(const spreadsheet &s) {
+	std::cout << "stale:";
+	for (const cellindex &i : s.stale_cells()) {
+		std::cout << " " << i;
+	}
+	std::cout << std::endl;
+}
+
+void test() {
+	trip_function trip;
+
+	functionmap functions;
+	functions["+"] = new plus_function();
+	functions["TRIP"] = &trip;
+
+	spreadsheet s(functions);
+
+	s.set("A1", "1");
+	for (int row = 2; row <= 8; row++) {
+		s.set(cellindex(0, row - 1), "=A" + to_string(row - 1) + " + 1");
+	}
+	s.set("A5", "=TRIP(A4) + 1");
+	s.set("B1", "=A8 + 1");
+	s.set("C1", "text");
+
+	// Deadline which has passed stops before the first cell
+	std::cout << "DEADLINE" << std::endl;
+	print_calculated(s.calculate(cancellation(cancellation::clock::now())), s);
+	print_stale(s);
+	std::cout << std::endl;
+
+	// Stops at the first cell after cancelling, evaluated cells stay valid
+	cancellation token;
+	trip.token = &token;
+	std::cout << "CANCELLED" << std::endl;
+	print_calculated(s.calculate(token), s);
+	print_stale(s);
+	std::cout << std::endl;
+
+	// Resuming evaluates only the stale cells
+	trip.token = nullptr;
+	cancellation resume;
+	std::cout << "RESUMED" << std::endl;
+	print_calculated(s.calculate(resume), s);
+	print_stale(s);
+	std::cout << "applied: " << trip.applied << std::endl;
+	for (const cellindex &i : s.non_empty_cells()) {
+		std::cout << i << ": " << s.evaluate(i) << std::endl;
+	}
+	std::cout << std::endl;
+
+	// Modification makes everything stale again
+	s.set("A1", "10");
+	std::cout << "CHANGED" << std::endl;
+	print_stale(s);
+	print_calculated(s.calculate(cancellation(std::chrono::seconds(10))), s);
+	std::cout << "B1: " << s.evaluate("B1") << std::endl;
+
+	delete functions["+"];
+}
+
+int main() {
+	test();
+	return 0;
+}
@@ -0,0 +1,79 @@
+#include "spreadsheet.hh"
+#include "functions.hh"
+
+#include <iostream>
+#include <thread>
+#include <vector>
+
+void test() {
+	functionmap functions;
+	functions["+"] = new plus_function();
+	functions["*"] = new mul_function();
+	functions["SUM"] = new plus_function();
+	functions["IF"] = new if_function();
+
+	spreadsheet s(functions, true);
+
+	// Column of running sums, and few broken cells
+	s.set("A1", "1");
+	for (unsigned int row = 1; row < 200; row++) {
+		s.set(cellindex(0, row), "=" + to_string(cellindex(0, row - 1)) + " + 1");
+		s.set(cellindex(1, row), "=SUM(" + to_string(cellindex(0, row)) + ", " + to_string(cellindex(1, row - 1)) + ")");
+	}
+	s.set("B1", "=A1");
+	s.set("C1", "=C2");
+	s.set("C2", "=C1");
+	s.set("C3", "=IF(1, C3, 1)");
+	s.set("C4", "=B200 * ");
+
+	// Many readers, each starting from different end of the sheet
+	std::set<cellindex> cells = s.non_empty_cells();
+	std::vector<cellindex> order(cells.begin(), cells.end());
+	const unsigned int thread_count = 8;
+	std::vector<std::vector<std::string> > results(thread_count);
+	std::vector<std::thread> threads;
+
+	for (unsigned int t = 0; t < thread_count; t++) {
+		threads.push_back(std::thread([&, t]() {
+			std::vector<std::string> &r = results[t];
+			r.resize(order.size());
+			for (std::size_t k = 0; k < order.size(); k++) {
+				std::size_t j = (k + t * order.size() / thread_count) % order.size();
+				r[j] = s.evaluate(order[j]);
+			}
+		}));
+	}
+	for (auto &thread : threads) {
+		thread.join();
+	}
+
+	bool same = true;
+	for (unsigned int t = 1; t < thread_count; t++) {
+		same = same && results[t] == results[0];
+	}
+	std::cout << "SAME: " << (same ? "yes" : "no") << std::endl;
+
+	for (const char *i : { "A1", "A200", "B1", "B200", "C1", "C2", "C3", "C4" }) {
+		std::cout << i << ": " << s.evaluate(i) << std::endl;
+	}
+
+	// Writer invalidates memoized values
+	s.set("A1", "2");
+	std::cout << "B200: " << s.evaluate("B200") << std::endl;
+
+	for (auto &p : functions) {
+		delete p.second;
+	}
+}
+
+int main() {
+	try {
+		test();
+	} catch (const std::exception &e) {
+		std::cout << "FATAL: " << e.what() << std::endl;
+		return 1;
+	} catch (...) {
+		std::cout << "CATCHED SOMETHING" << std::endl;
+		return 1;
+	}
+}
@@ -0,0 +1,56 @@
+#include "spreadsheet.hh"
+#include "functions.hh"
+
+#include <iostream>
+
+void test() {
+	functionmap functions;
+	functions["+"] = new plus_function();
+	functions["*"] = new mul_function();
+	functions["SUM"] = new plus_function();
+
+	spreadsheet s(functions);
+
+	s.set("A1", "1");
+	s.set("B1", "=A1 * 2");
+	s.set("D1", "=SUM(A1, B1, A3)");
+	s.set("A3", "3");
+	s.set("C3", "comma, \"quoted\"");
+	s.set("B4", "tab\there");
+	s.set("C5", "=C3 +");
+	s.set("D5", "=X1");
+
+	std::cout << "ROW-MAJOR" << std::endl;
+	s.for_each_value([](const cellindex &i, const std::string &value) {
+		std::cout << i << ": " << value << std::endl;
+	});
+	std::cout << std::endl;
+
+	std::cout << "CSV" << std::endl;
+	s.export_values(std::cout);
+	std::cout << std::endl;
+
+	std::cout << "TSV" << std::endl;
+	s.take_snapshot().export_values(std::cout, export_tsv);
+	std::cout << std::endl;
+
+	spreadsheet empty(functions);
+	std::cout << "EMPTY" << std::endl;
+	empty.export_values(std::cout);
+
+	for (auto &p : functions) {
+		delete p.second;
+	}
+}
+
+int main() {
+	try {
+		test();
+	} catch (const std::exception &e) {
+		std::cout << "FATAL: " << e.what() << std::endl;
+		return 1;
+	} catch (...) {
+		std::cout << "CATCHED SOMETHING" << std::endl;
+		return 1;
+	}
+}
@@ -0,0 +1,149 @@
+#include "spreadsheet.hh"
+#include "functions.hh"
+#include "journal.hh"
+
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+
+#include <signal.h>
+#include <sys/resource.h>
+
+static const char *path = "tests/journal.tmp";
+
+void print(const spreadsheet &s) {
+	for (const cellindex &i : s.non_empty_cells()) {
+		std::cout << i << ": " << s.get(i) << " = " << s.evaluate(i) << std::endl;
+	}
+}
+
+void test() {
+	functionmap functions;
+	functions["+"] = new plus_function();
+	functions["*"] = new mul_function();
+	functions["SUM"] = new plus_function();
+
+	std::remove(path);
+
+	{
+		journal j(path);
+		spreadsheet s(functions);
+		std::cout << "EMPTY: " << j.replay(s) << std::endl;
+		s.attach_journal(&j);
+
+		s.set("A1", "1");
+		s.set("A2", "=A1 + 1");
+		s.set("A3", "=SUM(A1, A2)");
+		s.set("B1", "overwritten");
+		s.set("B1", "=A3 * 2");
+		s.set("B2", "erased");
+		s.erase("B2");
+		s.set("C1", "=B1 +");
+		s.insert_rows(1);
+		s.set("A2", "=10");
+		s.set("D1", "undone");
+		s.undo();
+		std::cout << "pending: " << (j.pending() > 0) << std::endl;
+		j.commit();
+		std::cout << "pending: " << j.pending() << std::endl;
+
+		std::cout << "ORIGINAL" << std::endl;
+		print(s);
+		std::cout << std::endl;
+	}
+
+	// Torn write at the end of the journal
+	{
+		std::ofstream os(path, std::ios::binary | std::ios::app);
+		os << '\x01' << "torn";
+	}
+	{
+		journal j(path);
+		spreadsheet s(functions);
+		std::cout << "TORN: " << j.replay(s) << std::endl;
+	}
+
+	// Damaged length of the last record, it would not fit in the file
+	{
+		std::ofstream os(path, std::ios::binary | std::ios::app);
+		os << '\x01' << std::string(8, '\0') << "\xff\xff\xff\xff";
+	}
+
+	{
+		journal j(path);
+		spreadsheet s(functions);
+		std::cout << "REPLAYED: " << j.replay(s) << std::endl;
+		print(s);
+		std::cout << std::endl;
+
+		s.attach_journal(&j);
+		s.set("E1", "=A1 + 100");
+		j.compact(s);
+		s.set("E2", "after checkpoint");
+		j.commit();
+	}
+
+	{
+		journal j(path);
+		spreadsheet s(functions);
+		std::cout << "COMPACTED: " << j.replay(s) << std::endl;
+		print(s);
+	}
+
+	std::remove(path);
+
+	// Write failing after part of the record, file size is limited
+	{
+		std::remove(path);
+		journal j(path);
+		spreadsheet s(functions);
+		s.attach_journal(&j);
+		s.set("A1", "before");
+		j.commit();
+
+		struct rlimit original;
+		::getrlimit(RLIMIT_FSIZE, &original);
+		struct rlimit limited = original;
+		limited.rlim_cur = 64;
+		::setrlimit(RLIMIT_FSIZE, &limited);
+		s.set("A2", std::string(100, 'x'));
+		try {
+			j.commit();
+		} catch (const std::runtime_error &e) {
+			std::cout << "FAILED COMMIT" << std::endl;
+		}
+		std::cout << "pending: " << (j.pending() > 0) << std::endl;
+		::setrlimit(RLIMIT_FSIZE, &original);
+
+		s.set("A3", "after");
+		j.commit();
+		std::cout << "pending: " << j.pending() << std::endl;
+	}
+	{
+		journal j(path);
+		spreadsheet s(functions);
+		std::cout << "RETRIED: " << j.replay(s) << std::endl;
+		for (const cellindex &i : s.non_empty_cells()) {
+			std::cout << i << ": " << s.get(i).size() << std::endl;
+		}
+	}
+
+	try {
+		std::ofstream(path) << "not journal";
+		journal j(path);
+	} catch (const std::runtime_error &e) {
+		std::cout << e.what() << std::endl;
+	}
+	std::remove(path);
+
+	for (auto &p : functions) {
+		delete p.second;
+	}
+}
+
+int main() {
+	// Writes over the file size limit fail instead of killing the process.
+	::signal(SIGXFSZ, SIG_IGN);
+	test();
+	return 0;
+}
@@ -0,0 +1,95 @@
+#include "spreadsheet.hh"
+#include "functions.hh"
+
+#include <iostream>
+
+void test() {
+	functionmap functions;
+	functions["+"] = new plus_function();
+	functions["-"] = new minus_function();
+	functions["*"] = new mul_function();
+	functions["/"] = new div_function();
+	functions["SUM"] = new plus_function();
+	functions["AVG"] = new avg_function();
+
+	spreadsheet s(functions, true);
+
+	s.set("A2", "A2");
+	s.set("Z1", "Z1");
+
+	s.set("B1", "=1+2*3");
+	s.set("B2", "=B1 + 3");
+	s.set("B3", "=B1 * B2");
+	s.set("B4", "=SUM(B1, B2, B3)");
+	s.set("B5", "=AVG(B2, 10 + 2 * 5, SUM(B2, 0))");
+	s.set("B6", "3");
+
+	s.set("C1", "=C2");
+	s.set("C2", "=D1 + 1");
+
+	s.set("D1", "=B1 + ");
+	s.set("D2", "=FOO(1,1)");
+	s.set("D3", "=#");
+	s.set("D4", "=SUM(1,1");
+
+	// Only what is needed is compiled
+	std::cout << "B4: " << s.evaluate("B4") << std::endl;
+	std::cout << std::endl;
+
+	std::cout << "ALL" << std::endl;
+	for (const cellindex &i : s.non_empty_cells()) {
+		std::cout << i << ": " << s.evaluate(i) << std::endl;
+	}
+	std::cout << std::endl;
+
+	// Overwriting formula drops the compiled one
+	s.set("B1", "=2");
+	s.set("D1", "=B1 + 1");
+
+	std::cout << "CHANGED" << std::endl;
+	for (const cellindex &i : s.non_empty_cells()) {
+		std::cout << i << ": " << s.evaluate(i) << std::endl;
+	}
+
+	std::cout << std::endl;
+
+	// References of lazy formulas are known to the reference graph
+	std::cout << "CYCLE" << std::endl;
+	s.set("E1", "=E2 + 1");
+	s.set("E2", "=E1 + 1");
+	s.set("E3", "=E2 + ");
+	std::cout << "E1: " << (s.circular("E1") ? "circular" : "-") << std::endl;
+	std::cout << "E2: " << (s.circular("E2") ? "circular" : "-") << std::endl;
+	std::cout << "E3: " << (s.circular("E3") ? "circular" : "-") << std::endl;
+	s.set("E2", "1");
+	std::cout << "E1: " << (s.circular("E1") ? "circular" : "-") << std::endl;
+	std::cout << std::endl;
+
+	// Range evaluates the precedents in topological order, without recursing down the chain
+	std::cout << "RANGE" << std::endl;
+	const unsigned int length = 20000;
+	for (unsigned int k = length; k > 1; k--) {
+		s.set(cellindex(5, k - 1), "=F" + to_string(k - 1) + "+1");
+	}
+	s.set("F1", "1");
+	std::vector<std::string> values = s.evaluate_range(cellindex(5, length - 2), cellindex(5, length - 1));
+	for (const std::string &v : values) {
+		std::cout << v << std::endl;
+	}
+
+	for (auto &p : functions) {
+		delete p.second;
+	}
+}
+
+int main() {
+	try {
+		test();
+	} catch (const std::exception &e) {
+		std::cout << "FATAL: " << e.what() << std::endl;
+		return 1;
+	} catch (...) {
+		std::cout << "CATCHED SOMETHING" << std::endl;
+		return 1;
+	}
+}
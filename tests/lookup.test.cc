@@ -0,0 +1,103 @@
+#include "spreadsheet.hh"
+#include "functions.hh"
+#include "lookup.hh"
+
+#include <iostream>
+
+void show(const spreadsheet &s, const char *cell) {
+	std::cout << cell << ": " << s.get(cell) << " = " << s.evaluate(cell) << std::endl;
+}
+
+void test() {
+	functionmap functions;
+	functions["+"] = new plus_function();
+	functions["-"] = new minus_function();
+	functions["*"] = new mul_function();
+	functions["VLOOKUP"] = new vlookup_function();
+	functions["MATCH"] = new match_function();
+	functions["INDEX"] = new index_function();
+
+	spreadsheet s(functions);
+
+	// Table of keys and prices, keys unsorted
+	s.set("A1", "30");
+	s.set("B1", "3.5");
+	s.set("A2", "10");
+	s.set("B2", "1.5");
+	s.set("A3", "=10 + 10");
+	s.set("B3", "2.5");
+	s.set("A4", "text");
+	s.set("B4", "4.5");
+	s.set("A5", "10");
+	s.set("B5", "9.5");
+
+	s.set("D1", "=VLOOKUP(20, A1:B5, 2, 0)");
+	s.set("D2", "=VLOOKUP(25, B5:A1, 2)");
+	s.set("D3", "=VLOOKUP(5, A1:B5, 2)");
+	s.set("D4", "=MATCH(10, A1:A5, 0)");
+	s.set("D5", "=MATCH(25, A1:A5, 0 - 1)");
+	s.set("D6", "=INDEX(A1:B5, 3, 2) * 2");
+	s.set("D7", "=INDEX(A2:B2, 2)");
+	s.set("D8", "=MATCH(1, A1:B5)");
+	s.set("D9", "=VLOOKUP(10, A1, 1)");
+	s.set("D10", "=INDEX(A1:B5, 6)");
+	s.set("D11", "=A1:B2");
+
+	std::cout << "LOOKUPS" << std::endl;
+	for (const char *cell : {"D1", "D2", "D3", "D4", "D5", "D6", "D7", "D8", "D9", "D10", "D11"}) {
+		show(s, cell);
+	}
+	std::cout << std::endl;
+
+	// Changing key cell rebuilds the index
+	s.set("A2", "20");
+	std::cout << "CHANGED" << std::endl;
+	show(s, "D1");
+	show(s, "D4");
+	std::cout << std::endl;
+
+	// Error cell is reached by the lookups which don't find the value before it
+	s.set("G1", "1");
+	s.set("G2", "=INDEX(A1:A2, 9)");
+	s.set("G3", "3");
+	s.set("G4", "2");
+	s.set("H1", "=MATCH(1, G1:G4, 0)");
+	s.set("H2", "=MATCH(3, G1:G4, 0)");
+	s.set("H3", "=MATCH(7, G1:G4, 0)");
+	s.set("H4", "=MATCH(2, G1:G4)");
+	s.set("H5", "=VLOOKUP(1, G1:G4, 1, 0)");
+	std::cout << "ERRORS" << std::endl;
+	for (const char *cell : {"H1", "H2", "H3", "H4", "H5"}) {
+		show(s, cell);
+	}
+	std::cout << std::endl;
+
+	// Lookup of its own column is circular
+	s.set("A6", "=MATCH(30, A1:A6, 0)");
+	std::cout << "CIRCULAR" << std::endl;
+	show(s, "A6");
+	std::cout << std::endl;
+
+	// Ranges shift with rows and columns
+	s.insert_rows(2);
+	s.insert_cols(0);
+	s.delete_rows(4, 1);
+	std::cout << "SHIFTED" << std::endl;
+	show(s, "E1");
+	show(s, "E5");
+	show(s, "E10");
+	std::cout << std::endl;
+
+	s.delete_cols(1, 2);
+	std::cout << "DELETED" << std::endl;
+	show(s, "C1");
+}
+
+int main() {
+	try {
+		test();
+	} catch (const std::exception &e) {
+		std::cout << "exception: " << e.what() << std::endl;
+	}
+	return 0;
+}
@@ -0,0 +1,83 @@
+#include "spreadsheet.hh"
+#include "functions.hh"
+
+#include <iostream>
+#include <sstream>
+
+const char *yes(bool b) {
+	return b ? "yes" : "no";
+}
+
+void test() {
+	functionmap functions;
+	functions["+"] = new plus_function();
+	functions["*"] = new mul_function();
+
+	spreadsheet s(functions);
+	memory_report empty = s.memory_usage();
+	std::cout << "EMPTY" << std::endl;
+	std::cout << "inputs: " << empty.inputs << std::endl;
+	std::cout << "formulas: " << empty.formulas << std::endl;
+	std::cout << "regions: " << empty.regions << std::endl;
+	std::cout << std::endl;
+
+	for (int k = 1; k <= 100; k++) {
+		std::string row = to_string(k);
+		s.set("A" + row, row);
+		s.set("B" + row, "=A" + row + " * 2 + A" + row);
+		s.set("C" + row, "=A" + row + " +");
+	}
+	s.set("D1", "some text which is too long to fit into the string object");
+
+	memory_report filled = s.memory_usage();
+	std::cout << "FILLED" << std::endl;
+	std::cout << "inputs: " << yes(filled.inputs > 0) << std::endl;
+	std::cout << "formulas: " << yes(filled.formulas >= 200 * sizeof(double)) << std::endl;
+	std::cout << "tables: " << yes(filled.tables > 400 * sizeof(cellindex)) << std::endl;
+	std::cout << "syntax errors: " << yes(filled.syntax_errors > 0) << std::endl;
+	std::cout << "values: " << yes(filled.values < empty.values + 100) << std::endl;
+	std::cout << std::endl;
+
+	s.calculate();
+	memory_report evaluated = s.memory_usage();
+	std::cout << "EVALUATED" << std::endl;
+	std::cout << "values: " << yes(evaluated.values > 0) << std::endl;
+	std::cout << "cells unchanged: " << yes(evaluated.formulas == filled.formulas && evaluated.tables == filled.tables) << std::endl;
+	std::cout << std::endl;
+
+	// Compressed region is much smaller than the numbers
+	std::vector<double> values;
+	for (int k = 0; k < 100000; k++) {
+		values.push_back(k % 1000 == 0 ? 1.5 : 7);
+	}
+	s.load_column(5, 0, values);
+	memory_report loaded = s.memory_usage();
+	std::cout << "LOADED" << std::endl;
+	std::cout << "regions: " << loaded.region_details.size() << std::endl;
+	std::cout << "first: " << loaded.region_details[0].first << " rows: " << loaded.region_details[0].rows << std::endl;
+	std::cout << "compressed: " << yes(loaded.regions < values.size() * sizeof(double) / 10) << std::endl;
+	std::cout << "history not counted: " << loaded.history << std::endl;
+	std::cout << std::endl;
+
+	// Undo versions share most of the cells
+	s.set_undo_limit(1);
+	s.set("A1", "5");
+	memory_report history = s.memory_usage(true);
+	std::cout << "HISTORY" << std::endl;
+	std::cout << "history: " << yes(history.history > 0) << std::endl;
+	std::cout << "shared: " << yes(history.history < loaded.tables / 2) << std::endl;
+	std::cout << "total: " << yes(history.total() > history.history + history.regions) << std::endl;
+
+	std::ostringstream json;
+	history.write_json(json);
+	std::cout << "json: " << yes(json.str().find("\"region_details\":[{\"first\":\"F1\",\"rows\":100000,") != std::string::npos) << std::endl;
+}
+
+int main() {
+	try {
+		test();
+	} catch (const std::exception &e) {
+		std::cout << "exception: " << e.what() << std::endl;
+	}
+	return 0;
+}
@@ -0,0 +1,119 @@
+#include "spreadsheet.hh"
+#include "functions.hh"
+
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+#include <string>
+
+static const char *path = "tests/paging.tmp";
+
+static const unsigned int rows = 200000;
+static const unsigned int cols = 4;
+
+/** Values without runs or few distinct values, so they are stored raw. */
+static double value(unsigned int col, unsigned int row) {
+	return ((row + 1) * 2654435761u % 1000003u + col) / 8.0;
+}
+
+static std::string yes(bool b) {
+	return b ? "yes" : "no";
+}
+
+/** Check every 997th row of every column through evaluation. */
+static bool check(const spreadsheet &s, unsigned int shift) {
+	for (unsigned int col = 0; col < cols; col++) {
+		for (unsigned int row = 0; row < rows; row += 997) {
+			if (s.evaluate(cellindex(col, row + shift)) != to_string(value(col, row))) {
+				return false;
+			}
+		}
+	}
+	return true;
+}
+
+void test() {
+	functionmap functions;
+	functions["+"] = new plus_function();
+
+	spreadsheet s(functions);
+	const std::size_t budget = 2 * rows * sizeof(double) - 1;
+
+	// Existing file is not overwritten by the backing file
+	std::ofstream(path) << "kept";
+	s.enable_paging(path, budget);
+	std::string kept;
+	std::ifstream(path) >> kept;
+	std::cout << "existing: " << kept << std::endl;
+
+	for (unsigned int col = 0; col < cols; col++) {
+		std::vector<double> values;
+		for (unsigned int row = 0; row < rows; row++) {
+			values.push_back(value(col, row));
+		}
+		s.load_column(col, 0, values);
+	}
+	const page_file &pages = *s.pages();
+	std::cout << "nothing resident: " << yes(pages.resident() == 0) << std::endl;
+
+	std::cout << "values: " << yes(check(s, 0)) << std::endl;
+	std::cout << "within budget: " << yes(pages.resident() <= budget) << std::endl;
+	std::cout << "paged out: " << yes(pages.page_outs() > 0) << std::endl;
+
+	std::cout << "HOT" << std::endl;
+	for (unsigned int row = 0; row < rows; row += 1000) {
+		s.evaluate(cellindex(0, row));
+	}
+	std::size_t page_ins = pages.page_ins();
+	for (unsigned int row = 500; row < rows; row += 1000) {
+		s.evaluate(cellindex(0, row));
+	}
+	std::cout << "no page ins: " << yes(pages.page_ins() == page_ins) << std::endl;
+
+	std::cout << "MEMORY" << std::endl;
+	memory_report report = s.memory_usage();
+	std::cout << "regions in memory small: " << yes(report.regions < rows) << std::endl;
+	std::cout << "pages counted: " << yes(report.pages == pages.resident()) << std::endl;
+
+	std::cout << "SHIFT" << std::endl;
+	std::size_t file_size = pages.file_size();
+	s.insert_rows(0, 3);
+	std::cout << "values: " << yes(check(s, 3)) << std::endl;
+	std::cout << "tiles shared: " << yes(pages.file_size() == file_size) << std::endl;
+
+	std::cout << "SPLIT" << std::endl;
+	s.set("B1000", "=A1000+1");
+	std::cout << "B1000: " << yes(s.evaluate("B1000") == to_string(value(0, 996) + 1)) << std::endl;
+	std::cout << "B999: " << yes(s.evaluate("B999") == to_string(value(1, 995))) << std::endl;
+	std::cout << "B1001: " << yes(s.evaluate("B1001") == to_string(value(1, 997))) << std::endl;
+
+	std::cout << "SCAN" << std::endl;
+	std::size_t count = 0;
+	s.for_each_value([&count](const cellindex &i, const std::string &v) {
+		count++;
+	});
+	std::cout << "cells: " << count << std::endl;
+	std::cout << "within budget: " << yes(pages.resident() <= budget) << std::endl;
+
+	std::cout << "SNAPSHOT" << std::endl;
+	snapshot snap = s.take_snapshot();
+	s.set_undo_limit(0);
+	std::cout << "D5: " << yes(snap.evaluate("D5") == to_string(value(3, 1))) << std::endl;
+
+	for (auto &p : functions) {
+		delete p.second;
+	}
+}
+
+int main() {
+	try {
+		test();
+	} catch (const std::exception &e) {
+		std::cout << "FATAL: " << e.what() << std::endl;
+		return 1;
+	} catch (...) {
+		std::cout << "CATCHED SOMETHING" << std::endl;
+		return 1;
+	}
+	std::remove(path);
+}
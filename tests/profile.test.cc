@@ -0,0 +1,107 @@
+#include "spreadsheet.hh"
+#include "functions.hh"
+#include "profiler.hh"
+
+#include <chrono>
+#include <iostream>
+#include <sstream>
+
+/** Busy wait, so the cell calling it is the most expensive one. */
+double slow(double x) {
+	auto end = std::chrono::steady_clock::now() + std::chrono::milliseconds(20);
+	while (std::chrono::steady_clock::now() < end) {
+	}
+	return x;
+}
+
+static const char *yes(bool b) {
+	return b ? "yes" : "no";
+}
+
+void test() {
+	functionmap functions;
+	functions["+"] = new plus_function();
+	functions["SLOW"] = new lifted_unary_function("SLOW", slow);
+
+	spreadsheet s(functions);
+	s.set("A1", "=SLOW(1)");
+	s.set("A2", "=A1 + 1");
+	s.set("A3", "=A2 + 1");
+	s.set("B1", "=2 + 3");
+	s.enable_profiling();
+	std::cout << "A3: " << s.evaluate("A3") << std::endl;
+	std::cout << "B1: " << s.evaluate("B1") << std::endl;
+
+	// Exclusive time of a cell does not include its precedents, inclusive does
+	const profiler &p = *s.profile();
+	std::vector<std::pair<cellindex, cell_profile> > cells = p.top(4);
+	std::cout << "CHAIN" << std::endl;
+	std::cout << "cells: " << cells.size() << std::endl;
+	std::cout << "top: " << cells[0].first << std::endl;
+	std::map<cellindex, cell_profile> profiles(cells.begin(), cells.end());
+	const cell_profile &a1 = profiles[cellindex("A1")];
+	const cell_profile &a2 = profiles[cellindex("A2")];
+	const cell_profile &a3 = profiles[cellindex("A3")];
+	std::cout << "A1 evaluations: " << a1.evaluations << std::endl;
+	std::cout << "A1 exclusive is inclusive: " << yes(a1.exclusive == a1.inclusive) << std::endl;
+	std::cout << "A3 inclusive over A1: " << yes(a3.inclusive >= a2.inclusive && a2.inclusive >= a1.inclusive) << std::endl;
+	std::cout << "A3 exclusive under A1: " << yes(a3.exclusive < a1.exclusive && a2.exclusive < a1.exclusive) << std::endl;
+
+	double cost;
+	std::vector<cellindex> path = p.critical_path(cost);
+	std::cout << "critical path:";
+	for (const cellindex &i : path) {
+		std::cout << " " << i;
+	}
+	std::cout << std::endl;
+	std::cout << "cost over A1: " << yes(cost >= a1.exclusive) << std::endl;
+	std::cout << std::endl;
+
+	// Recorded directly, times are exact
+	profiler q;
+	q.record(cellindex("A1"), 10, 10);
+	q.record(cellindex("A2"), 15, 5);
+	q.dependency(cellindex("A2"), cellindex("A1"));
+	q.record(cellindex("B1"), 8, 8);
+	q.record(cellindex("B2"), 9, 1);
+	q.dependency(cellindex("B2"), cellindex("B1"));
+	q.record(cellindex("C1"), 2, 2);
+	q.record(cellindex("C1"), 2, 2);
+
+	std::cout << "RECORDED" << std::endl;
+	for (auto &c : q.top(4)) {
+		std::cout << c.first << ": " << c.second.exclusive << " " << c.second.inclusive << " " << c.second.evaluations << std::endl;
+	}
+	path = q.critical_path(cost);
+	std::cout << "critical path:";
+	for (const cellindex &i : path) {
+		std::cout << " " << i;
+	}
+	std::cout << " cost: " << cost << std::endl;
+
+	std::ostringstream json;
+	q.write_json(json, 2);
+	std::cout << json.str() << std::endl;
+
+	q.clear();
+	std::cout << "cleared: " << q.top(3).size() << std::endl;
+
+	s.disable_profiling();
+	std::cout << "disabled: " << yes(s.profile() == nullptr) << std::endl;
+
+	for (auto &f : functions) {
+		delete f.second;
+	}
+}
+
+int main() {
+	try {
+		test();
+	} catch (const std::exception &e) {
+		std::cout << "FATAL: " << e.what() << std::endl;
+		return 1;
+	} catch (...) {
+		std::cout << "CATCHED SOMETHING" << std::endl;
+		return 1;
+	}
+}
@@ -0,0 +1,154 @@
+#include "spreadsheet.hh"
+#include "functions.hh"
+#include "journal.hh"
+
+#include <cmath>
+#include <cstdio>
+#include <iostream>
+
+void print(const spreadsheet &s) {
+	s.for_each_value([&](const cellindex &i, const std::string &value) {
+		std::cout << i << ": " << s.get(i) << " = " << value << std::endl;
+	});
+}
+
+void test() {
+	functionmap functions;
+	functions["+"] = new plus_function();
+	functions["*"] = new mul_function();
+
+	spreadsheet s(functions);
+
+	// Runs, sequences, dictionary codes and raw values
+	std::vector<double> values;
+	for (int k = 0; k < 6; k++) values.push_back(0);
+	for (int k = 0; k < 5; k++) values.push_back(10 + 2 * k);
+	values.push_back(0.1);
+	values.push_back(7);
+	values.push_back(0.1);
+	values.push_back(1e300);
+
+	s.set("A1", "text");
+	s.set("B5", "=A5 + A13");
+	s.set("B6", "=A20");
+	s.set("C1", "=B5 * 2");
+	s.load_column(0, 1, values);
+
+	std::cout << "LOADED" << std::endl;
+	print(s);
+	std::cout << std::endl;
+
+	// Editing region splits it
+	s.set("A8", "=A7 + 100");
+	s.erase("A3");
+	std::cout << "EDITED" << std::endl;
+	std::cout << "A2: " << s.evaluate("A2") << std::endl;
+	std::cout << "A3: '" << s.get("A3") << "'" << std::endl;
+	std::cout << "A8: " << s.evaluate("A8") << std::endl;
+	std::cout << "A9: " << s.evaluate("A9") << std::endl;
+	std::cout << std::endl;
+
+	// Shifting moves regions, and references to them
+	s.insert_rows(4, 2);
+	s.delete_rows(10, 1);
+	s.insert_cols(0);
+	std::cout << "SHIFTED" << std::endl;
+	print(s);
+	std::cout << std::endl;
+
+	// Undo of the whole load
+	s.undo();
+	s.undo();
+	s.undo();
+	s.undo();
+	s.undo();
+	s.undo();
+	std::cout << "UNDONE" << std::endl;
+	print(s);
+	std::cout << std::endl;
+
+	// Journal keeps regions
+	const char *path = "tests/region.tmp";
+	std::remove(path);
+	{
+		journal j(path);
+		spreadsheet t(functions);
+		t.attach_journal(&j);
+		t.set("B1", "=1 +");
+		t.load_column(0, 0, values);
+		t.set("A2", "=A1 + 1");
+		t.undo();
+		t.redo();
+		j.commit();
+	}
+	{
+		journal j(path);
+		spreadsheet t(functions);
+		std::cout << "REPLAYED: " << j.replay(t) << std::endl;
+		std::cout << "A1: " << t.evaluate("A1") << std::endl;
+		std::cout << "A2: " << t.get("A2") << " = " << t.evaluate("A2") << std::endl;
+		std::cout << "A3: " << t.evaluate("A3") << std::endl;
+		std::cout << "A15: " << t.evaluate("A15") << std::endl;
+		j.compact(t);
+	}
+	{
+		journal j(path);
+		spreadsheet t(functions);
+		std::cout << "COMPACTED: " << j.replay(t) << std::endl;
+		std::cout << "A3: " << t.evaluate("A3") << std::endl;
+		std::cout << "A15: " << t.evaluate("A15") << std::endl;
+	}
+	std::remove(path);
+
+	// Undone load is journaled as unload before the cell it replaced
+	{
+		journal j(path);
+		spreadsheet t(functions);
+		t.attach_journal(&j);
+		t.set("A1", "5");
+		t.load_column(0, 0, values);
+		t.undo();
+		j.commit();
+		std::cout << "UNDONE LOAD: " << t.non_empty_cells().size() << std::endl;
+	}
+	{
+		journal j(path);
+		spreadsheet t(functions);
+		j.replay(t);
+		std::cout << "REPLAYED: " << t.non_empty_cells().size() << std::endl;
+		std::cout << "A1: " << t.get("A1") << std::endl;
+		std::cout << "A2: '" << t.get("A2") << "'" << std::endl;
+	}
+	std::remove(path);
+
+	// Compression
+	std::vector<double> big;
+	for (int k = 0; k < 100000; k++) {
+		big.push_back(k % 1000 == 0 ? 1 : 0);
+	}
+	constant_region r(0, 0, big);
+	std::cout << "less than byte per value: " << (r.memory_usage() < big.size()) << std::endl;
+	std::cout << "sum: " << r.sum() << std::endl;
+	std::cout << "slice: " << r.slice(500, 1000, 1, 0)->sum() << std::endl;
+
+	// Signs of zeros are kept
+	std::vector<double> zeros;
+	for (int k = 0; k < 8; k++) {
+		zeros.push_back(k % 2 == 0 ? 0.0 : -0.0);
+	}
+	constant_region z(0, 0, zeros);
+	std::cout << "signs:";
+	for (double d : z.values()) {
+		std::cout << " " << (std::signbit(d) ? "-" : "+");
+	}
+	std::cout << std::endl;
+
+	for (auto &p : functions) {
+		delete p.second;
+	}
+}
+
+int main() {
+	test();
+	return 0;
+}
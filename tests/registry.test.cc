@@ -0,0 +1,77 @@
+#include "registry.hh"
+#include "functions.hh"
+#include "spreadsheet.hh"
+
+#include <iostream>
+#include <cmath>
+
+void test() {
+	functionmap functions;
+	functions["+"] = new plus_function();
+	functions["-"] = new minus_function();
+	functions["*"] = new mul_function();
+	functions["/"] = new div_function();
+	functions["SUM"] = new plus_function();
+	functions["AVG"] = new avg_function();
+	functions["IF"] = new if_function();
+	functions["SIN"] = new lifted_unary_function("sin", sin);
+
+	function_registry registry(functions);
+
+	std::cout << "FUNCTIONS" << std::endl;
+	for (unsigned int id = 0; id < registry.size(); id++) {
+		const function_traits &traits = registry[id]->traits();
+		std::cout << id << " " << registry.name(id)
+			<< " arity " << traits.min_arity << ".." << (traits.max_arity == function_traits::variadic ? std::string("*") : to_string(traits.max_arity))
+			<< (traits.pure ? " pure" : "")
+			<< (traits.is_volatile ? " volatile" : "")
+			<< " op " << traits.op << std::endl;
+	}
+	std::cout << std::endl;
+
+	std::cout << "LOOKUP" << std::endl;
+	for (const char *name : { "SUM", "sum", "Avg", "if", "COS", "+" }) {
+		unsigned int id = registry.id(name);
+		std::cout << name << ": " << (id == function_registry::npos ? std::string("not found") : to_string(id)) << std::endl;
+	}
+	std::cout << std::endl;
+
+	spreadsheet s(functions);
+	s.set("A1", "=sum(1, 2) * Avg(2, 4)");
+	s.set("A2", "=A1 - 1 - 2");
+	s.set("A3", "=A1 / 2 / 3");
+	s.set("A4", "=if(0, 1, 2)");
+	s.set("A5", "=if(0, 1)");
+	s.set("A6", "=SIN(1, 2)");
+	s.set("A7", "=sum()");
+	std::cout << "EVALUATED" << std::endl;
+	for (const cellindex &i : s.non_empty_cells()) {
+		std::cout << i << ": " << s.evaluate(i) << std::endl;
+	}
+	std::cout << std::endl;
+
+	functionmap duplicates;
+	duplicates["SUM"] = functions["SUM"];
+	duplicates["Sum"] = functions["+"];
+	try {
+		function_registry duplicate_registry(duplicates);
+	} catch (const std::runtime_error &e) {
+		std::cout << "ERROR: " << e.what() << std::endl;
+	}
+
+	for (auto &p : functions) {
+		delete p.second;
+	}
+}
+
+int main() {
+	try {
+		test();
+	} catch (const std::exception &e) {
+		std::cout << "FATAL: " << e.what() << std::endl;
+		return 1;
+	} catch (...) {
+		std::cout << "CATCHED SOMETHING" << std::endl;
+		return 1;
+	}
+}
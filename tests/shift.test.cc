@@ -0,0 +1,81 @@
+#include "spreadsheet.hh"
+#include "functions.hh"
+
+#include <iostream>
+
+void print(const std::string &title, const spreadsheet &s) {
+	std::cout << title << std::endl;
+	for (const cellindex &i : s.non_empty_cells()) {
+		std::cout << i << ": " << s.get(i) << " = " << s.evaluate(i) << std::endl;
+	}
+	std::cout << std::endl;
+}
+
+void test() {
+	functionmap functions;
+	functions["+"] = new plus_function();
+	functions["-"] = new minus_function();
+	functions["*"] = new mul_function();
+	functions["/"] = new div_function();
+	functions["SUM"] = new plus_function();
+	functions["IF"] = new if_function();
+
+	spreadsheet s(functions);
+
+	s.set("A1", "1");
+	s.set("A2", "2");
+	s.set("A3", "=A1 + A2");
+	s.set("A4", "=sum(A1, A2, A3) * 2");
+	s.set("B1", "=A4 - (A3 - A2) - A1");
+	s.set("B2", "=A1 / (A2 * A3) / 0.1");
+	s.set("B3", "=IF(A1, B1, 2)");
+	s.set("B4", "text");
+	s.set("C1", "=A1 +");
+	s.set("C2", "=(A1 + A2) * A3");
+
+	print("INITIAL", s);
+
+	s.insert_rows(1, 2);
+	print("INSERTED ROWS 2-3", s);
+
+	s.delete_rows(1, 2);
+	s.delete_rows(1);
+	print("DELETED ROWS 2-3, THEN ROW 2", s);
+
+	s.insert_cols(0);
+	print("INSERTED COLUMN A", s);
+
+	s.delete_cols(0);
+	s.delete_cols(1);
+	print("DELETED COLUMN A, THEN COLUMN B", s);
+
+	for (int k = 0; k < 6; k++) {
+		s.undo();
+	}
+	print("UNDONE", s);
+
+	// Lazy mode compiles formulas to rewrite them, text of syntax errors stays.
+	spreadsheet l(functions, true);
+	l.set("A1", "1");
+	l.set("A2", "=A1 * 2");
+	l.set("A3", "=A2 + ");
+	l.set("A4", "=A3");
+	l.insert_rows(0);
+	print("LAZY", l);
+
+	for (auto &p : functions) {
+		delete p.second;
+	}
+}
+
+int main() {
+	try {
+		test();
+	} catch (const std::exception &e) {
+		std::cout << "FATAL: " << e.what() << std::endl;
+		return 1;
+	} catch (...) {
+		std::cout << "CATCHED SOMETHING" << std::endl;
+		return 1;
+	}
+}
@@ -0,0 +1,99 @@
+#include "spreadsheet.hh"
+#include "functions.hh"
+
+#include <iostream>
+#include <thread>
+
+void print(const std::string &title, const spreadsheet &s) {
+	std::cout << title << std::endl;
+	for (const cellindex &i : s.non_empty_cells()) {
+		std::cout << i << ": " << s.get(i) << " = " << s.evaluate(i) << std::endl;
+	}
+	std::cout << std::endl;
+}
+
+void print(const std::string &title, const snapshot &s) {
+	std::cout << title << std::endl;
+	for (const cellindex &i : s.non_empty_cells()) {
+		std::cout << i << ": " << s.get(i) << " = " << s.evaluate(i) << std::endl;
+	}
+	std::cout << std::endl;
+}
+
+void test() {
+	functionmap functions;
+	functions["+"] = new plus_function();
+	functions["-"] = new minus_function();
+	functions["*"] = new mul_function();
+	functions["/"] = new div_function();
+	functions["SUM"] = new plus_function();
+
+	spreadsheet s(functions);
+
+	s.set("A1", "1");
+	s.set("A2", "2");
+	s.set("A3", "=SUM(A1, A2)");
+	s.set("B1", "=A3 * 2");
+	s.set("B2", "=A3 +");
+
+	snapshot first = s.take_snapshot();
+
+	s.set("A1", "10");
+	s.erase("B2");
+	s.set("C1", "=B1 / 2");
+
+	print("CURRENT", s);
+	print("SNAPSHOT", first);
+
+	// Reader evaluates the snapshot while writer modifies the spreadsheet
+	snapshot second = s.take_snapshot();
+	std::string reader_result;
+	std::thread reader([&]() {
+		for (int k = 0; k < 1000; k++) {
+			reader_result = second.evaluate("C1");
+		}
+	});
+	for (unsigned int row = 1; row < 1000; row++) {
+		s.set(cellindex(0, 0), to_string(row));
+	}
+	reader.join();
+	std::cout << "READER C1: " << reader_result << std::endl;
+	std::cout << "CURRENT C1: " << s.evaluate("C1") << std::endl;
+	std::cout << std::endl;
+
+	// Undo history
+	s.set_undo_limit(3);
+	s.set("A2", "20");
+	s.set("A2", "200");
+	print("BEFORE UNDO", s);
+
+	while (s.undo()) {
+		std::cout << "UNDO A1: " << s.get("A1") << " A2: " << s.get("A2") << " C1: " << s.evaluate("C1") << std::endl;
+	}
+	s.redo();
+	s.redo();
+	std::cout << "REDO A1: " << s.get("A1") << " A2: " << s.get("A2") << " C1: " << s.evaluate("C1") << std::endl;
+
+	// New modification forgets undone versions
+	s.set("A2", "0");
+	std::cout << "CAN REDO: " << (s.redo() ? "yes" : "no") << std::endl;
+	std::cout << std::endl;
+
+	print("SNAPSHOT", first);
+
+	for (auto &p : functions) {
+		delete p.second;
+	}
+}
+
+int main() {
+	try {
+		test();
+	} catch (const std::exception &e) {
+		std::cout << "FATAL: " << e.what() << std::endl;
+		return 1;
+	} catch (...) {
+		std::cout << "CATCHED SOMETHING" << std::endl;
+		return 1;
+	}
+}
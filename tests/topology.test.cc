@@ -0,0 +1,87 @@
+#include "spreadsheet.hh"
+#include "functions.hh"
+
+#include <iostream>
+
+void print_circular(const spreadsheet &s, const std::vector<std::string> &cells) {
+	for (const std::string &c : cells) {
+		std::cout << c << (s.circular(c) ? ": circular" : ": -") << std::endl;
+	}
+}
+
+void test() {
+	functionmap functions;
+	functions["+"] = new plus_function();
+	functions["IF"] = new if_function();
+
+	spreadsheet s(functions);
+
+	std::cout << "SET" << std::endl;
+	s.set("A1", "=A2");
+	s.set("A2", "=A1");
+	print_circular(s, {"A1", "A2"});
+	std::cout << "A1 = " << s.evaluate("A1") << std::endl;
+
+	std::cout << "BREAK" << std::endl;
+	s.set("A2", "5");
+	print_circular(s, {"A1", "A2"});
+	std::cout << "A1 = " << s.evaluate("A1") << std::endl;
+
+	std::cout << "UNDO" << std::endl;
+	s.undo();
+	print_circular(s, {"A1", "A2"});
+	s.redo();
+	print_circular(s, {"A1", "A2"});
+
+	std::cout << "TWO CYCLES" << std::endl;
+	s.set("B1", "=B2");
+	s.set("B2", "=B3");
+	s.set("B3", "=B1+B4");
+	s.set("B4", "=B2");
+	print_circular(s, {"B1", "B2", "B3", "B4"});
+	s.set("B4", "1");
+	print_circular(s, {"B1", "B2", "B3", "B4"});
+	s.set("B3", "=B4");
+	print_circular(s, {"B1", "B2", "B3", "B4"});
+	std::cout << "B1 = " << s.evaluate("B1") << std::endl;
+
+	std::cout << "IF" << std::endl;
+	s.set("D1", "=IF(0,D1,1)");
+	print_circular(s, {"D1"});
+	std::cout << "D1 = " << s.evaluate("D1") << std::endl;
+
+	std::cout << "SHIFT" << std::endl;
+	s.set("C1", "=C2");
+	s.set("C2", "=C1");
+	s.insert_rows(1);
+	print_circular(s, {"C1", "C2", "C3"});
+	s.erase("C3");
+	print_circular(s, {"C1", "C3"});
+
+	std::cout << "CHAIN" << std::endl;
+	// set from the end, every reference is against the order of the cells set so far
+	const unsigned int length = 20000;
+	for (unsigned int k = length; k > 1; k--) {
+		s.set(cellindex(5, k - 1), "=F" + to_string(k - 1) + "+1");
+	}
+	s.set("F1", "1");
+	std::cout << "pending: " << s.calculate() << std::endl;
+	std::cout << "F" << length << " = " << s.evaluate(cellindex(5, length - 1)) << std::endl;
+	std::cout << "circular: " << (s.circular(cellindex(5, length - 1)) ? "yes" : "no") << std::endl;
+
+	for (auto &p : functions) {
+		delete p.second;
+	}
+}
+
+int main() {
+	try {
+		test();
+	} catch (const std::exception &e) {
+		std::cout << "FATAL: " << e.what() << std::endl;
+		return 1;
+	} catch (...) {
+		std::cout << "CATCHED SOMETHING" << std::endl;
+		return 1;
+	}
+}
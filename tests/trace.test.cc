@@ -0,0 +1,114 @@
+#include "spreadsheet.hh"
+#include "functions.hh"
+#include "trace.hh"
+
+#include <iostream>
+#include <set>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+/** Count of spans with the name. */
+static unsigned int count(const std::vector<trace_event> &events, const std::string &name) {
+	unsigned int ret = 0;
+	for (const trace_event &e : events) {
+		ret += name == e.name;
+	}
+	return ret;
+}
+
+/** Span with the name which is within other span with the name, on the same thread. */
+static bool nested(const std::vector<trace_event> &events, const std::string &inner, const std::string &outer) {
+	for (const trace_event &i : events) {
+		for (const trace_event &o : events) {
+			if (inner == i.name && outer == o.name && i.thread == o.thread
+				&& i.begin >= o.begin && i.begin + i.duration <= o.begin + o.duration) {
+				return true;
+			}
+		}
+	}
+	return false;
+}
+
+void test() {
+	functionmap functions;
+	functions["+"] = new plus_function();
+
+	spreadsheet s(functions);
+	tracer t;
+	s.set_tracer(&t);
+
+	s.set("A1", "1");
+	std::cout << "disabled: " << t.events().size() << std::endl;
+
+	t.enable();
+	s.set("A2", "=A1+1");
+	s.set("A3", "=A2+1");
+	std::cout << "A3: " << s.evaluate("A3") << std::endl;
+
+	std::vector<trace_event> events = t.events();
+	const char *names[] = { "set", "parse", "invalidate", "references", "evaluate", "cell", "format" };
+	for (const char *name : names) {
+		std::cout << name << ": " << count(events, name) << std::endl;
+	}
+	std::cout << "parse in set: " << nested(events, "parse", "set") << std::endl;
+	std::cout << "cell in evaluate: " << nested(events, "cell", "evaluate") << std::endl;
+	std::cout << "dropped: " << t.dropped() << std::endl;
+
+	bool ordered = true;
+	for (std::size_t k = 1; k < events.size(); k++) {
+		ordered = ordered && events[k - 1].begin <= events[k].begin;
+	}
+	std::cout << "ordered: " << ordered << std::endl;
+
+	std::ostringstream json;
+	t.write_json(json);
+	std::cout << "json: " << json.str().substr(0, 16) << std::endl;
+	std::cout << "json cell: " << (json.str().find("\"args\":{\"cell\":\"A3\"}") != std::string::npos) << std::endl;
+
+	s.set_tracer(nullptr);
+	t.clear();
+	s.set("A4", "2");
+	std::cout << "detached: " << t.events().size() << std::endl;
+
+	// Small ring overwrites the oldest spans
+	tracer small(16);
+	small.enable();
+	for (unsigned int k = 0; k < 100; k++) {
+		trace_scope ts(&small, "span");
+	}
+	std::cout << "small: " << small.events().size() << " dropped: " << small.dropped() << std::endl;
+
+	// Threads record concurrently, each with its own id
+	tracer shared(1024);
+	shared.enable();
+	std::vector<std::thread> threads;
+	for (unsigned int k = 0; k < 4; k++) {
+		threads.push_back(std::thread([&shared]() {
+			for (unsigned int n = 0; n < 100; n++) {
+				trace_scope ts(&shared, "work");
+			}
+		}));
+	}
+	for (std::thread &th : threads) {
+		th.join();
+	}
+	std::set<unsigned int> ids;
+	for (const trace_event &e : shared.events()) {
+		ids.insert(e.thread);
+	}
+	std::cout << "threads: " << ids.size() << " spans: " << shared.events().size() << std::endl;
+}
+
+int main() {
+	try {
+		test();
+	} catch (const std::exception &e) {
+		std::cout << "FATAL: " << e.what() << std::endl;
+		return 1;
+	} catch (...) {
+		std::cout << "CATCHED SOMETHING" << std::endl;
+		return 1;
+	}
+}
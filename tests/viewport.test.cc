@@ -0,0 +1,73 @@
+#include "spreadsheet.hh"
+#include "functions.hh"
+
+#include <iostream>
+
+void test() {
+	functionmap functions;
+	functions["+"] = new plus_function();
+	functions["*"] = new mul_function();
+
+	spreadsheet s(functions);
+
+	// Long chain in A, the window shows its end in B
+	const unsigned int length = 20000;
+	s.set("A1", "1");
+	for (unsigned int k = 1; k < length; k++) {
+		s.set(cellindex(0, k), "=A" + to_string(k) + "+1");
+	}
+	for (unsigned int k = length - 5; k < length; k++) {
+		s.set(cellindex(1, k), "=A" + to_string(k + 1) + "*2");
+	}
+	s.set(cellindex(2, length - 4), "text");
+	s.set(cellindex(2, length - 3), "=1+");
+	s.set(cellindex(2, length - 2), "=C" + to_string(length - 1));
+	s.load_column(3, length - 3, std::vector<double>(2, 7));
+
+	// Unrelated formulas, not evaluated for the window
+	for (unsigned int k = 0; k < 100; k++) {
+		s.set(cellindex(4, k), "=" + to_string(k) + "*2");
+	}
+
+	cellindex first(1, length - 5);
+	cellindex last(3, length - 1);
+	std::vector<std::string> values = s.evaluate_range(first, last);
+	std::cout << "stale: " << s.stale_cells().size() << std::endl;
+	for (unsigned int row = first.row; row <= last.row; row++) {
+		for (unsigned int col = first.col; col <= last.col; col++) {
+			std::cout << (col == first.col ? "" : " | ") << values[(row - first.row) * 3 + (col - first.col)];
+		}
+		std::cout << std::endl;
+	}
+
+	// Same values cell by cell, corners in any order
+	std::vector<std::string> swapped = s.evaluate_range(cellindex(3, length - 5), cellindex(1, length - 1));
+	bool same = swapped == values;
+	for (unsigned int row = first.row; row <= last.row; row++) {
+		for (unsigned int col = first.col; col <= last.col; col++) {
+			same = same && s.evaluate(cellindex(col, row)) == values[(row - first.row) * 3 + (col - first.col)];
+		}
+	}
+	std::cout << "same as evaluate: " << (same ? "yes" : "no") << std::endl;
+
+	std::cout << "SNAPSHOT" << std::endl;
+	snapshot snap = s.take_snapshot();
+	std::vector<std::string> small = snap.evaluate_range(cellindex(4, 2), cellindex(4, 3));
+	std::cout << small[0] << " " << small[1] << std::endl;
+
+	for (auto &p : functions) {
+		delete p.second;
+	}
+}
+
+int main() {
+	try {
+		test();
+	} catch (const std::exception &e) {
+		std::cout << "FATAL: " << e.what() << std::endl;
+		return 1;
+	} catch (...) {
+		std::cout << "CATCHED SOMETHING" << std::endl;
+		return 1;
+	}
+}
@@ -0,0 +1,121 @@
+#include "spreadsheet.hh"
+#include "functions.hh"
+#include "lookup.hh"
+
+#include <iostream>
+
+static int clock_ticks = 0;
+static int clock_reads = 0;
+
+double now() {
+	clock_reads++;
+	return clock_ticks;
+}
+
+double twice(double x) {
+	return 2 * x;
+}
+
+void test() {
+	functionmap functions;
+	functions["+"] = new plus_function();
+	functions["*"] = new mul_function();
+	functions["IF"] = new if_function();
+	functions["NOW"] = new lifted_nullary_function("NOW", now, function_traits().set_volatile());
+	functions["TWICE"] = new lifted_unary_function("TWICE", twice);
+
+	spreadsheet s(functions);
+
+	s.set("A1", "=NOW()");
+	s.set("A2", "=A1 + 1");
+	s.set("A3", "=TWICE(A2)");
+	s.set("B1", "=10");
+	s.set("B2", "=B1 * 2");
+	s.set("B3", "=B2 + A3");
+	s.set("C1", "=IF(0, NOW(), 5)");
+
+	std::cout << "FIRST" << std::endl;
+	for (const cellindex &i : s.non_empty_cells()) {
+		std::cout << i << ": " << s.evaluate(i) << std::endl;
+	}
+	std::cout << "reads: " << clock_reads << std::endl;
+	std::cout << std::endl;
+
+	// Only the volatile cell and its dependents are recomputed
+	clock_ticks = 100;
+	std::cout << "TICK" << std::endl;
+	std::cout << "stale: " << s.tick() << std::endl;
+	for (const cellindex &i : s.stale_cells()) {
+		std::cout << i << " ";
+	}
+	std::cout << std::endl;
+	for (const cellindex &i : s.non_empty_cells()) {
+		std::cout << i << ": " << s.evaluate(i) << std::endl;
+	}
+	std::cout << "reads: " << clock_reads << std::endl;
+	std::cout << std::endl;
+
+	// Volatile cells are marked again when evaluated, without evaluation in between tick has nothing to do
+	std::cout << "TICK AGAIN" << std::endl;
+	std::cout << "stale: " << s.tick() << std::endl;
+	std::cout << "stale: " << s.tick() << std::endl;
+	std::cout << std::endl;
+
+	// Taken branch decides whether the cell is volatile
+	s.set("C1", "=IF(1, NOW(), 5)");
+	clock_ticks = 200;
+	std::cout << "CHANGED" << std::endl;
+	std::cout << "C1: " << s.evaluate("C1") << std::endl;
+	std::cout << "B3: " << s.evaluate("B3") << std::endl;
+	clock_ticks = 300;
+	std::cout << "stale: " << s.tick() << std::endl;
+	std::cout << "C1: " << s.evaluate("C1") << std::endl;
+	std::cout << "B3: " << s.evaluate("B3") << std::endl;
+	std::cout << "reads: " << clock_reads << std::endl;
+	std::cout << std::endl;
+
+	// Range precedents reach the cells looking into the range
+	functions["MATCH"] = new match_function();
+	spreadsheet r(functions);
+	for (int k = 1; k <= 100; k++) {
+		std::string row = to_string(k);
+		r.set("A" + row, k == 50 ? "=NOW() * 0 + 50" : row);
+		r.set("B" + row, "=MATCH(" + row + ", A1:A" + row + ", 0)");
+	}
+	r.set("C1", "=MATCH(3, A2:A3, 0) + B100");
+	r.calculate();
+	std::cout << "RANGES" << std::endl;
+	std::cout << "B100: " << r.evaluate("B100") << std::endl;
+	std::cout << "C1: " << r.evaluate("C1") << std::endl;
+	std::cout << "stale: " << r.tick() << std::endl;
+	std::cout << "B49 stale: " << r.stale_cells().count(cellindex("B49")) << std::endl;
+	std::cout << "B50 stale: " << r.stale_cells().count(cellindex("B50")) << std::endl;
+	r.calculate();
+	std::cout << "stale: " << r.tick() << std::endl;
+	std::cout << "C1: " << r.evaluate("C1") << std::endl;
+	std::cout << std::endl;
+
+	// Editing forgets only the cells depending on the edited one, also through ranges
+	r.calculate();
+	r.set("A60", "1");
+	std::cout << "EDITED" << std::endl;
+	std::cout << "stale: " << r.stale_cells().size() << std::endl;
+	std::cout << "B59 stale: " << r.stale_cells().count(cellindex("B59")) << std::endl;
+	std::cout << "B60 stale: " << r.stale_cells().count(cellindex("B60")) << std::endl;
+	std::cout << "B100: " << r.evaluate("B100") << std::endl;
+	std::cout << "C1: " << r.evaluate("C1") << std::endl;
+	r.erase("A1");
+	std::cout << "ERASED" << std::endl;
+	std::cout << "stale: " << r.stale_cells().size() << std::endl;
+	std::cout << "B1: " << r.evaluate("B1") << std::endl;
+	std::cout << "B2: " << r.evaluate("B2") << std::endl;
+
+	for (auto &p : functions) {
+		delete p.second;
+	}
+}
+
+int main() {
+	test();
+	return 0;
+}
@@ -0,0 +1,145 @@
+#include "workbook.hh"
+#include "functions.hh"
+
+#include <iostream>
+
+void print(const workbook &w) {
+	for (const std::string &name : w.sheet_names()) {
+		const spreadsheet *s = w.sheet(name);
+		for (const cellindex &i : s->non_empty_cells()) {
+			std::cout << name << "!" << i << ": " << s->get(i) << " = " << s->evaluate(i) << std::endl;
+		}
+	}
+}
+
+static int clock_ticks = 0;
+
+double now() {
+	return clock_ticks;
+}
+
+void test() {
+	functionmap functions;
+	functions["+"] = new plus_function();
+	functions["-"] = new minus_function();
+	functions["*"] = new mul_function();
+	functions["/"] = new div_function();
+	functions["SUM"] = new plus_function();
+
+	workbook w(functions);
+
+	spreadsheet &inputs = w.add_sheet("Inputs");
+	spreadsheet &calc = w.add_sheet("Calc");
+	spreadsheet &report = w.add_sheet("Report");
+	spreadsheet &other = w.add_sheet("Other");
+
+	inputs.set("A1", "10");
+	inputs.set("A2", "20");
+	calc.set("A1", "=SUM(Inputs!A1, Inputs!A2)");
+	calc.set("A2", "=A1 * inputs!A1");
+	report.set("A1", "=Calc!A2 + Calc!A1");
+	report.set("A2", "=Missing!A1");
+	report.set("A3", "=Report!A1 + 1");
+	other.set("A1", "=2 * 21");
+
+	// Circular reference across sheets
+	other.set("B1", "=Report!B1");
+	report.set("B1", "=Other!B1");
+
+	std::cout << "CALCULATE" << std::endl;
+	w.calculate();
+	print(w);
+	std::cout << std::endl;
+
+	// Modification of one sheet is seen by the others
+	inputs.set("A1", "1");
+	std::cout << "CHANGED" << std::endl;
+	print(w);
+	std::cout << std::endl;
+
+	std::cout << "UNDO" << std::endl;
+	inputs.undo();
+	std::cout << "Report!A1 = " << report.evaluate("A1") << std::endl;
+	std::cout << std::endl;
+
+	std::cout << "REMOVE" << std::endl;
+	std::cout << "removed: " << w.remove_sheet("CALC") << std::endl;
+	std::cout << "removed: " << w.remove_sheet("CALC") << std::endl;
+	print(w);
+	std::cout << std::endl;
+
+	std::cout << "ERRORS" << std::endl;
+	try {
+		w.add_sheet("inputs");
+	} catch (const std::invalid_argument &e) {
+		std::cout << e.what() << std::endl;
+	}
+	try {
+		w.add_sheet("1st");
+	} catch (const std::invalid_argument &e) {
+		std::cout << e.what() << std::endl;
+	}
+	std::cout << std::endl;
+
+	// Shifting a sheet rewrites references to it in all sheets
+	workbook v(functions);
+	spreadsheet &data = v.add_sheet("Data");
+	spreadsheet &sums = v.add_sheet("Sums");
+	data.set("A1", "1");
+	data.set("A2", "2");
+	data.set("A3", "=data!A2 * 10");
+	sums.set("A1", "=Data!A1 + Data!A3");
+	sums.set("A2", "=A1 + DATA!A2");
+	sums.set("B1", "=A1 * 2");
+	std::cout << "BEFORE SHIFT" << std::endl;
+	print(v);
+	std::cout << std::endl;
+
+	data.insert_rows(0, 2);
+	sums.insert_rows(0);
+	std::cout << "INSERTED" << std::endl;
+	print(v);
+	std::cout << std::endl;
+
+	data.delete_rows(3);
+	data.delete_cols(0);
+	std::cout << "DELETED" << std::endl;
+	print(v);
+	std::cout << std::endl;
+
+	sums.undo();
+	std::cout << "UNDONE" << std::endl;
+	print(v);
+	std::cout << std::endl;
+
+	// References going to other sheet and back to the edited one
+	functions["NOW"] = new lifted_nullary_function("NOW", now, function_traits().set_volatile());
+	workbook u(functions);
+	spreadsheet &s1 = u.add_sheet("S1");
+	spreadsheet &s2 = u.add_sheet("S2");
+	s1.set("A1", "1");
+	s2.set("A1", "=S1!A1");
+	s1.set("B1", "=S2!A1 + 0");
+	s1.set("C1", "=B1 * 2");
+	s1.set("D1", "=NOW()");
+	s2.set("B1", "=S1!D1");
+	s1.set("E1", "=S2!B1 + 1");
+	std::cout << "ROUND TRIP" << std::endl;
+	print(u);
+	s1.set("A1", "5");
+	std::cout << "EDITED" << std::endl;
+	print(u);
+	clock_ticks = 10;
+	u.tick();
+	std::cout << "TICKED" << std::endl;
+	print(u);
+
+	for (auto &p : functions) {
+		delete p.second;
+	}
+}
+
+int main() {
+	test();
+	return 0;
+}
@@ -0,0 +1,276 @@
+#include "topology.hh"
+#include "definitions.hh"
+
+#include <algorithm>
+#include <unordered_set>
+
+typedef std::unordered_set<cellindex, cellindex_hash> cellset;
+
+reference_graph::node &reference_graph::precedent_node(const cellindex &cell) {
+	auto iter = m_nodes.find(cell);
+	if (iter != m_nodes.end()) {
+		return iter->second;
+	}
+
+	// Without precedents it can be first, then references from it are in order.
+	node &n = m_nodes[cell];
+	n.ord = --m_low;
+	return n;
+}
+
+void reference_graph::set(const cellindex &cell, const std::vector<cellindex> &precedents, std::vector<cellindex> &changed) {
+	auto iter = m_nodes.find(cell);
+	if (iter == m_nodes.end()) {
+		// Without dependents it can be last.
+		m_nodes[cell].ord = ++m_high;
+	}
+	m_nodes[cell].formula = true;
+	bool removed = unlink(cell, changed);
+
+	cellset seen;
+	for (const cellindex &p : precedents) {
+		if (seen.insert(p).second) {
+			add(p, cell, changed);
+		}
+	}
+
+	if (removed && !m_closing.empty()) {
+		retry_cycles(changed);
+	}
+}
+
+void reference_graph::remove(const cellindex &cell, std::vector<cellindex> &changed) {
+	auto iter = m_nodes.find(cell);
+	if (iter == m_nodes.end()) {
+		return;
+	}
+
+	bool removed = unlink(cell, changed);
+	iter = m_nodes.find(cell);
+	iter->second.formula = false;
+	if (iter->second.dependents.empty()) {
+		m_nodes.erase(iter);
+	}
+
+	if (removed && !m_closing.empty()) {
+		retry_cycles(changed);
+	}
+}
+
+bool reference_graph::unlink(const cellindex &cell, std::vector<cellindex> &changed) {
+	node &n = m_nodes[cell];
+	bool removed = !n.precedents.empty();
+	for (const cellindex &p : n.precedents) {
+		auto iter = m_nodes.find(p);
+		// cellindex is not assignable, so the vector is copied without the cell
+		std::vector<cellindex> dependents;
+		for (const cellindex &d : iter->second.dependents) {
+			if (!(d == cell)) {
+				dependents.push_back(d);
+			}
+		}
+		iter->second.dependents.swap(dependents);
+		if (iter->second.dependents.empty() && !iter->second.formula) {
+			m_nodes.erase(iter);
+		}
+	}
+	std::vector<cellindex>().swap(n.precedents);
+
+	for (auto iter = m_closing.begin(); iter != m_closing.end();) {
+		if (iter->first.second == cell) {
+			count_cycle(iter->second, -1, changed);
+			iter = m_closing.erase(iter);
+			removed = true;
+		} else {
+			++iter;
+		}
+	}
+	return removed;
+}
+
+void reference_graph::retry_cycles(std::vector<cellindex> &changed) {
+	std::map<edge, std::vector<cellindex> > closing;
+	closing.swap(m_closing);
+	for (auto &p : closing) {
+		count_cycle(p.second, -1, changed);
+	}
+	for (auto &p : closing) {
+		add(p.first.first, p.first.second, changed);
+	}
+}
+
+void reference_graph::count_cycle(const std::vector<cellindex> &cells, int delta, std::vector<cellindex> &changed) {
+	for (const cellindex &c : cells) {
+		unsigned int &count = m_cycles[c];
+		count += delta;
+		if (count == 0) {
+			m_cycles.erase(c);
+			changed.push_back(c);
+		} else if (count == 1 && delta > 0) {
+			changed.push_back(c);
+		}
+	}
+}
+
+void reference_graph::add(const cellindex &precedent, const cellindex &dependent, std::vector<cellindex> &changed) {
+	precedent_node(precedent);
+	node &x = m_nodes[precedent];
+	node &y = m_nodes[dependent];
+
+	if (x.ord < y.ord) {
+		x.dependents.push_back(dependent);
+		y.precedents.push_back(precedent);
+		return;
+	}
+
+	// Forward from the dependent through the cells ordered before the precedent.
+	std::vector<cellindex> forward;
+	cellset seen_forward;
+	bool cycle = precedent == dependent;
+	std::vector<cellindex> stack(1, dependent);
+	seen_forward.insert(dependent);
+	while (!stack.empty()) {
+		cellindex c = stack.back();
+		stack.pop_back();
+		forward.push_back(c);
+		for (const cellindex &d : m_nodes[c].dependents) {
+			if (d == precedent) {
+				cycle = true;
+			} else if (m_nodes[d].ord < x.ord && seen_forward.insert(d).second) {
+				stack.push_back(d);
+			}
+		}
+	}
+
+	if (cycle) {
+		// Cells of the cycle are the ones found forward which reach the precedent.
+		std::vector<cellindex> cells(1, precedent);
+		cellset seen(cells.begin(), cells.end());
+		stack.push_back(precedent);
+		while (!stack.empty()) {
+			cellindex c = stack.back();
+			stack.pop_back();
+			for (const cellindex &p : m_nodes[c].precedents) {
+				if (seen_forward.find(p) != seen_forward.end() && seen.insert(p).second) {
+					cells.push_back(p);
+					stack.push_back(p);
+				}
+			}
+		}
+		if (seen.insert(dependent).second) {
+			cells.push_back(dependent);
+		}
+		count_cycle(cells, 1, changed);
+		m_closing[edge(precedent, dependent)].swap(cells);
+		return;
+	}
+
+	// Backward from the precedent through the cells ordered after the dependent.
+	std::vector<cellindex> backward;
+	cellset seen_backward;
+	stack.push_back(precedent);
+	seen_backward.insert(precedent);
+	while (!stack.empty()) {
+		cellindex c = stack.back();
+		stack.pop_back();
+		backward.push_back(c);
+		for (const cellindex &p : m_nodes[c].precedents) {
+			if (m_nodes[p].ord > y.ord && seen_backward.insert(p).second) {
+				stack.push_back(p);
+			}
+		}
+	}
+
+	// Backward cells take the smallest of the orders, keeping their relative order.
+	// Keys of the nodes are sorted by pointers, cellindex is not assignable.
+	std::vector<std::pair<long long, const cellindex *> > moved;
+	for (const cellindex &c : backward) {
+		auto iter = m_nodes.find(c);
+		moved.push_back(std::make_pair(iter->second.ord, &iter->first));
+	}
+	std::sort(moved.begin(), moved.end());
+	std::size_t backward_size = moved.size();
+	for (const cellindex &c : forward) {
+		auto iter = m_nodes.find(c);
+		moved.push_back(std::make_pair(iter->second.ord, &iter->first));
+	}
+	std::sort(moved.begin() + backward_size, moved.end());
+
+	std::vector<long long> ords;
+	for (auto &p : moved) {
+		ords.push_back(p.first);
+	}
+	std::sort(ords.begin(), ords.end());
+	for (std::size_t k = 0; k < moved.size(); k++) {
+		m_nodes[*moved[k].second].ord = ords[k];
+	}
+
+	x.dependents.push_back(dependent);
+	y.precedents.push_back(precedent);
+}
+
+std::vector<cellindex> reference_graph::order() const {
+	// Orders are sparse after reordering and removal, sorted once per call.
+	std::vector<std::pair<long long, const cellindex *> > ords;
+	ords.reserve(m_nodes.size());
+	for (auto &p : m_nodes) {
+		ords.push_back(std::make_pair(p.second.ord, &p.first));
+	}
+	std::sort(ords.begin(), ords.end());
+
+	std::vector<cellindex> ret;
+	ret.reserve(ords.size());
+	for (auto &p : ords) {
+		ret.push_back(*p.second);
+	}
+	return ret;
+}
+
+std::vector<cellindex> reference_graph::cone(const std::vector<cellindex> &cells) const {
+	std::vector<std::pair<long long, const cellindex *> > ords;
+	cellset seen;
+	std::vector<const cellindex *> stack;
+	for (const cellindex &c : cells) {
+		auto iter = m_nodes.find(c);
+		if (iter != m_nodes.end() && seen.insert(c).second) {
+			stack.push_back(&iter->first);
+		}
+	}
+	while (!stack.empty()) {
+		const node &n = m_nodes.find(*stack.back())->second;
+		ords.push_back(std::make_pair(n.ord, stack.back()));
+		stack.pop_back();
+		for (const cellindex &p : n.precedents) {
+			if (seen.insert(p).second) {
+				stack.push_back(&m_nodes.find(p)->first);
+			}
+		}
+	}
+	std::sort(ords.begin(), ords.end());
+
+	std::vector<cellindex> ret;
+	ret.reserve(ords.size());
+	for (auto &p : ords) {
+		ret.push_back(*p.second);
+	}
+	return ret;
+}
+
+void reference_graph::clear() {
+	m_nodes.clear();
+	m_closing.clear();
+	m_cycles.clear();
+	m_low = 0;
+	m_high = 0;
+}
+
+std::size_t reference_graph::memory_usage() const {
+	std::size_t ret = hash_usage(m_nodes) + tree_usage(m_closing) + hash_usage(m_cycles);
+	for (auto &p : m_nodes) {
+		ret += (p.second.precedents.capacity() + p.second.dependents.capacity()) * sizeof(cellindex);
+	}
+	for (auto &p : m_closing) {
+		ret += p.second.capacity() * sizeof(cellindex);
+	}
+	return ret;
+}
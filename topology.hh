@@ -0,0 +1,89 @@
+/** \file References between cells in topological order. */
+
+#ifndef TOPOLOGY_HH
+#define TOPOLOGY_HH
+
+#include <map>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "cellindex.hh"
+
+/** Static references between cells, kept in topological order as formulas are set.
+ *
+ * Order is maintained incrementally (Pearce-Kelly): adding a reference against the order
+ * reorders only the cells between the two, and finds the cycle if the reference closes one.
+ * Reference closing a cycle is kept aside, and its cells are cyclic until the cycle is broken.
+ * Every cycle of the references contains a cyclic cell.
+ */
+class reference_graph {
+public:
+	reference_graph() : m_low(0), m_high(0) {}
+
+	/** Replace the precedents of the cell.
+	 * Cells which became, or stopped being cyclic are appended to `changed`.
+	 */
+	void set(const cellindex &cell, const std::vector<cellindex> &precedents, std::vector<cellindex> &changed);
+
+	/** Remove the cell and its precedents. */
+	void remove(const cellindex &cell, std::vector<cellindex> &changed);
+
+	/** Cell is on a cycle of references. */
+	bool cyclic(const cellindex &cell) const {
+		return m_cycles.find(cell) != m_cycles.end();
+	}
+
+	/** All cells, precedents before their dependents. Cells of one cycle are in any order. */
+	std::vector<cellindex> order() const;
+
+	/** The cells and their transitive precedents, in the order of `order`. */
+	std::vector<cellindex> cone(const std::vector<cellindex> &cells) const;
+
+	void clear();
+
+	/** Memory used by the graph, in bytes. */
+	std::size_t memory_usage() const;
+
+private:
+	struct node {
+		node() : ord(0), formula(false) {}
+
+		long long ord;
+		/** Precedents were set, cell stays in the order without dependents. */
+		bool formula;
+		std::vector<cellindex> precedents;
+		std::vector<cellindex> dependents;
+	};
+
+	typedef std::unordered_map<cellindex, node, cellindex_hash> node_map;
+	typedef std::pair<cellindex, cellindex> edge;
+
+	/** Node of the cell, new precedent is placed before all cells. */
+	node &precedent_node(const cellindex &cell);
+
+	/** Add reference, in order or aside if it closes a cycle. */
+	void add(const cellindex &precedent, const cellindex &dependent, std::vector<cellindex> &changed);
+
+	/** Remove references to the cell. Returns true if any was removed. */
+	bool unlink(const cellindex &cell, std::vector<cellindex> &changed);
+
+	/** Add the references closing cycles again, after some reference was removed. */
+	void retry_cycles(std::vector<cellindex> &changed);
+
+	void count_cycle(const std::vector<cellindex> &cells, int delta, std::vector<cellindex> &changed);
+
+	node_map m_nodes;
+
+	/** References closing cycles, with the cells of the cycle. */
+	std::map<edge, std::vector<cellindex> > m_closing;
+
+	/** Number of cycles each cyclic cell is on. */
+	std::unordered_map<cellindex, unsigned int, cellindex_hash> m_cycles;
+
+	/** Orders given to new cells, before and after all existing ones. */
+	long long m_low;
+	long long m_high;
+};
+
+#endif
@@ -0,0 +1,105 @@
+#include "trace.hh"
+
+#include <algorithm>
+#include <iomanip>
+
+/** Small sequential id of the calling thread, readable in the trace. */
+static unsigned int thread_id() {
+	static std::atomic<unsigned int> next(0);
+	thread_local unsigned int id = ++next;
+	return id;
+}
+
+static std::size_t power_of_two(std::size_t n) {
+	std::size_t ret = 1;
+	while (ret < n) {
+		ret *= 2;
+	}
+	return ret;
+}
+
+tracer::tracer(std::size_t capacity)
+	: m_enabled(false), m_start(clock::now()), m_mask(power_of_two(capacity) - 1), m_slots(new slot[m_mask + 1]), m_next(0) {}
+
+void tracer::record(const char *name, const cellindex *cell, clock::time_point begin, clock::time_point end) {
+	std::uint64_t ticket = m_next.fetch_add(1, std::memory_order_relaxed);
+	slot &s = m_slots[ticket & m_mask];
+
+	s.sequence.store(2 * ticket + 1, std::memory_order_relaxed);
+	std::atomic_thread_fence(std::memory_order_release);
+	s.name.store(name, std::memory_order_relaxed);
+	s.begin.store(std::chrono::duration_cast<std::chrono::nanoseconds>(begin - m_start).count(), std::memory_order_relaxed);
+	s.duration.store(std::chrono::duration_cast<std::chrono::nanoseconds>(end - begin).count(), std::memory_order_relaxed);
+	s.thread.store(thread_id(), std::memory_order_relaxed);
+	s.col.store(cell != nullptr ? cell->col : ~0u, std::memory_order_relaxed);
+	s.row.store(cell != nullptr ? cell->row : ~0u, std::memory_order_relaxed);
+	s.sequence.store(2 * ticket + 2, std::memory_order_release);
+}
+
+std::vector<trace_event> tracer::events() const {
+	std::vector<trace_event> ret;
+	for (std::size_t k = 0; k <= m_mask; k++) {
+		const slot &s = m_slots[k];
+		std::uint64_t sequence = s.sequence.load(std::memory_order_acquire);
+		if (sequence == 0 || sequence % 2 == 1) {
+			continue;
+		}
+
+		trace_event e;
+		e.name = s.name.load(std::memory_order_relaxed);
+		e.begin = s.begin.load(std::memory_order_relaxed) / 1000.0;
+		e.duration = s.duration.load(std::memory_order_relaxed) / 1000.0;
+		e.thread = s.thread.load(std::memory_order_relaxed);
+		e.col = s.col.load(std::memory_order_relaxed);
+		e.row = s.row.load(std::memory_order_relaxed);
+		e.has_cell = e.col != ~0u;
+
+		// Slot rewritten while reading, the span is lost.
+		std::atomic_thread_fence(std::memory_order_acquire);
+		if (s.sequence.load(std::memory_order_relaxed) == sequence) {
+			ret.push_back(e);
+		}
+	}
+
+	std::sort(ret.begin(), ret.end(), [](const trace_event &a, const trace_event &b) {
+		return a.begin < b.begin;
+	});
+	return ret;
+}
+
+std::size_t tracer::dropped() const {
+	std::uint64_t n = m_next.load(std::memory_order_relaxed);
+	return n > m_mask + 1 ? n - (m_mask + 1) : 0;
+}
+
+void tracer::write_json(std::ostream &os) const {
+	// Microseconds with nanoseconds, also for long traces.
+	std::ios::fmtflags flags = os.flags();
+	std::streamsize precision = os.precision();
+	os << std::fixed << std::setprecision(3);
+
+	os << "{\"traceEvents\":[";
+	bool first = true;
+	for (const trace_event &e : events()) {
+		os << (first ? "" : ",")
+			<< "{\"name\":\"" << e.name << "\",\"ph\":\"X\",\"pid\":1"
+			<< ",\"tid\":" << e.thread
+			<< ",\"ts\":" << e.begin
+			<< ",\"dur\":" << e.duration;
+		if (e.has_cell) {
+			os << ",\"args\":{\"cell\":\"" << cellindex(e.col, e.row) << "\"}";
+		}
+		os << "}";
+		first = false;
+	}
+	os << "],\"displayTimeUnit\":\"ns\"}";
+	os.flags(flags);
+	os.precision(precision);
+}
+
+void tracer::clear() {
+	for (std::size_t k = 0; k <= m_mask; k++) {
+		m_slots[k].sequence.store(0, std::memory_order_relaxed);
+	}
+	m_next.store(0, std::memory_order_relaxed);
+}
@@ -0,0 +1,118 @@
+/** \file Timeline tracer of spans, in Chrome trace-event format. */
+
+#ifndef TRACE_HH
+#define TRACE_HH
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <ostream>
+#include <vector>
+
+#include "cellindex.hh"
+
+/** Recorded span, times in microseconds since the tracer was created. */
+struct trace_event {
+	const char *name;
+	double begin;
+	double duration;
+	unsigned int thread;
+
+	/** Cell the span is about, if `has_cell`. */
+	bool has_cell;
+	unsigned int col;
+	unsigned int row;
+};
+
+/** Records spans of work with their threads into fixed size ring buffer,
+ * the oldest spans are overwritten. Recording is lock-free, threads only
+ * reserve slots by atomic increment. Disabled tracer costs one relaxed load per span.
+ *
+ * Written JSON can be opened in chrome://tracing or Perfetto.
+ *
+ * \sa spreadsheet::set_tracer, trace_scope
+ */
+class tracer {
+public:
+	typedef std::chrono::steady_clock clock;
+
+	/** Capacity is rounded up to power of two. */
+	explicit tracer(std::size_t capacity = 65536);
+
+	void enable(bool on = true) {
+		m_enabled.store(on, std::memory_order_relaxed);
+	}
+
+	bool enabled() const {
+		return m_enabled.load(std::memory_order_relaxed);
+	}
+
+	/** Record span, `name` must be a string literal. */
+	void record(const char *name, const cellindex *cell, clock::time_point begin, clock::time_point end);
+
+	/** Spans in the buffer, ordered by their begin. Spans being recorded are skipped. */
+	std::vector<trace_event> events() const;
+
+	/** Number of spans overwritten, as the buffer was full. */
+	std::size_t dropped() const;
+
+	/** Write spans as Chrome trace-event JSON object. */
+	void write_json(std::ostream &os) const;
+
+	/** Forget recorded spans, must not run concurrently with recording. */
+	void clear();
+
+private:
+	tracer(const tracer &);
+	tracer &operator=(const tracer &);
+
+	/** Slot of the ring. Sequence is odd while the slot is written, readers check it
+	 * did not change while they read the fields.
+	 */
+	struct slot {
+		slot() : sequence(0), name(nullptr), begin(0), duration(0), thread(0), col(0), row(0) {}
+
+		std::atomic<std::uint64_t> sequence;
+		std::atomic<const char *> name;
+		std::atomic<std::int64_t> begin;
+		std::atomic<std::int64_t> duration;
+		std::atomic<unsigned int> thread;
+		std::atomic<unsigned int> col;
+		std::atomic<unsigned int> row;
+	};
+
+	std::atomic<bool> m_enabled;
+	clock::time_point m_start;
+	std::size_t m_mask;
+	std::unique_ptr<slot[]> m_slots;
+	std::atomic<std::uint64_t> m_next;
+};
+
+/** RAII span, recorded into the tracer when it is enabled. Tracer can be nullptr. */
+class trace_scope {
+public:
+	trace_scope(tracer *t, const char *name, const cellindex *cell = nullptr)
+		: m_tracer(t != nullptr && t->enabled() ? t : nullptr), m_name(name), m_cell(cell) {
+		if (m_tracer != nullptr) {
+			m_begin = tracer::clock::now();
+		}
+	}
+
+	~trace_scope() {
+		if (m_tracer != nullptr) {
+			m_tracer->record(m_name, m_cell, m_begin, tracer::clock::now());
+		}
+	}
+
+private:
+	trace_scope(const trace_scope &);
+	trace_scope &operator=(const trace_scope &);
+
+	tracer *m_tracer;
+	const char *m_name;
+	const cellindex *m_cell;
+	tracer::clock::time_point m_begin;
+};
+
+#endif
@@ -0,0 +1,265 @@
+#include "workbook.hh"
+#include "exceptions.hh"
+
+#include <cctype>
+#include <stdexcept>
+#include <thread>
+
+static std::string upper(const std::string &s) {
+	std::string ret(s);
+	for (char &c : ret) {
+		c = std::toupper(static_cast<unsigned char>(c));
+	}
+	return ret;
+}
+
+static bool valid_name(const std::string &name) {
+	if (name.empty() || !std::isalpha(static_cast<unsigned char>(name[0]))) {
+		return false;
+	}
+	for (char c : name) {
+		if (!std::isalnum(static_cast<unsigned char>(c))) {
+			return false;
+		}
+	}
+	return true;
+}
+
+/** Cells of other sheets being evaluated by this thread.
+ * Each sheet evaluates with its own evaluation stack, so circular references
+ * across sheets are found here.
+ */
+static thread_local std::set<std::pair<const spreadsheet *, std::pair<unsigned int, unsigned int> > > cross_sheet_stack;
+
+/** Helper RAII class pushing the cell to the cross sheet stack. */
+class cross_sheet_lookup {
+public:
+	cross_sheet_lookup(const spreadsheet *s, const cellindex &index) : key(s, std::make_pair(index.col, index.row)) {
+		if (!cross_sheet_stack.insert(key).second) {
+			throw evaluation_error("circular reference");
+		}
+	}
+
+	~cross_sheet_lookup() {
+		cross_sheet_stack.erase(key);
+	}
+
+private:
+	std::pair<const spreadsheet *, std::pair<unsigned int, unsigned int> > key;
+};
+
+spreadsheet &workbook::add_sheet(const std::string &name) {
+	if (!valid_name(name)) {
+		throw std::invalid_argument("invalid sheet name -- " + name);
+	}
+	if (m_names.find(upper(name)) != m_names.end()) {
+		throw std::invalid_argument("duplicate sheet name -- " + name);
+	}
+
+	std::unique_ptr<spreadsheet> s(new spreadsheet(m_functions, m_lazy));
+	s->m_workbook = this;
+	s->m_state.link = this;
+
+	spreadsheet &ret = *s;
+	m_names.insert(std::make_pair(upper(name), s.get()));
+	m_sheets.push_back(std::make_pair(name, std::move(s)));
+
+	// References to the sheet were errors before
+	invalidate_except(&ret);
+	return ret;
+}
+
+spreadsheet *workbook::sheet(const std::string &name) {
+	auto iter = m_names.find(upper(name));
+	return iter == m_names.end() ? nullptr : iter->second;
+}
+
+const spreadsheet *workbook::sheet(const std::string &name) const {
+	auto iter = m_names.find(upper(name));
+	return iter == m_names.end() ? nullptr : iter->second;
+}
+
+bool workbook::remove_sheet(const std::string &name) {
+	auto iter = m_names.find(upper(name));
+	if (iter == m_names.end()) {
+		return false;
+	}
+
+	const spreadsheet *removed = iter->second;
+	m_names.erase(iter);
+	for (auto sheet_iter = m_sheets.begin(); sheet_iter != m_sheets.end(); ++sheet_iter) {
+		if (sheet_iter->second.get() == removed) {
+			m_sheets.erase(sheet_iter);
+			break;
+		}
+	}
+
+	invalidate_except(nullptr);
+	return true;
+}
+
+std::vector<std::string> workbook::sheet_names() const {
+	std::vector<std::string> ret;
+	for (auto &p : m_sheets) {
+		ret.push_back(p.first);
+	}
+	return ret;
+}
+
+double workbook::find(const std::string &name, const cellindex &index) const {
+	const spreadsheet *s = sheet(name);
+	if (s == nullptr) {
+		throw evaluation_error("no sheet -- " + name);
+	}
+
+	cross_sheet_lookup lookup(s, index);
+	return s->m_contents.value(index, s->m_state);
+}
+
+std::string workbook::name(const spreadsheet *s) const {
+	for (auto &p : m_sheets) {
+		if (p.second.get() == s) {
+			return p.first;
+		}
+	}
+	return std::string();
+}
+
+void workbook::shift_references(const spreadsheet *shifted, const reference_shift &shift) {
+	reference_shift other = shift;
+	other.local = false;
+	for (auto &p : m_sheets) {
+		if (p.second.get() != shifted) {
+			p.second->rewrite_references(other);
+		}
+	}
+}
+
+void workbook::invalidate_except(const spreadsheet *changed) {
+	for (auto &p : m_sheets) {
+		if (p.second.get() != changed) {
+			p.second->forget_values();
+		}
+	}
+}
+
+std::map<const spreadsheet *, std::set<const spreadsheet *> > workbook::references() const {
+	std::map<const spreadsheet *, std::set<const spreadsheet *> > ret;
+	for (auto &p : m_sheets) {
+		std::set<std::string> names;
+		for (auto &c : p.second->m_contents.cells) {
+			if (c.second.ast) {
+				c.second.ast->sheets(names);
+			}
+		}
+
+		std::set<const spreadsheet *> &referenced = ret[p.second.get()];
+		for (const std::string &name : names) {
+			const spreadsheet *s = sheet(name);
+			if (s != nullptr) {
+				referenced.insert(s);
+			}
+		}
+	}
+	return ret;
+}
+
+std::vector<std::vector<const spreadsheet *> > workbook::levels() const {
+	std::map<const spreadsheet *, std::set<const spreadsheet *> > waiting = references();
+	for (auto &p : waiting) {
+		p.second.erase(p.first);
+	}
+
+	std::vector<std::vector<const spreadsheet *> > ret;
+	while (!waiting.empty()) {
+		std::vector<const spreadsheet *> level;
+		for (auto &p : waiting) {
+			if (p.second.empty()) {
+				level.push_back(p.first);
+			}
+		}
+
+		if (level.empty()) {
+			// only cycles are left
+			level.clear();
+			for (auto &p : waiting) {
+				level.push_back(p.first);
+			}
+			ret.push_back(level);
+			break;
+		}
+
+		for (const spreadsheet *s : level) {
+			waiting.erase(s);
+		}
+		for (auto &p : waiting) {
+			for (const spreadsheet *s : level) {
+				p.second.erase(s);
+			}
+		}
+		ret.push_back(level);
+	}
+	return ret;
+}
+
+void workbook::calculate() const {
+	for (auto &level : levels()) {
+		if (level.size() == 1) {
+			level.front()->calculate();
+			continue;
+		}
+
+		std::vector<std::thread> threads;
+		for (const spreadsheet *s : level) {
+			threads.push_back(std::thread([s]() {
+				s->calculate();
+			}));
+		}
+		for (std::thread &t : threads) {
+			t.join();
+		}
+	}
+}
+
+std::size_t workbook::tick() {
+	std::size_t ret = 0;
+	std::set<const spreadsheet *> ticked;
+	for (auto &p : m_sheets) {
+		std::size_t stale = p.second->tick();
+		if (stale > 0) {
+			ticked.insert(p.second.get());
+			ret += stale;
+		}
+	}
+
+	// Sheets referencing ticked sheets, also indirectly, and the ticked sheets reading them back.
+	std::map<const spreadsheet *, std::set<const spreadsheet *> > refs = references();
+	std::set<const spreadsheet *> affected = ticked;
+	bool changed = !affected.empty();
+	while (changed) {
+		changed = false;
+		for (auto &p : refs) {
+			if (affected.count(p.first) != 0) {
+				continue;
+			}
+			for (const spreadsheet *s : p.second) {
+				if (affected.count(s) != 0) {
+					affected.insert(p.first);
+					changed = true;
+					break;
+				}
+			}
+		}
+	}
+
+	// Only the cells reading other sheets, and their dependents, can see the ticked values.
+	for (auto &p : m_sheets) {
+		for (const spreadsheet *s : refs[p.second.get()]) {
+			if (affected.count(s) != 0) {
+				p.second->forget_external();
+				break;
+			}
+		}
+	}
+	return ret;
+}
@@ -0,0 +1,95 @@
+/** \file Workbook of sheets. */
+
+#ifndef WORKBOOK_HH
+#define WORKBOOK_HH
+
+#include <map>
+#include <memory>
+#include <set>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "spreadsheet.hh"
+
+/** Sheets sharing one set of functions, formulas can reference cells of other sheets eg. Sheet2!A1.
+ * Sheet names are case insensitive, letters and digits starting with letter.
+ *
+ * Modifying a sheet forgets memoized values of the other sheets too, as they may reference it,
+ * and values of its cells reading other sheets, as they may read the modified cell back.
+ * Inserting or deleting rows or columns of a sheet rewrites references to it in all sheets.
+ * Circular references across sheets are evaluation errors, as within one sheet.
+ *
+ * \sa spreadsheet
+ */
+class workbook : public sheet_link {
+public:
+	workbook(const functionmap &fm, bool lazy = false)
+		: m_functions(std::make_shared<function_registry>(fm)), m_lazy(lazy) {}
+
+	/** Add empty sheet.
+	 *
+	 * @throw std::invalid_argument if the name is not valid or the sheet exists
+	 */
+	spreadsheet &add_sheet(const std::string &name);
+
+	/** Sheet by name, nullptr if there is no such sheet. */
+	spreadsheet *sheet(const std::string &name);
+	const spreadsheet *sheet(const std::string &name) const;
+
+	/** Remove the sheet. References to it become evaluation errors.
+	 * Returns false if there is no such sheet.
+	 */
+	bool remove_sheet(const std::string &name);
+
+	/** Names of the sheets in the order they were added. */
+	std::vector<std::string> sheet_names() const;
+
+	/** Evaluate all formulas of all sheets.
+	 * Sheets are calculated after the sheets they reference, independent sheets concurrently.
+	 */
+	void calculate() const;
+
+	/** Recompute volatile cells of all sheets, and forget values of the cells reading other sheets
+	 * which reference them, also indirectly or back in the ticked sheet.
+	 * Returns number of stale cells in the ticked sheets.
+	 */
+	std::size_t tick();
+
+	/** Evaluate cell of the named sheet, for the references between sheets. */
+	double find(const std::string &sheet, const cellindex &index) const;
+
+private:
+	friend class spreadsheet;
+
+	workbook(const workbook &);
+	workbook &operator=(const workbook &);
+
+	/** Name of the sheet as it was added. */
+	std::string name(const spreadsheet *s) const;
+
+	/** Rewrite references to the shifted sheet in the other sheets. */
+	void shift_references(const spreadsheet *shifted, const reference_shift &shift);
+
+	/** Forget memoized values of all sheets except the changed one. */
+	void invalidate_except(const spreadsheet *changed);
+
+	/** Sheets directly referenced by the formulas of each sheet. */
+	std::map<const spreadsheet *, std::set<const spreadsheet *> > references() const;
+
+	/** Sheets grouped into levels, so that sheets reference only sheets of earlier levels.
+	 * Sheets in reference cycles are in the last level.
+	 */
+	std::vector<std::vector<const spreadsheet *> > levels() const;
+
+	std::shared_ptr<const function_registry> m_functions;
+	bool m_lazy;
+
+	/** Sheets in the order they were added, with their names. */
+	std::vector<std::pair<std::string, std::unique_ptr<spreadsheet> > > m_sheets;
+
+	/** Upper case names of the sheets. */
+	std::map<std::string, spreadsheet *> m_names;
+};
+
+#endif